@@ -0,0 +1,83 @@
+// Measures entities per second for the per-entity TransformComponent path against every batched transform kernel
+// the running CPU supports. Build with -DVIONIS_BUILD_BENCHMARKS=ON.
+
+#include "vionis/components/transform_component.hpp"
+#include "vionis/transform_kernel.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+constexpr uint32_t ENTITY_COUNT = 100000;
+constexpr int ITERATIONS = 50;
+
+template <typename Fn>
+double entitiesPerSecond(Fn &&fn)
+{
+    fn();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        fn();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    return static_cast<double>(ENTITY_COUNT) * ITERATIONS / seconds;
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 random{42};
+    std::uniform_real_distribution<float> positions{-100.0f, 100.0f};
+    std::uniform_real_distribution<float> angles{-6.3f, 6.3f};
+    std::uniform_real_distribution<float> scales{0.1f, 4.0f};
+
+    std::vector<vionis::TransformComponent> components(ENTITY_COUNT);
+    std::vector<float> columns[9];
+    for (auto &column : columns)
+    {
+        column.resize(ENTITY_COUNT);
+    }
+
+    for (uint32_t i = 0; i < ENTITY_COUNT; i++)
+    {
+        auto &transform = components[i];
+        transform.position = {positions(random), positions(random), positions(random)};
+        transform.rotation = {angles(random), angles(random), angles(random)};
+        transform.scale = {scales(random), scales(random), scales(random)};
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            columns[axis][i] = transform.position[axis];
+            columns[3 + axis][i] = transform.rotation[axis];
+            columns[6 + axis][i] = transform.scale[axis];
+        }
+    }
+
+    vionis::TransformArrays transforms{columns[0].data(), columns[1].data(), columns[2].data(),
+                                       columns[3].data(), columns[4].data(), columns[5].data(),
+                                       columns[6].data(), columns[7].data(), columns[8].data()};
+    std::vector<glm::mat4> worldMatrices(ENTITY_COUNT);
+
+    double baseline = entitiesPerSecond([&]() {
+        for (uint32_t i = 0; i < ENTITY_COUNT; i++)
+        {
+            worldMatrices[i] = components[i].toMatrix();
+        }
+    });
+    std::printf("%-24s %12.2f M entities/s\n", "TransformComponent", baseline / 1e6);
+
+    for (const auto &kernel : vionis::supportedTransformKernels())
+    {
+        double rate = entitiesPerSecond([&]() { kernel.compute(transforms, ENTITY_COUNT, worldMatrices.data()); });
+        std::printf("%-24s %12.2f M entities/s  (%.2fx)\n", kernel.name, rate / 1e6, rate / baseline);
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "vionis/geometry.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- BoundingVolumeHierarchy ----------
+
+// Dynamic AABB tree over leaves that each carry a 32-bit user value. Leaves store their bounds enlarged by a margin,
+// so objects that move a little stay inside their fat box and do not touch the tree at all. When a leaf escapes its
+// box the leaf is refitted in place and its ancestors are widened, which is cheap but lets the tree degrade as objects
+// drift apart. The tree tracks the summed surface area of its internal nodes (the SAH cost) against the value it had
+// after the last rebuild, and needsRebuild() reports when a full top-down rebuild would pay off.
+//
+// Queries test fat bounds, so callers refine the reported leaves against their exact bounds where it matters. The
+// tree is not thread-safe for modification; concurrent queries are fine.
+class BoundingVolumeHierarchy
+{
+public:
+    static constexpr uint32_t INVALID_INDEX = ~0u;
+    // Trees with fewer leaves are left as insertion built them.
+    static constexpr uint32_t REBUILD_MIN_LEAVES = 64;
+    // Rebuild once the normalised SAH cost exceeds the cost right after the last rebuild by this factor.
+    static constexpr double REBUILD_COST_RATIO = 1.5;
+
+    explicit BoundingVolumeHierarchy(float margin = 0.1f);
+
+    // Adds a leaf and returns its proxy, which stays valid until remove() even across rebuilds.
+    uint32_t insert(const Aabb &bounds, uint32_t userData);
+    void remove(uint32_t proxy);
+
+    // Moves a leaf to new bounds. Returns false if the bounds still fit inside the leaf's fat box.
+    bool update(uint32_t proxy, const Aabb &bounds);
+
+    uint32_t userData(uint32_t proxy) const { return m_nodes[proxy].userData; }
+    const Aabb &fatBounds(uint32_t proxy) const { return m_nodes[proxy].bounds; }
+    uint32_t size() const { return m_leafCount; }
+
+    bool needsRebuild() const;
+
+    // Rebuilds the whole tree top-down with a binned SAH split. Proxies are preserved.
+    void rebuild();
+
+    // fn(uint32_t userData) is called for every leaf whose fat box overlaps the volume. Returning false stops the
+    // query.
+    template <typename Fn>
+    void query(const Aabb &bounds, Fn &&fn) const
+    {
+        traverse([&bounds](const Aabb &node) { return bounds.overlaps(node); }, fn);
+    }
+
+    template <typename Fn>
+    void query(const Sphere &sphere, Fn &&fn) const
+    {
+        traverse([&sphere](const Aabb &node) { return sphere.overlaps(node); }, fn);
+    }
+
+    template <typename Fn>
+    void query(const Frustum &frustum, Fn &&fn) const
+    {
+        traverse([&frustum](const Aabb &node) { return frustum.overlaps(node); }, fn);
+    }
+
+    // fn(uint32_t userData, float maxDistance) is called for every leaf whose fat box the ray enters within
+    // maxDistance and returns the new maximum distance: the hit distance to clip the ray, maxDistance to ignore the
+    // leaf, or 0 to stop. Subtrees beyond the clipped distance are skipped.
+    template <typename Fn>
+    void raycast(const Ray &ray, float maxDistance, Fn &&fn) const
+    {
+        traverse([&ray, &maxDistance](const Aabb &node) { return ray.intersect(node, maxDistance) >= 0.0f; },
+                 [&fn, &maxDistance](uint32_t userData) {
+                     maxDistance = fn(userData, maxDistance);
+                     return maxDistance > 0.0f;
+                 });
+    }
+
+private:
+    struct Node
+    {
+        Aabb bounds;
+        uint32_t parent;
+        uint32_t children[2];
+        uint32_t userData;
+
+        bool isLeaf() const { return children[0] == INVALID_INDEX; }
+    };
+
+    template <typename Overlaps, typename Fn>
+    void traverse(Overlaps &&overlaps, Fn &&fn) const
+    {
+        if (m_root == INVALID_INDEX)
+        {
+            return;
+        }
+
+        // The tree is not kept balanced between rebuilds, so spill to the heap for unusually deep paths.
+        uint32_t localStack[64];
+        std::vector<uint32_t> heapStack;
+        uint32_t *stack = localStack;
+        uint32_t capacity = 64;
+        uint32_t top = 0;
+        stack[top++] = m_root;
+
+        while (top > 0)
+        {
+            const Node &node = m_nodes[stack[--top]];
+            if (!overlaps(node.bounds))
+            {
+                continue;
+            }
+
+            if (node.isLeaf())
+            {
+                if (!fn(node.userData))
+                {
+                    return;
+                }
+                continue;
+            }
+
+            if (top + 2 > capacity)
+            {
+                if (heapStack.empty())
+                {
+                    heapStack.assign(localStack, localStack + top);
+                }
+                capacity *= 2;
+                heapStack.resize(capacity);
+                stack = heapStack.data();
+            }
+            stack[top++] = node.children[1];
+            stack[top++] = node.children[0];
+        }
+    }
+
+    uint32_t allocateNode();
+    void freeNode(uint32_t node);
+    void insertLeaf(uint32_t leaf);
+    void removeLeaf(uint32_t leaf);
+    void refitAncestors(uint32_t node);
+    void setBounds(uint32_t node, const Aabb &bounds);
+    uint32_t buildRange(uint32_t *leaves, uint32_t count, uint32_t parent, uint32_t depth);
+
+    std::vector<Node> m_nodes;
+    uint32_t m_root{INVALID_INDEX};
+    uint32_t m_freeList{INVALID_INDEX};
+    uint32_t m_leafCount{0};
+    float m_margin;
+
+    // Summed surface area of the internal nodes, kept up to date by every structural change and refit.
+    double m_internalArea{0.0};
+    double m_rebuiltCost{0.0};
+};
+
+} // namespace vionis
@@ -25,6 +25,7 @@ public:
 
     void writeToIndex(void *data, int index);
     VkResult flushIndex(int index);
+    VkResult flushIndices(const uint32_t *sortedIndices, uint32_t count);
     VkDescriptorBufferInfo descriptorInfoForIndex(int index);
     VkResult invalidateIndex(int index);
 
@@ -43,7 +44,7 @@ private:
     Device &device;
     void *mapped = nullptr;
     VkBuffer buffer = VK_NULL_HANDLE;
-    VkDeviceMemory memory = VK_NULL_HANDLE;
+    MemoryAllocation memory;
 
     VkDeviceSize bufferSize;
     uint32_t instanceCount;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "vionis/device.hpp"
+#include "vionis/pipeline.hpp"
+
+#include <cstdint>
+
+namespace vionis
+{
+
+// ---------- CommandRecorder ----------
+
+// Records into a command buffer while tracking what is bound, so binds that would not change anything are skipped.
+// The tracked state only holds for one command buffer inside one render pass; use a new recorder for each.
+class CommandRecorder
+{
+public:
+    static constexpr uint32_t MAX_DESCRIPTOR_SETS = 4;
+
+    struct Stats
+    {
+        uint32_t pipelineBinds;
+        uint32_t descriptorSetBinds;
+        uint32_t vertexBufferBinds;
+        uint32_t indexBufferBinds;
+        uint32_t skippedBinds;
+        uint32_t drawCalls;
+
+        Stats &operator+=(const Stats &other)
+        {
+            pipelineBinds += other.pipelineBinds;
+            descriptorSetBinds += other.descriptorSetBinds;
+            vertexBufferBinds += other.vertexBufferBinds;
+            indexBufferBinds += other.indexBufferBinds;
+            skippedBinds += other.skippedBinds;
+            drawCalls += other.drawCalls;
+            return *this;
+        }
+    };
+
+    explicit CommandRecorder(VkCommandBuffer commandBuffer) : m_commandBuffer{commandBuffer} {}
+
+    CommandRecorder(const CommandRecorder &) = delete;
+    CommandRecorder &operator=(const CommandRecorder &) = delete;
+
+    VkCommandBuffer commandBuffer() const { return m_commandBuffer; }
+    const Stats &stats() const { return m_stats; }
+
+    void bindPipeline(Pipeline &pipeline);
+    void bindDescriptorSet(VkPipelineLayout layout, uint32_t setIndex, VkDescriptorSet set);
+    void bindVertexBuffer(VkBuffer buffer, VkDeviceSize offset = 0);
+    void bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkIndexType indexType = VK_INDEX_TYPE_UINT32);
+
+    void draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+    void drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset,
+                     uint32_t firstInstance);
+    void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+    void drawIndexedIndirectCount(Device &device, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer,
+                                  VkDeviceSize countBufferOffset, uint32_t maxDrawCount, uint32_t stride);
+
+private:
+    VkCommandBuffer m_commandBuffer;
+    Stats m_stats{};
+
+    Pipeline *m_pipeline{nullptr};
+    // Sets stay bound across layouts that are compatible up to their index, which the tracking does not try to
+    // prove, so a set only counts as bound for the layout it was bound with.
+    VkPipelineLayout m_setLayouts[MAX_DESCRIPTOR_SETS]{};
+    VkDescriptorSet m_sets[MAX_DESCRIPTOR_SETS]{};
+    VkBuffer m_vertexBuffer{VK_NULL_HANDLE};
+    VkDeviceSize m_vertexBufferOffset{0};
+    VkBuffer m_indexBuffer{VK_NULL_HANDLE};
+    VkDeviceSize m_indexBufferOffset{0};
+    VkIndexType m_indexType{VK_INDEX_TYPE_UINT32};
+};
+
+} // namespace vionis
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "vionis/camera.hpp"
+#include "vionis/geometry.hpp"
+
+#include <cstdint>
+
+namespace vionis
+{
+
+// ---------- SphereArrays ----------
+
+// Structure of arrays view over a batch of bounding spheres. Every pointer addresses count consecutive floats.
+struct SphereArrays
+{
+    const float *centerX;
+    const float *centerY;
+    const float *centerZ;
+    const float *radius;
+};
+
+// ---------- CullView ----------
+
+// What spheres are culled against. Besides the frustum test, a sphere is dropped when its radius is below
+// minRadius + minRadiusPerDistance * (distance to viewPosition), which is a projected size threshold expressed in
+// world space.
+struct CullView
+{
+    Frustum frustum;
+    glm::vec3 viewPosition;
+    float minRadius;
+    float minRadiusPerDistance;
+
+    // Culls against the camera's frustum and drops spheres whose projected diameter covers less than
+    // minProjectedSize of the viewport height. Works for perspective and orthographic projections.
+    static CullView fromCamera(const Camera &camera, float minProjectedSize);
+};
+
+// ---------- Sphere culling ----------
+
+// Writes 1 to visible[i] for every sphere that survives the view and 0 otherwise, testing four spheres per
+// instruction on x86. Spheres with a negative radius are always culled. Returns the number of visible spheres.
+uint32_t cullSpheres(const SphereArrays &spheres, uint32_t count, const CullView &view, uint8_t *visible);
+
+} // namespace vionis
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "vionis/descriptors.hpp"
+#include "vionis/device.hpp"
+#include "vionis/pipeline.hpp"
+#include "vionis/swapchain.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- DepthPyramid ----------
+
+// Hierarchical-Z buffer: a R32_SFLOAT mip chain in which every texel holds the farthest depth of the texels it covers
+// one level below. Level 0 has half the resolution of the depth buffer it is built from, the last level is 1x1. The
+// pyramid is built in the middle of a frame from the depth of what has been drawn so far, so the rest of the frame's
+// instances can be tested against those occluders.
+//
+// The image always stays in VK_IMAGE_LAYOUT_GENERAL and holds valid, if meaningless, contents from creation on, so
+// descriptors can point at it before the first build. Builds are ordered against earlier and later compute reads of
+// the pyramid by pipeline barriers, which also cover other frames in flight on the same queue.
+class DepthPyramid
+{
+public:
+    // Enough for depth buffers up to 65536 texels wide.
+    static constexpr uint32_t MAX_LEVELS = 16;
+
+    explicit DepthPyramid(Device &device);
+    ~DepthPyramid();
+
+    DepthPyramid(const DepthPyramid &) = delete;
+    DepthPyramid &operator=(const DepthPyramid &) = delete;
+
+    // Sizes the pyramid for a depth buffer. A new depth extent recreates the pyramid, which waits for the device to go
+    // idle, so it has to happen before anything of the frame that binds the pyramid is recorded.
+    void resize(VkExtent2D depthExtent);
+
+    // Records the reduction of a depth buffer of the extent last passed to resize() into the pyramid. The depth buffer
+    // must be in VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL with its writes made visible to compute shaders.
+    void build(VkCommandBuffer commandBuffer, int frameIndex, VkImageView depthView);
+
+    VkExtent2D extent() const { return m_extent; }
+    uint32_t levelCount() const { return static_cast<uint32_t>(m_levelViews.size()); }
+
+    // Changes whenever the image is recreated, so that descriptor sets pointing at it know to be rewritten.
+    uint64_t generation() const { return m_generation; }
+    VkDescriptorImageInfo descriptorInfo() const;
+
+private:
+    struct PushConstantData
+    {
+        glm::ivec2 sourceSize;
+        glm::ivec2 targetSize;
+    };
+
+    void createImage(VkExtent2D extent);
+    void destroyImage();
+    VkDescriptorSet getLevelDescriptorSet(int frameIndex, uint32_t level, VkImageView depthView);
+
+    Device &m_device;
+
+    VkImage m_image{VK_NULL_HANDLE};
+    MemoryAllocation m_imageMemory;
+    // View of the whole chain for sampling, and one view per level for the reduction.
+    VkImageView m_imageView{VK_NULL_HANDLE};
+    std::vector<VkImageView> m_levelViews;
+    VkSampler m_sampler{VK_NULL_HANDLE};
+    VkExtent2D m_extent{0, 0};
+    VkExtent2D m_depthExtent{0, 0};
+    uint64_t m_generation{0};
+
+    std::unique_ptr<DescriptorSetLayout> m_setLayout;
+    std::unique_ptr<DescriptorPool> m_descriptorPool;
+    VkPipelineLayout m_pipelineLayout{VK_NULL_HANDLE};
+    std::unique_ptr<ComputePipeline> m_pipeline;
+
+    // Per frame in flight: one set per level, and the depth buffer the first level's set reads from.
+    std::vector<std::vector<VkDescriptorSet>> m_levelSets{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    std::vector<VkImageView> m_depthViews = std::vector<VkImageView>(Swapchain::MAX_FRAMES_IN_FLIGHT, VK_NULL_HANDLE);
+};
+
+} // namespace vionis
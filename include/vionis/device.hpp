@@ -1,9 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "vionis/context.hpp"
+#include "vionis/memory_allocator.hpp"
+#include "vionis/upload_batcher.hpp"
 #include "vionis/window.hpp"
 
 namespace vionis
@@ -20,8 +23,12 @@ struct QueueFamilyIndices
 {
     uint32_t graphicsFamily;
     uint32_t presentFamily;
+    // Family and index of the queue uploads run on, if there is one besides the graphics queue.
+    uint32_t transferFamily;
+    uint32_t transferQueueIndex = 0;
     bool graphicsFamilyHasValue = false;
     bool presentFamilyHasValue = false;
+    bool transferFamilyHasValue = false;
 
     bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
 };
@@ -29,7 +36,8 @@ struct QueueFamilyIndices
 class Device
 {
 public:
-    Device(Context &context, Window &window);
+    // stagingRingSize: size of the staging ring of the upload batcher.
+    Device(Context &context, Window &window, VkDeviceSize stagingRingSize = StagingRing::DEFAULT_SIZE);
     ~Device();
 
     Device(const Device &) = delete;
@@ -38,13 +46,19 @@ public:
     Device &operator=(Device &&) = delete;
 
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer &buffer,
-                      VkDeviceMemory &bufferMemory);
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+                      MemoryAllocation &bufferMemory);
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0,
+                    VkDeviceSize dstOffset = 0);
     void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount);
     void createImageWithInfo(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties, VkImage &image,
-                             VkDeviceMemory &imageMemory);
+                             MemoryAllocation &imageMemory);
+    // Frees memory from createBuffer() or createImageWithInfo() once the resource bound to it is destroyed.
+    void freeMemory(MemoryAllocation &memory);
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,
                                uint32_t mipLevels = 1, uint32_t layerCount = 1);
+    void cmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
+                                  VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1,
+                                  uint32_t layerCount = 1);
 
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer commandBuffer);
@@ -58,14 +72,33 @@ public:
     float getMaxAnisotropy() const { return m_physicalDeviceProperties.limits.maxSamplerAnisotropy; }
 
     bool supportsAnisotropy() const { return m_physicalDeviceFeatures.samplerAnisotropy == VK_TRUE; }
+    bool supportsMultiDrawIndirect() const { return m_physicalDeviceFeatures.multiDrawIndirect == VK_TRUE; }
+    bool supportsDrawIndirectFirstInstance() const
+    {
+        return m_physicalDeviceFeatures.drawIndirectFirstInstance == VK_TRUE;
+    }
+    // VK_KHR_draw_indirect_count is enabled when the physical device offers it.
+    bool supportsDrawIndirectCount() const { return m_cmdDrawIndexedIndirectCount != nullptr; }
+
+    void cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+                                     VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+                                     uint32_t stride);
 
     VkDevice device() { return m_device; }
     VkPhysicalDevice physicalDevice() const { return m_physicalDevice; }
     VkPhysicalDeviceProperties physicalDeviceProperties() const { return m_physicalDeviceProperties; };
     VkPhysicalDeviceFeatures physicalDeviceFeatures() const { return m_physicalDeviceFeatures; };
     VkCommandPool getCommandPool() { return m_commandPool; }
+    MemoryAllocator &memoryAllocator() { return *m_allocator; }
+    UploadBatcher &uploadBatcher() { return *m_uploadBatcher; }
     VkQueue graphicsQueue() { return m_graphicsQueue; }
     VkQueue presentQueue() { return m_presentQueue; }
+    // Queue for streaming uploads, VK_NULL_HANDLE when they share the graphics queue.
+    VkQueue transferQueue() { return m_transferQueue; }
+    bool hasTransferQueue() const { return m_transferQueue != VK_NULL_HANDLE; }
+    VkCommandPool getTransferCommandPool() { return m_transferCommandPool; }
+    uint32_t graphicsQueueFamily() const { return m_queueFamilies.graphicsFamily; }
+    uint32_t transferQueueFamily() const { return m_queueFamilies.transferFamily; }
     VkSurfaceKHR surface() { return m_surface->get(); }
 
 #ifdef NDEBUG
@@ -82,6 +115,7 @@ private:
 
     bool isDeviceSuitable(VkPhysicalDevice device);
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+    bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char *extensionName);
 
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
     SwapchainSupportDetails querySwapchainSupport(VkPhysicalDevice device);
@@ -102,10 +136,18 @@ private:
 
     VkQueue m_graphicsQueue = VK_NULL_HANDLE;
     VkQueue m_presentQueue = VK_NULL_HANDLE;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
+    QueueFamilyIndices m_queueFamilies;
 
     VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkCommandPool m_transferCommandPool = VK_NULL_HANDLE;
+
+    std::unique_ptr<MemoryAllocator> m_allocator;
+    std::unique_ptr<UploadBatcher> m_uploadBatcher;
 
     const std::vector<const char *> m_deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+
+    PFN_vkCmdDrawIndexedIndirectCountKHR m_cmdDrawIndexedIndirectCount = nullptr;
 };
 
 } // namespace vionis
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- DrawSortKey ----------
+
+// 64-bit key that orders draws by the state they need, most expensive state change first:
+//
+//   | pass 4 | pipeline 8 | material 16 | vertex buffer 12 | mesh 12 | depth 12 |
+//
+// Fields hold small dense ids handed out by the caller. Ids beyond a field's range wrap around, which only costs
+// extra binds, never wrong draws.
+struct DrawSortKey
+{
+    uint32_t pass;
+    uint32_t pipeline;
+    uint32_t material;
+    uint32_t vertexBuffer;
+    uint32_t mesh;
+    // Quantized view depth, front to back for opaque passes.
+    uint32_t depth;
+
+    uint64_t pack() const
+    {
+        return (static_cast<uint64_t>(pass & 0xf) << 60) | (static_cast<uint64_t>(pipeline & 0xff) << 52) |
+               (static_cast<uint64_t>(material & 0xffff) << 36) | (static_cast<uint64_t>(vertexBuffer & 0xfff) << 24) |
+               (static_cast<uint64_t>(mesh & 0xfff) << 12) | static_cast<uint64_t>(depth & 0xfff);
+    }
+};
+
+// ---------- Radix sort ----------
+
+// Stable LSD radix sort of keys, carrying values along, one byte per pass. Passes over bytes that are equal in every
+// key are skipped, so keys that use few of their bits sort in few passes. The scratch vectors are resized as needed
+// and can be kept between calls.
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, std::vector<uint64_t> &keyScratch,
+               std::vector<uint32_t> &valueScratch);
+
+} // namespace vionis
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vionis/components/material_component.hpp"
+#include "vionis/components/transform_component.hpp"
+#include "vionis/model.hpp"
+#include "vionis/texture.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vionis
+{
+
+// An entity id packs the slot index in the low bits and a generation counter in the high bits. The slot index
+// addresses the registry tables and the per-entity GPU record; the generation is bumped every time the slot
+// is freed, so handles that outlive their entity no longer compare equal to the slot's current id.
+using EntityId = uint32_t;
+using ComponentMask = uint32_t;
+
+constexpr uint32_t ENTITY_INDEX_BITS = 20;
+constexpr uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+constexpr uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+
+constexpr uint32_t entityIndex(EntityId id) { return id & ENTITY_INDEX_MASK; }
+constexpr uint32_t entityGeneration(EntityId id) { return id >> ENTITY_INDEX_BITS; }
+constexpr EntityId makeEntityId(uint32_t index, uint32_t generation)
+{
+    return ((generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS) | (index & ENTITY_INDEX_MASK);
+}
+
+enum ComponentFlagBits : ComponentMask
+{
+    COMPONENT_TRANSFORM_BIT = 1u << 0,
+    COMPONENT_MATERIAL_BIT = 1u << 1,
+    COMPONENT_MODEL_BIT = 1u << 2,
+    COMPONENT_TEXTURE_BIT = 1u << 3,
+};
+
+// ---------- EntityArchetype ----------
+
+// Dense storage for every entity that owns exactly the same set of components. Each component lives in its own
+// contiguous array and row i of every array belongs to the same entity, so systems can walk the arrays linearly.
+// Arrays of components that are not part of the mask stay empty.
+class EntityArchetype
+{
+public:
+    explicit EntityArchetype(ComponentMask mask) : m_mask{mask} {}
+
+    EntityArchetype(const EntityArchetype &) = delete;
+    EntityArchetype &operator=(const EntityArchetype &) = delete;
+
+    ComponentMask mask() const { return m_mask; }
+    bool has(ComponentMask components) const { return (m_mask & components) == components; }
+
+    uint32_t size() const { return static_cast<uint32_t>(m_ids.size()); }
+    bool empty() const { return m_ids.empty(); }
+
+    uint32_t push(EntityId id);
+    EntityId swapRemove(uint32_t row);
+    uint32_t moveTo(uint32_t row, EntityArchetype &target);
+
+    const std::vector<EntityId> &ids() const { return m_ids; }
+    std::vector<TransformComponent> &transforms() { return m_transforms; }
+    std::vector<MaterialComponent> &materials() { return m_materials; }
+    std::vector<std::shared_ptr<Model>> &models() { return m_models; }
+    std::vector<std::shared_ptr<Texture>> &textures() { return m_textures; }
+
+    // Change tracking, present alongside the transform component. pendingFrames holds one bit per frame in flight
+    // whose GPU record still has to be rewritten; matricesDirty marks cached matrices that must be recomputed. Both
+    // start cleared on new rows, the registry flags them together with queueing the entity.
+    std::vector<glm::mat4> &worldMatrices() { return m_worldMatrices; }
+    std::vector<uint8_t> &pendingFrames() { return m_pendingFrames; }
+    std::vector<uint8_t> &matricesDirty() { return m_matricesDirty; }
+
+    static constexpr EntityId INVALID_ID = ~0u;
+
+private:
+    ComponentMask m_mask;
+
+    std::vector<EntityId> m_ids;
+    std::vector<TransformComponent> m_transforms;
+    std::vector<MaterialComponent> m_materials;
+    std::vector<std::shared_ptr<Model>> m_models;
+    std::vector<std::shared_ptr<Texture>> m_textures;
+
+    std::vector<glm::mat4> m_worldMatrices;
+    std::vector<uint8_t> m_pendingFrames;
+    std::vector<uint8_t> m_matricesDirty;
+};
+
+} // namespace vionis
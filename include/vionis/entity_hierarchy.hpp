@@ -0,0 +1,106 @@
+#pragma once
+
+#include "vionis/entity_archetype.hpp"
+#include "vionis/job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- EntityHierarchy ----------
+
+// Parent/child links between entities plus the data needed to propagate world transforms. Only entities that have a
+// parent or children take part; everything else stays on the flat path in EntityRegistry.
+//
+// Links are kept per entity slot as intrusive child/sibling lists. Linked entities are additionally laid out in
+// breadth-first order, one contiguous range per depth level, so a node's parent always precedes it and world
+// matrices can be propagated level by level, with every level processed in parallel. Since every level is the
+// concatenation of the children of the level above, the children of a run of nodes form a run as well, and
+// propagation only walks the runs below the changed nodes instead of the whole hierarchy. The layout is rebuilt
+// lazily after links change.
+class EntityHierarchy
+{
+public:
+    static constexpr uint32_t INVALID_INDEX = ~0u;
+
+    void setParent(EntityId child, EntityId parent);
+    void clearParent(EntityId child);
+    EntityId parent(EntityId child) const;
+
+    bool isLinked(EntityId entity) const
+    {
+        uint32_t slot = entityIndex(entity);
+        return slot < m_parent.size() && (m_parent[slot] != INVALID_INDEX || m_firstChild[slot] != INVALID_INDEX);
+    }
+
+    // Unlinks entity from its parent and turns its children into roots, which are appended to orphans.
+    void removeEntity(EntityId entity, std::vector<EntityId> &orphans);
+
+    bool layoutDirty() const { return m_layoutDirty; }
+
+    // Lays out the linked entities in breadth-first order and marks every node as changed.
+    void rebuild();
+
+    // Node index of entity in the breadth-first layout, INVALID_INDEX if it is not linked. Requires a clean layout.
+    uint32_t nodeIndex(EntityId entity) const
+    {
+        uint32_t slot = entityIndex(entity);
+        return slot < m_nodeOf.size() ? m_nodeOf[slot] : INVALID_INDEX;
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(m_entities.size()); }
+    const std::vector<EntityId> &entities() const { return m_entities; }
+
+    // Flags a node whose local matrix has to be refreshed before the next propagate().
+    void markChanged(uint32_t node)
+    {
+        if (!m_changed[node])
+        {
+            m_changed[node] = 1;
+            m_changedNodes.push_back(node);
+        }
+    }
+    const std::vector<uint32_t> &changedNodes() const { return m_changedNodes; }
+
+    // Local matrices are inputs, world matrices outputs.
+    std::vector<glm::mat4> &localMatrices() { return m_localMatrices; }
+    const std::vector<glm::mat4> &worldMatrices() const { return m_worldMatrices; }
+
+    // Recomputes the world matrices of every changed node and its descendants, level by level, and clears the
+    // changed nodes.
+    void propagate(JobSystem &jobSystem);
+    // Nodes whose world matrix the last propagate() recomputed, in breadth-first order.
+    const std::vector<uint32_t> &updatedNodes() const { return m_updatedNodes; }
+
+private:
+    void ensureSlot(uint32_t slot);
+    void unlink(uint32_t slot);
+
+    // Indexed by entity slot.
+    std::vector<EntityId> m_ids;
+    std::vector<uint32_t> m_parent;
+    std::vector<uint32_t> m_firstChild;
+    std::vector<uint32_t> m_nextSibling;
+    std::vector<uint32_t> m_prevSibling;
+    std::vector<uint32_t> m_nodeOf;
+
+    // Indexed by node, in breadth-first order.
+    std::vector<EntityId> m_entities;
+    std::vector<uint32_t> m_parentNodes;
+    // The children of node n are the nodes [m_childOffsets[n], m_childOffsets[n + 1]), one entry more than nodes.
+    std::vector<uint32_t> m_childOffsets;
+    std::vector<uint32_t> m_levelOffsets;
+    std::vector<glm::mat4> m_localMatrices;
+    std::vector<glm::mat4> m_worldMatrices;
+    std::vector<uint8_t> m_changed;
+    std::vector<uint32_t> m_changedNodes;
+    std::vector<uint32_t> m_updatedNodes;
+
+    bool m_layoutDirty{false};
+};
+
+} // namespace vionis
@@ -1,7 +1,12 @@
 #pragma once
 
+#include "vionis/bounding_volume_hierarchy.hpp"
 #include "vionis/components/material_component.hpp"
 #include "vionis/components/transform_component.hpp"
+#include "vionis/culling.hpp"
+#include "vionis/entity_archetype.hpp"
+#include "vionis/entity_hierarchy.hpp"
+#include "vionis/job_system.hpp"
 #include "vionis/swapchain.hpp"
 #include "vionis/model.hpp"
 #include "vionis/texture.hpp"
@@ -9,51 +14,68 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <cassert>
+#include <functional>
 #include <memory>
-#include <unordered_map>
+#include <queue>
+#include <vector>
 
 namespace vionis
 {
 
-// ---------- EntityUniformData ----------
+// ---------- EntityGpuData ----------
 
-struct EntityUniformData
+// Per-entity record in the instance storage buffer, read by the shaders as a std430 array indexed by the draw's
+// instance index. The model matrix is affine, so only its top three rows are stored; the normal matrix is derived
+// in the vertex shader from the upper 3x3 block. baseColor is packed as RGBA8 unorm.
+struct EntityGpuData
 {
-    glm::mat4 modelMatrix;
-    glm::mat4 normalMatrix;
-    glm::vec3 baseColor;
+    glm::vec4 modelRows[3];
+    uint32_t baseColor;
+    uint32_t padding[3];
 };
 
+static_assert(sizeof(EntityGpuData) == 64, "EntityGpuData must match the std430 stride used by the shaders");
+
 // ---------- EntityInstance forward declaration ----------
 
 class EntityRegistry;
 
+// Lightweight handle to an entity. The components themselves live in the registry's archetype arrays, so the
+// references returned by the accessors are only valid until the next structural change (create, component add or
+// remove) in the registry. The mutable transform() and material() accessors flag the entity as changed so its
+// uniform data gets rewritten; use the const overloads for read-only access. An entity with a parent interprets its
+// transform relative to the parent.
 class EntityInstance
 {
 public:
-    using ID = uint32_t;
-    using Map = std::unordered_map<ID, EntityInstance>;
+    using ID = EntityId;
+
+    ID getId() const { return id; }
+    bool valid() const;
 
-    EntityInstance(const EntityInstance &) = delete;
-    EntityInstance &operator=(const EntityInstance &) = delete;
+    ID getParentId() const;
+    void setParent(const EntityInstance &parent);
+    void clearParent();
 
-    EntityInstance(EntityInstance &&) = default;
-    EntityInstance &operator=(EntityInstance &&) = delete;
+    // Index of the entity's record in the instance buffers.
+    uint32_t getInstanceIndex() const { return entityIndex(id); }
 
-    ID getId() const { return id; }
+    TransformComponent &transform();
+    const TransformComponent &transform() const;
+    MaterialComponent &material();
+    const MaterialComponent &material() const;
 
-    VkDescriptorBufferInfo getUniformBufferInfo(int frameIndex) const;
+    const std::shared_ptr<Model> &model() const;
+    void setModel(std::shared_ptr<Model> model);
 
-    TransformComponent transformComponent;
-    MaterialComponent materialComponent;
-    std::shared_ptr<Model> model;
-    std::shared_ptr<Texture> diffuseTexture;
+    const std::shared_ptr<Texture> &diffuseTexture() const;
+    void setDiffuseTexture(std::shared_ptr<Texture> texture);
 
 private:
-    EntityInstance(ID entityId, const EntityRegistry &registry);
+    EntityInstance(ID entityId, EntityRegistry &registry);
 
     ID id;
-    const EntityRegistry &registryRef;
+    EntityRegistry *registry;
 
     friend class EntityRegistry;
 };
@@ -63,7 +85,7 @@ private:
 class EntityRegistry
 {
 public:
-    explicit EntityRegistry(Device &device);
+    EntityRegistry(Device &device, JobSystem &jobSystem);
 
     EntityRegistry(const EntityRegistry &) = delete;
     EntityRegistry &operator=(const EntityRegistry &) = delete;
@@ -71,30 +93,143 @@ public:
     EntityRegistry(EntityRegistry &&) = delete;
     EntityRegistry &operator=(EntityRegistry &&) = delete;
 
-    EntityInstance &createEntity()
+    EntityInstance createEntity();
+    void destroyEntity(EntityInstance::ID entityId);
+
+    void setParent(EntityInstance::ID child, EntityInstance::ID parent);
+    void clearParent(EntityInstance::ID child);
+
+    bool isAlive(EntityInstance::ID entityId) const
+    {
+        uint32_t index = entityIndex(entityId);
+        return index < m_locations.size() && m_locations[index].id == entityId && m_locations[index].archetype;
+    }
+
+    // The whole instance buffer of a frame. Buffers are replaced when they grow or shrink, and the replacement is
+    // created before the old buffer is released, so cached descriptors must be rewritten whenever the handle changes.
+    VkDescriptorBufferInfo getInstanceBufferInfo(int frameIndex) const
+    {
+        return m_instanceBuffers[frameIndex]->descriptorInfo();
+    }
+
+    // Recomputes the world matrices of entities whose transform changed, propagating through the hierarchy, and
+    // refits their leaves in the spatial index. Called by updateInstanceBuffers; call it directly to query the spatial
+    // index with up to date bounds earlier in the frame.
+    void updateTransforms();
+
+    // Updates transforms, then rewrites and flushes only the records of entities that changed since this frame's
+    // buffer was last written. The changed entities are split across the job system's workers.
+    void updateInstanceBuffers(int frameIndex);
+
+    // Spatial index over the world bounds of every entity with a model. Leaf user data is the entity id; leaves hold
+    // slightly enlarged bounds, refine against worldBounds() where exact results matter.
+    const BoundingVolumeHierarchy &spatialIndex() const { return m_spatialIndex; }
+
+    // World space bounds of an entity's model as of the last updateTransforms(). Invalid for entities without one.
+    const Aabb &worldBounds(EntityInstance::ID entityId) const
     {
-        assert(m_nextId < MAX_ENTITIES && "Max entity count exceeded!");
-        EntityInstance entity{m_nextId++, *this};
-        entity.diffuseTexture = m_defaultDiffuseTexture;
-        m_entities.emplace(entity.getId(), std::move(entity));
-        return m_entities.at(entity.getId());
+        static const Aabb none{};
+
+        assert(isAlive(entityId) && "Unknown or destroyed entity id");
+        uint32_t slot = entityIndex(entityId);
+        return m_spatialProxies[slot] != BoundingVolumeHierarchy::INVALID_INDEX ? m_worldBounds[slot] : none;
     }
 
-    VkDescriptorBufferInfo getEntityUniformBufferInfo(EntityInstance::ID entityId, int frameIndex) const
+    // World space bounding spheres of the entities' models, indexed by entity slot for [0, slotCount()), as of the
+    // last updateTransforms(). Slots without a model hold a negative radius.
+    SphereArrays worldSpheres() const
     {
-        return m_uniformBuffers[frameIndex]->descriptorInfoForIndex(entityId);
+        return {m_sphereCenterX.data(), m_sphereCenterY.data(), m_sphereCenterZ.data(), m_sphereRadii.data()};
     }
+    uint32_t slotCount() const { return m_slotHighWater; }
 
-    void updateUniformBuffers(int frameIndex);
+    // Closest entity whose world bounds the ray hits within maxDistance, or EntityArchetype::INVALID_ID.
+    EntityInstance::ID raycast(const Ray &ray, float maxDistance, float *hitDistance = nullptr) const;
+
+    // Calls fn(EntityArchetype &) for every non-empty archetype that owns at least the requested components.
+    template <typename Fn>
+    void forEachArchetype(ComponentMask required, Fn &&fn)
+    {
+        for (auto &archetype : m_archetypes)
+        {
+            if (archetype->has(required) && !archetype->empty())
+            {
+                fn(*archetype);
+            }
+        }
+    }
+
+    // Job system the registry spreads its updates over, for systems that work on its data.
+    JobSystem &jobSystem() const { return m_jobSystem; }
+
+    uint32_t entityCount() const { return static_cast<uint32_t>(m_locations.size() - m_freeSlots.size()); }
+
+    // Bumped whenever an entity is created or destroyed or changes its model or diffuse texture. Renderers keep
+    // their per-entity draw lists until it changes.
+    uint64_t drawListVersion() const { return m_drawListVersion; }
 
     static constexpr int MAX_ENTITIES = 100000;
-    EntityInstance::Map &entities() { return m_entities; }
+    // Slots reserved per frame in flight before the first growth.
+    static constexpr uint32_t INITIAL_CAPACITY = 1024;
 
 private:
-    EntityInstance::ID m_nextId{0};
-    EntityInstance::Map m_entities;
-    std::vector<std::unique_ptr<Buffer>> m_uniformBuffers{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    // Indexed by entity slot. id holds the slot's current generation; archetype is null while the slot is free.
+    struct EntityLocation
+    {
+        EntityInstance::ID id;
+        EntityArchetype *archetype;
+        uint32_t row;
+    };
+
+    EntityArchetype &getOrCreateArchetype(ComponentMask mask);
+    void changeComponents(EntityInstance::ID entityId, ComponentMask mask);
+    void removeRow(EntityArchetype &archetype, uint32_t row);
+    void markDirty(EntityInstance::ID entityId, bool transformChanged);
+    void queueUpload(EntityInstance::ID entityId);
+    void updateHierarchy();
+    void updateSpatialIndex();
+    void removeFromSpatialIndex(uint32_t slot);
+    std::unique_ptr<Buffer> createInstanceBuffer(uint32_t capacity);
+    void resizeInstanceBuffer(int frameIndex);
+    void computeLocalMatrices(const EntityInstance::ID *entities, uint32_t count, glm::mat4 *worldMatrices);
+
+    const EntityLocation &location(EntityInstance::ID entityId) const
+    {
+        assert(isAlive(entityId) && "Unknown or destroyed entity id");
+        return m_locations[entityIndex(entityId)];
+    }
+
+    Device &m_device;
+    JobSystem &m_jobSystem;
+
+    std::vector<EntityLocation> m_locations;
+    // Min-heap so the lowest free slot is handed out first and the live part of the instance buffers stays compact.
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> m_freeSlots;
+    std::vector<std::unique_ptr<EntityArchetype>> m_archetypes;
+    // Sized from the highest live slot, so the free list handing out the lowest slot first keeps them small.
+    std::vector<std::unique_ptr<Buffer>> m_instanceBuffers{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    uint32_t m_slotHighWater{0};
+    std::vector<std::vector<EntityInstance::ID>> m_dirtyEntities{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    // Entities whose matrices are stale, each listed once until updateTransforms() recomputes them.
+    std::vector<EntityInstance::ID> m_staleEntities;
+    EntityHierarchy m_hierarchy;
+    // Entities whose world bounds must be recomputed, because they moved or changed model.
+    std::vector<EntityInstance::ID> m_movedEntities;
+    BoundingVolumeHierarchy m_spatialIndex;
+    // Indexed by entity slot. Proxy of the entity's leaf in m_spatialIndex, INVALID_INDEX without a model.
+    std::vector<uint32_t> m_spatialProxies;
+    std::vector<Aabb> m_worldBounds;
+    // World bounding spheres as structure of arrays, so they can be culled several at a time.
+    std::vector<float> m_sphereCenterX;
+    std::vector<float> m_sphereCenterY;
+    std::vector<float> m_sphereCenterZ;
+    std::vector<float> m_sphereRadii;
     std::shared_ptr<Texture> m_defaultDiffuseTexture;
+    uint64_t m_drawListVersion{0};
+
+    static_assert(Swapchain::MAX_FRAMES_IN_FLIGHT <= 8, "Pending frame bits must fit in uint8_t");
+
+    friend class EntityInstance;
 };
 
 // // ---------- EntityUboArraySystem ----------
@@ -23,8 +23,7 @@ struct FrameInfo
     VkCommandBuffer commandBuffer;
     Camera &camera;
     VkDescriptorSet globalDescriptorSet;
-    DescriptorPool &frameDescriptorPool;
-    EntityInstance::Map &gameObjects;
+    EntityRegistry &entities;
 };
 
 } // namespace vionis
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace vionis
+{
+
+// ---------- Aabb ----------
+
+// Axis aligned bounding box. A default constructed box is empty (min > max) and absorbs whatever is merged into it.
+struct Aabb
+{
+    glm::vec3 min{FLT_MAX};
+    glm::vec3 max{-FLT_MAX};
+
+    bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+    float surfaceArea() const
+    {
+        glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    void expand(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const Aabb &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool contains(const Aabb &other) const
+    {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z && max.x >= other.max.x &&
+               max.y >= other.max.y && max.z >= other.max.z;
+    }
+
+    bool overlaps(const Aabb &other) const
+    {
+        return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y &&
+               min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    // Bounds of this box after an affine transform.
+    Aabb transformed(const glm::mat4 &transform) const;
+
+    static Aabb merge(const Aabb &a, const Aabb &b) { return {glm::min(a.min, b.min), glm::max(a.max, b.max)}; }
+};
+
+// ---------- Sphere ----------
+
+struct Sphere
+{
+    glm::vec3 center{0.0f};
+    float radius{0.0f};
+
+    bool overlaps(const Aabb &box) const
+    {
+        glm::vec3 closest = glm::clamp(center, box.min, box.max);
+        glm::vec3 offset = center - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+
+    // Bounds of the transformed sphere. The radius grows with the largest axis scale, so non-uniform scales give a
+    // conservative result.
+    Sphere transformed(const glm::mat4 &transform) const;
+};
+
+// ---------- Ray ----------
+
+struct Ray
+{
+    glm::vec3 origin{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, 1.0f};
+
+    // Slab test. Returns the entry distance along the ray, or a negative value if the box is missed within
+    // [0, maxDistance].
+    float intersect(const Aabb &box, float maxDistance) const;
+};
+
+// ---------- Frustum ----------
+
+// Six inward facing planes (xyz normal, w distance) extracted from a projection * view matrix with a [0, 1] depth
+// range, as used by Camera.
+struct Frustum
+{
+    glm::vec4 planes[6];
+
+    static Frustum fromMatrix(const glm::mat4 &projectionView);
+
+    bool overlaps(const Aabb &box) const
+    {
+        glm::vec3 center = box.center();
+        glm::vec3 extent = box.extent();
+        for (const auto &plane : planes)
+        {
+            glm::vec3 normal{plane};
+            if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + plane.w < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool overlaps(const Sphere &sphere) const
+    {
+        for (const auto &plane : planes)
+        {
+            if (glm::dot(glm::vec3{plane}, sphere.center) + plane.w < -sphere.radius)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace vionis
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- ScratchAllocator ----------
+
+// Linear allocator for short lived per-frame data. Allocations are never freed individually; reset() releases
+// everything at once and keeps the memory blocks around for the next frame.
+class ScratchAllocator
+{
+public:
+    explicit ScratchAllocator(size_t blockSize = 1 << 20) : m_blockSize{blockSize} {}
+
+    ScratchAllocator(const ScratchAllocator &) = delete;
+    ScratchAllocator &operator=(const ScratchAllocator &) = delete;
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    template <typename T>
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void reset();
+
+private:
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> memory;
+        size_t size;
+    };
+
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_currentBlock{0};
+    size_t m_offset{0};
+};
+
+// ---------- JobSystem ----------
+
+// Work-stealing task scheduler. Every worker owns a deque: it pushes and pops its own jobs at the back, idle workers
+// steal from the front of the others. The thread that owns the JobSystem takes part as worker 0 whenever it waits,
+// so wait() and parallelFor() never block a core while there is work left.
+class JobSystem
+{
+public:
+    class Job;
+    using JobHandle = std::shared_ptr<Job>;
+
+    // workerCount includes the calling thread; 0 picks one worker per hardware thread.
+    explicit JobSystem(uint32_t workerCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // Queues fn to run once every job in dependencies has finished.
+    JobHandle schedule(std::function<void()> fn, std::initializer_list<JobHandle> dependencies = {});
+    JobHandle schedule(std::function<void()> fn, const std::vector<JobHandle> &dependencies);
+
+    // Runs queued jobs on the calling thread until job has finished.
+    void wait(const JobHandle &job);
+
+    // Splits [0, count) into batches of at least minBatchSize items, calls fn(begin, end) for each batch in parallel
+    // and returns once all of them are done.
+    template <typename Fn>
+    void parallelFor(uint32_t count, uint32_t minBatchSize, Fn &&fn)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        uint32_t maxBatches = std::max(1u, count / std::max(1u, minBatchSize));
+        uint32_t batchCount = std::min(maxBatches, workerCount() * 4);
+        if (batchCount <= 1)
+        {
+            fn(0u, count);
+            return;
+        }
+
+        uint32_t batchSize = (count + batchCount - 1) / batchCount;
+        std::vector<JobHandle> batches;
+        batches.reserve(batchCount);
+        for (uint32_t begin = batchSize; begin < count; begin += batchSize)
+        {
+            uint32_t end = std::min(begin + batchSize, count);
+            batches.push_back(schedule([&fn, begin, end]() { fn(begin, end); }));
+        }
+
+        // The first batch runs on the calling thread while the workers pick up the rest.
+        fn(0u, std::min(batchSize, count));
+        for (const auto &batch : batches)
+        {
+            wait(batch);
+        }
+    }
+
+    uint32_t workerCount() const { return static_cast<uint32_t>(m_queues.size()); }
+
+    // Index of the worker running the current job, in [0, workerCount()). Threads that are not workers report 0.
+    uint32_t currentWorker() const;
+
+    // Scratch allocator of the worker running the current job (worker 0 outside of jobs).
+    ScratchAllocator &scratch();
+
+    // Releases every scratch allocation. Must only be called while no jobs are running, e.g. at the start of a frame.
+    void resetScratch();
+
+    class Job
+    {
+    public:
+        bool finished() const { return m_finished.load(std::memory_order_acquire); }
+
+    private:
+        std::function<void()> m_fn;
+        std::atomic<uint32_t> m_pendingDependencies{1};
+        std::atomic<bool> m_finished{false};
+        std::mutex m_mutex;
+        std::vector<JobHandle> m_continuations;
+
+        friend class JobSystem;
+    };
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    void workerLoop(uint32_t workerIndex);
+    void enqueue(JobHandle job);
+    void execute(const JobHandle &job);
+    bool runOne(uint32_t workerIndex);
+    JobHandle pop(uint32_t workerIndex);
+    JobHandle steal(uint32_t thiefIndex);
+    void addDependency(const JobHandle &job, const JobHandle &dependency);
+    void release(const JobHandle &job);
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::unique_ptr<ScratchAllocator>> m_scratch;
+    std::vector<std::thread> m_threads;
+
+    std::atomic<int32_t> m_queuedJobs{0};
+    std::atomic<bool> m_stopping{false};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeCondition;
+};
+
+} // namespace vionis
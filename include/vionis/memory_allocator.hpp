@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vionis
+{
+
+class MemoryBlock;
+
+// ---------- MemoryAllocation ----------
+
+// A range of device memory that a buffer or image is bound to. Several allocations usually share one VkDeviceMemory,
+// so memory must only be touched through the range, never mapped or freed directly.
+struct MemoryAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Host address of offset for host visible memory, which stays mapped for the allocation's lifetime.
+    void *mapped = nullptr;
+    VkMemoryPropertyFlags propertyFlags = 0;
+
+    // Block the range was carved from, owned by the MemoryAllocator.
+    MemoryBlock *block = nullptr;
+    uint32_t region = 0;
+};
+
+// ---------- MemoryAllocator ----------
+
+// Sub-allocates buffers and images from a few large VkDeviceMemory blocks per memory type instead of allocating
+// memory for each of them, since drivers cap the number of allocations (maxMemoryAllocationCount) and every one is
+// slow. Inside a block, free ranges are kept in two-level segregated lists as in TLSF: the first level splits sizes
+// by power of two, the second linearly into SECOND_LEVEL_COUNT classes, and a bitmap per level finds the smallest
+// class that fits in constant time. Freed ranges merge with free neighbours right away.
+//
+// Linear resources (buffers, linearly tiled images) and optimally tiled images are kept in separate blocks when the
+// device has a bufferImageGranularity above 1, so they never share a page. Host visible blocks are mapped once for
+// their lifetime, and their ranges are aligned to nonCoherentAtomSize so that flushing one never touches another.
+// Resources get memory of their own only where VK_KHR_dedicated_allocation reports that the driver prefers it.
+//
+// Allocating and freeing are thread-safe.
+class MemoryAllocator
+{
+public:
+    struct Stats
+    {
+        // VkDeviceMemory objects currently allocated.
+        uint32_t deviceMemoryCount;
+        uint32_t allocationCount;
+        VkDeviceSize blockBytes;
+        VkDeviceSize allocatedBytes;
+    };
+
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+    // Device local heaps up to this size that the host can map are the classic PCIe BAR window, too small to keep
+    // resources in.
+    static constexpr VkDeviceSize BAR_WINDOW_SIZE = 256ull << 20;
+
+    // dedicatedAllocation: whether VK_KHR_get_memory_requirements2 and VK_KHR_dedicated_allocation are enabled.
+    MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, bool dedicatedAllocation);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator &) = delete;
+    MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+
+    // Allocates memory with the given properties for a resource and binds the resource to it.
+    MemoryAllocation allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags properties);
+    MemoryAllocation allocateImageMemory(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags properties);
+    // Returns the range to its block and resets the allocation. The resource bound to it must be destroyed first, or
+    // at least never be used again.
+    void free(MemoryAllocation &allocation);
+
+    // The memory range to flush or invalidate for a range of an allocation, given relative to its start and widened
+    // to nonCoherentAtomSize. VK_WHOLE_SIZE reaches to the end of the allocation.
+    VkMappedMemoryRange mappedRange(const MemoryAllocation &allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+    Stats stats();
+
+    // Whether there is device local memory the host can write to, so resources can be filled in place rather than
+    // through staging copies: the shared memory of integrated and software devices, or all of video memory on
+    // discrete devices with resizable BAR.
+    bool supportsDirectUploads() const { return m_directUploads; }
+
+private:
+    // Blocks of one memory type that hold either linear or optimally tiled resources.
+    struct Pool
+    {
+        std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    };
+
+    MemoryAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+                              bool optimalImage, bool dedicated, const VkMemoryDedicatedAllocateInfo *dedicatedInfo);
+    std::unique_ptr<MemoryBlock> createBlock(uint32_t memoryType, VkDeviceSize size, bool optimalImages,
+                                             const VkMemoryDedicatedAllocateInfo *dedicatedInfo);
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+    VkDeviceSize preferredBlockSize(uint32_t memoryType) const;
+    Pool &pool(uint32_t memoryType, bool optimalImage);
+
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties;
+    VkDeviceSize m_bufferImageGranularity;
+    VkDeviceSize m_nonCoherentAtomSize;
+    bool m_directUploads{false};
+
+    PFN_vkGetBufferMemoryRequirements2KHR m_getBufferMemoryRequirements2 = nullptr;
+    PFN_vkGetImageMemoryRequirements2KHR m_getImageMemoryRequirements2 = nullptr;
+
+    std::mutex m_mutex;
+    // Two pools per memory type, indexed by 2 * memoryType + optimalImage.
+    std::vector<Pool> m_pools;
+    // Allocations with memory of their own.
+    std::vector<std::unique_ptr<MemoryBlock>> m_dedicatedBlocks;
+};
+
+} // namespace vionis
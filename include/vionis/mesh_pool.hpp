@@ -0,0 +1,82 @@
+#pragma once
+
+#include "vionis/buffer.hpp"
+#include "vionis/device.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+
+namespace vionis
+{
+
+// ---------- MeshPool ----------
+
+// Shared device-local vertex and index buffers that many meshes are suballocated from. Meshes in one pool are bound
+// together, so draws of different meshes differ only in their index and vertex offsets and can be submitted with a
+// single multi-draw indirect call. Next to the full vertices the pool keeps a tightly packed copy of their positions
+// at the same vertex offsets, for passes that need nothing else.
+//
+// Capacity is fixed at creation; ranges are handed out first-fit and coalesced when freed. A freed range can be reused
+// right away, so just like destroying a standalone Model's buffers, freeing must wait until no frame in flight draws
+// the mesh anymore.
+class MeshPool
+{
+public:
+    struct Allocation
+    {
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    static constexpr uint32_t DEFAULT_MAX_VERTICES = 1u << 20;
+    static constexpr uint32_t DEFAULT_MAX_INDICES = 4u << 20;
+
+    MeshPool(Device &device, VkDeviceSize vertexSize, uint32_t maxVertices = DEFAULT_MAX_VERTICES,
+             uint32_t maxIndices = DEFAULT_MAX_INDICES);
+
+    MeshPool(const MeshPool &) = delete;
+    MeshPool &operator=(const MeshPool &) = delete;
+
+    // Reserves ranges for a mesh and uploads its data. Throws if the pool is out of space.
+    Allocation allocate(const void *vertices, const glm::vec3 *positions, uint32_t vertexCount,
+                        const uint32_t *indices, uint32_t indexCount);
+    void free(const Allocation &allocation);
+
+    void bind(VkCommandBuffer commandBuffer);
+
+    VkBuffer getVertexBuffer() const { return vertexBuffer->getBuffer(); }
+    VkBuffer getPositionBuffer() const { return positionBuffer->getBuffer(); }
+    VkBuffer getIndexBuffer() const { return indexBuffer->getBuffer(); }
+
+private:
+    // Free ranges keyed by their first element, never adjacent to each other.
+    class RangeAllocator
+    {
+    public:
+        explicit RangeAllocator(uint32_t capacity) { freeRanges.emplace(0, capacity); }
+
+        bool allocate(uint32_t count, uint32_t &offset);
+        void free(uint32_t offset, uint32_t count);
+
+    private:
+        std::map<uint32_t, uint32_t> freeRanges;
+    };
+
+    void upload(Buffer &target, const void *data, VkDeviceSize size, VkDeviceSize offset);
+
+    Device &device;
+
+    VkDeviceSize vertexSize;
+    std::unique_ptr<Buffer> vertexBuffer;
+    std::unique_ptr<Buffer> positionBuffer;
+    std::unique_ptr<Buffer> indexBuffer;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+};
+
+} // namespace vionis
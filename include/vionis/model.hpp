@@ -1,18 +1,24 @@
 #pragma once
 
 #include "vionis/buffer.hpp"
+#include "vionis/command_recorder.hpp"
 #include "vionis/device.hpp"
+#include "vionis/geometry.hpp"
+#include "vionis/mesh_pool.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 namespace vionis
 {
 
+struct OccluderMesh;
+
 class Model
 {
 public:
@@ -25,6 +31,9 @@ public:
 
         static std::vector<VkVertexInputBindingDescription> getBindingDescriptions();
         static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+        // Layout of the position stream, which holds nothing but the position of every vertex.
+        static std::vector<VkVertexInputBindingDescription> getPositionBindingDescriptions();
+        static std::vector<VkVertexInputAttributeDescription> getPositionAttributeDescriptions();
 
         bool operator==(const Vertex &other) const
         {
@@ -32,8 +41,10 @@ public:
         }
     };
 
-    Model(Device &device, const std::string &filepath);
-    static std::unique_ptr<Model> createFromFile(Device &device, const std::string &filePath);
+    // With a mesh pool the geometry is suballocated from the pool's shared buffers instead of owning its own.
+    Model(Device &device, const std::string &filepath, MeshPool *meshPool = nullptr);
+    static std::unique_ptr<Model> createFromFile(Device &device, const std::string &filePath,
+                                                 MeshPool *meshPool = nullptr);
 
     ~Model();
 
@@ -41,20 +52,68 @@ public:
     Model &operator=(const Model &) = delete;
 
     void bind(VkCommandBuffer commandBuffer);
-    void draw(VkCommandBuffer commandBuffer);
+    void draw(VkCommandBuffer commandBuffer, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
+    // Same as above, skipping binds of buffers that are already bound.
+    void bind(CommandRecorder &recorder);
+    // Binds the position stream in place of the full vertices, for passes that only need positions.
+    void bindPositions(CommandRecorder &recorder);
+    void draw(CommandRecorder &recorder, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
+
+    // Object space bounds of the vertex positions.
+    const Aabb &getBounds() const { return bounds; }
+    // Object space sphere around the vertex positions, centered on the bounding box.
+    const Sphere &getBoundingSphere() const { return boundingSphere; }
+
+    // Models bound through the same vertex buffer can share one multi-draw indirect call.
+    VkBuffer getVertexBuffer() const { return meshPool ? meshPool->getVertexBuffer() : vertexBuffer->getBuffer(); }
+    // Positions at the same vertex offsets as getVertexBuffer(), so draw commands apply to both.
+    VkBuffer getPositionBuffer() const
+    {
+        return meshPool ? meshPool->getPositionBuffer() : positionBuffer->getBuffer();
+    }
+    // VK_NULL_HANDLE for non-indexed models.
+    VkBuffer getIndexBuffer() const
+    {
+        if (meshPool)
+            return meshPool->getIndexBuffer();
+        return hasIndexBuffer ? indexBuffer->getBuffer() : VK_NULL_HANDLE;
+    }
+    bool isIndexed() const { return hasIndexBuffer; }
+    // Indirect equivalent of draw(). Only valid for indexed models.
+    VkDrawIndexedIndirectCommand drawCommand(uint32_t instanceCount = 1, uint32_t firstInstance = 0) const;
+
+    // Designates every entity drawn with this model as an occluder for software occlusion culling, rasterized with
+    // the given mesh in the model's object space. Null removes the designation.
+    void setOccluder(std::shared_ptr<const OccluderMesh> mesh) { occluder = std::move(mesh); }
+    const OccluderMesh *getOccluder() const { return occluder.get(); }
+
+    // Completes once the model's vertex and index data is on the GPU.
+    UploadTicket getUploadTicket() const { return uploadTicket; }
 
 private:
     void createVertexBuffers(const std::vector<Vertex> &vertices);
+    void createPositionBuffer(const std::vector<glm::vec3> &positions);
     void createIndexBuffers(const std::vector<uint32_t> &indices);
 
     Device &device;
 
+    MeshPool *meshPool;
+    MeshPool::Allocation meshAllocation{};
+
     std::unique_ptr<Buffer> vertexBuffer;
+    std::unique_ptr<Buffer> positionBuffer;
     uint32_t vertexCount;
 
     bool hasIndexBuffer = false;
     std::unique_ptr<Buffer> indexBuffer;
     uint32_t indexCount;
+
+    UploadTicket uploadTicket = 0;
+
+    Aabb bounds{};
+    Sphere boundingSphere{};
+
+    std::shared_ptr<const OccluderMesh> occluder;
 };
 
 } // namespace vionis
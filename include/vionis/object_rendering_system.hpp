@@ -1,10 +1,18 @@
 #pragma once
 
+#include "vionis/command_recorder.hpp"
+#include "vionis/depth_pyramid.hpp"
 #include "vionis/device.hpp"
 #include "vionis/frame_info.hpp"
+#include "vionis/job_system.hpp"
+#include "vionis/occlusion_buffer.hpp"
 #include "vionis/pipeline.hpp"
+#include "vionis/renderer.hpp"
+#include "vionis/swapchain.hpp"
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace vionis
 {
@@ -17,18 +25,299 @@ public:
     ObjectRenderingSystem(const ObjectRenderingSystem &) = delete;
     ObjectRenderingSystem &operator=(const ObjectRenderingSystem &) = delete;
 
+    // Prepares the frame's draws and, with GPU culling, records the compute pass that culls them. Must be called for
+    // every frame outside of the render pass, before renderGameObjects(). The depth extent is the size of the
+    // swapchain's depth buffer, which the occlusion culling reduces.
+    void cullGameObjects(FrameInfo &frameInfo, VkExtent2D depthExtent);
     void renderGameObjects(FrameInfo &frameInfo);
+    // Records the draws on the job system's workers into secondary command buffers, see
+    // Renderer::recordSecondaryCommandBuffers(). The swapchain render pass must have been begun with
+    // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    void renderGameObjects(FrameInfo &frameInfo, Renderer &renderer, JobSystem &jobSystem);
+
+    // Submits the draw groups from a per-frame indirect buffer, merging groups that share a texture and a vertex buffer
+    // into one multi-draw indirect call. Falls back to direct draws when the device lacks drawIndirectFirstInstance.
+    void setIndirectDrawsEnabled(bool enabled) { indirectDraws = enabled; }
+    bool indirectDrawsEnabled() const { return indirectDraws; }
+
+    // Records a depth-only pass over the frame's draws from the position stream before shading them, so the shading
+    // pass tests depth with EQUAL and runs the fragment shader once per pixel instead of once per overlapping
+    // surface. Pays off in scenes with heavy overdraw and costs a second round of vertex work everywhere else. Takes
+    // effect with the next frame recorded.
+    void setDepthPrepassEnabled(bool enabled) { depthPrepass = enabled; }
+    bool depthPrepassEnabled() const { return depthPrepass; }
+
+    // Tests every instance against the camera frustum in a compute pass, which writes the visible instances and the
+    // indirect commands, so the CPU never looks at individual instances. Draws that lost all their instances are
+    // compacted away with VK_KHR_draw_indirect_count and left as empty commands without it. Needs
+    // drawIndirectFirstInstance, devices without it keep drawing every group in full.
+    void setGpuCullingEnabled(bool enabled) { gpuCulling = enabled; }
+    bool gpuCullingEnabled() const { return gpuCulling; }
+
+    // Without GPU culling, instances are frustum culled on the CPU against the world bounding spheres of their models
+    // before anything is recorded. Both paths also drop instances whose projected diameter covers less than this
+    // fraction of the viewport height. 0 disables the size test.
+    void setMinProjectedSize(float fraction) { minProjectedSize = fraction; }
+    float getMinProjectedSize() const { return minProjectedSize; }
+
+    // With GPU culling, occlusion culling runs in two phases. The first one only draws the instances that were
+    // visible last frame. Once its render pass has ended, cullOccludedGameObjects() reduces the depth it left into a
+    // depth pyramid and tests every instance's bounds against the depth the pyramid holds for their screen area.
+    // Those that are visible now but were skipped by the first phase are drawn by a second renderGameObjects() call,
+    // which the same frame records in the resumed render pass (see Renderer::resumeSwapchainRenderPass()). The
+    // result also decides what the next frame's first phase draws. Frames culled on the CPU skip the occlusion test.
+    //
+    // Returns whether a second phase was recorded that still has to be drawn.
+    bool cullOccludedGameObjects(FrameInfo &frameInfo, VkImageView depthView);
+    void setOcclusionCullingEnabled(bool enabled) { occlusionCulling = enabled; }
+    bool occlusionCullingEnabled() const { return occlusionCulling; }
+
+    // Frames culled on the CPU rasterize the occluder meshes of the models that have one (see Model::setOccluder())
+    // into a small depth buffer on the registry's job system, and drop the instances whose bounds lie behind them
+    // before anything is recorded. Occluders test the current frame's transforms, so there is no latency, but only
+    // designated occluders hide anything.
+    void setSoftwareOcclusionEnabled(bool enabled) { softwareOcclusion = enabled; }
+    bool softwareOcclusionEnabled() const { return softwareOcclusion; }
+
+    struct FrameStats
+    {
+        uint32_t visibleInstances;
+        uint32_t culledInstances;
+        // Instances inside the frustum that software occlusion culling dropped, included in culledInstances.
+        uint32_t occludedInstances;
+        // Binds and draws recorded by renderGameObjects(), see CommandRecorder.
+        CommandRecorder::Stats commands;
+    };
+
+    // Statistics of the last frame recorded. GPU culling results are read back once their frame has retired, so the
+    // instance counts lag Swapchain::MAX_FRAMES_IN_FLIGHT frames behind.
+    const FrameStats &getFrameStats() const { return frameStats; }
+
+    // Distinct diffuse textures that can be in use at a time, counting destroyed ones that frames in flight still draw.
+    static constexpr uint32_t MAX_TEXTURE_SETS = 1024;
 
 private:
+    // Phase of the GPU culling, matches the CULL_PHASE constants of cull.comp.
+    enum class CullPhase : uint32_t
+    {
+        // Frustum culling only, everything visible is drawn at once.
+        SINGLE = 0,
+        // Draws the visible instances that were also visible last frame.
+        FIRST = 1,
+        // Tests every instance against the depth pyramid of the first phase, records the result for the next frame
+        // and draws those the first phase skipped.
+        SECOND = 2,
+    };
+
+    // Passes the draw runs are recorded in.
+    enum class DrawPass
+    {
+        SHADING,
+        // Depth-only pass from the position stream.
+        DEPTH_PREPASS,
+        // Shading against the depth the pre-pass left, without writing depth.
+        SHADING_AFTER_PREPASS,
+    };
+
+    // Entities that share a model and a diffuse texture are drawn with a single instanced call. The group's instances
+    // occupy [firstInstance, firstInstance + instanceCount) of the frame's instance index buffer, which maps every
+    // gl_InstanceIndex to the entity's record in the registry's instance buffer.
+    struct DrawGroup
+    {
+        Model *model;
+        std::shared_ptr<Texture> texture;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    // Consecutive draw groups that share a texture and a vertex buffer and are submitted with one indirect call.
+    // Groups of non-indexed models always form a run of their own.
+    struct DrawRun
+    {
+        uint32_t firstDraw;
+        uint32_t drawCount;
+    };
+
+    struct DrawGroupKey
+    {
+        const Model *model;
+        const Texture *texture;
+
+        bool operator==(const DrawGroupKey &other) const
+        {
+            return model == other.model && texture == other.texture;
+        }
+    };
+
+    struct DrawGroupKeyHash
+    {
+        size_t operator()(const DrawGroupKey &key) const
+        {
+            return std::hash<const void *>{}(key.model) ^ (std::hash<const void *>{}(key.texture) << 1);
+        }
+    };
+
+    // The entity records and the instance index buffer are bound once per frame through set 1, the draws then only
+    // switch set 2, which holds the diffuse texture. Texture sets do not depend on the frame, so every texture has a
+    // single one. The texture is tracked weakly to notice when its address gets reused.
+    struct EntityDescriptorSet
+    {
+        VkDescriptorBufferInfo instanceBufferInfo{};
+        VkDescriptorBufferInfo instanceIndexBufferInfo{};
+        VkDescriptorSet set = VK_NULL_HANDLE;
+    };
+
+    struct TextureDescriptorSet
+    {
+        std::weak_ptr<Texture> texture;
+        VkDescriptorSet set;
+        // Frame number the set was last bound in, it may only be freed once that frame has retired.
+        uint64_t lastUsedFrame;
+    };
+
+    // A draw group as the culling shaders see it, matches DrawGroup in cull.comp and compact_draws.comp. Bounds are
+    // the model's, in model space. firstDraw is the first command of the group's run.
+    struct CullDrawGroup
+    {
+        glm::vec4 boundsCenter;
+        glm::vec4 boundsExtent;
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t firstInstance;
+        uint32_t firstDraw;
+        uint32_t run;
+        uint32_t padding[2];
+    };
+
+    static_assert(sizeof(CullDrawGroup) == 64, "CullDrawGroup must match the std430 layout of the culling shaders");
+
+    // Matches Push in cull.comp and compact_draws.comp.
+    struct CullPushConstantData
+    {
+        uint32_t candidateCount;
+        uint32_t groupCount;
+        uint32_t compactDraws;
+        float minRadius;
+        float minRadiusPerDistance;
+        CullPhase phase;
+        glm::vec2 pyramidSize;
+    };
+    static_assert(sizeof(CullPushConstantData) == 32, "CullPushConstantData must match the culling push constants");
+
+    // Inputs are written by the CPU when the draw groups change, outputs are written by the culling pass every frame.
+    struct FrameCullBuffers
+    {
+        std::unique_ptr<Buffer> drawGroups;
+        // Entity record and draw group of every instance.
+        std::unique_ptr<Buffer> candidates;
+        // Visible instances per draw group, then compacted draws per run. Both phases reuse the counters and
+        // outputs, the second one once the first one's draws have consumed them.
+        std::unique_ptr<Buffer> counters;
+        std::unique_ptr<Buffer> visibleInstances;
+        std::unique_ptr<Buffer> drawCommands;
+        // Host copy of the per-group visible counts of every phase, summed for the statistics once the frame has
+        // retired.
+        std::unique_ptr<Buffer> statsReadback;
+        uint32_t readbackCounts = 0;
+        uint32_t readbackInstanceCount = 0;
+
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        VkBuffer boundBuffers[7]{};
+        uint64_t boundPyramidGeneration = 0;
+    };
+
     void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
     void createPipeline(VkRenderPass renderPass);
+    void createDescriptorPool();
+    void createCullPipelines(VkDescriptorSetLayout globalSetLayout);
+    void buildDrawGroups(EntityRegistry &entities);
+    void cullInstances(FrameInfo &frameInfo);
+    uint32_t cullOccludedSlots(FrameInfo &frameInfo);
+    void writeDrawBuffers(int frameIndex);
+    void writeCullBuffers(int frameIndex);
+    void reserveInstanceVisibility(FrameInfo &frameInfo);
+    void recordCulling(FrameInfo &frameInfo);
+    void readCullingStats(int frameIndex);
+    bool compactDraws() const;
+    VkDescriptorSet getEntityDescriptorSet(int frameIndex, const VkDescriptorBufferInfo &instanceBufferInfo,
+                                           const VkDescriptorBufferInfo &instanceIndexBufferInfo);
+    VkDescriptorSet getTextureDescriptorSet(const std::shared_ptr<Texture> &texture);
+    void releaseExpiredTextureSets();
+    bool prepareDescriptorSets(FrameInfo &frameInfo);
+    void recordDrawRuns(CommandRecorder &recorder, FrameInfo &frameInfo, uint32_t firstRun, uint32_t endRun,
+                        DrawPass pass);
 
     Device &device;
 
     std::unique_ptr<Pipeline> pipeline;
+    std::unique_ptr<Pipeline> depthPrepassPipeline;
+    std::unique_ptr<Pipeline> depthEqualPipeline;
     VkPipelineLayout pipelineLayout;
+    bool depthPrepass = false;
+
+    std::unique_ptr<DescriptorSetLayout> entitySetLayout;
+    std::unique_ptr<DescriptorSetLayout> textureSetLayout;
+    std::unique_ptr<DescriptorPool> entityDescriptorPool;
+    std::unique_ptr<DescriptorPool> textureDescriptorPool;
+    std::vector<EntityDescriptorSet> entityDescriptorSets{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    std::unordered_map<const Texture *, TextureDescriptorSet> textureSets;
+    // Sets of destroyed textures that frames in flight may still use.
+    std::vector<TextureDescriptorSet> retiredTextureSets;
+    // Counts the frames prepared by cullGameObjects().
+    uint64_t frameNumber = 0;
+    // Descriptor sets of the frame being recorded, resolved up front so the draws can be recorded from any thread.
+    VkDescriptorSet frameEntityDescriptorSet = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> runTextureDescriptorSets;
+
+    std::vector<std::unique_ptr<Buffer>> instanceIndexBuffers{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    std::vector<std::unique_ptr<Buffer>> indirectBuffers{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    bool indirectDraws = true;
+
+    std::unique_ptr<ComputePipeline> cullPipeline;
+    std::unique_ptr<ComputePipeline> compactPipeline;
+    VkPipelineLayout cullPipelineLayout;
+    std::unique_ptr<DescriptorSetLayout> cullSetLayout;
+    std::unique_ptr<DescriptorPool> cullDescriptorPool;
+    std::vector<FrameCullBuffers> cullBuffers{Swapchain::MAX_FRAMES_IN_FLIGHT};
+    // Whether every entity slot passed the second phase of the last frame that had one. Shared by the frames in
+    // flight, which access it in submission order.
+    std::unique_ptr<Buffer> instanceVisibility;
+    DepthPyramid depthPyramid;
+    CullPhase cullPhase = CullPhase::SINGLE;
+    bool gpuCulling = true;
+    bool occlusionCulling = true;
+    OcclusionBuffer occlusionBuffer;
+    bool softwareOcclusion = false;
+    // Occluders of the frame being culled on the CPU, kept so the storage is reused.
+    std::vector<Occluder> occluders;
+    // Whether the frame being recorded was culled on the GPU, decided by cullGameObjects().
+    bool frameCulled = false;
+    bool framePrepared = false;
+    float minProjectedSize = 0.0f;
+    FrameStats frameStats{};
+
+    // Draw groups in draw order, rebuilt only when the registry's draw list version changes. With GPU culling every
+    // frame in flight rewrites its buffers once it notices the new version.
+    std::vector<DrawGroup> drawGroups;
+    std::vector<DrawRun> drawRuns;
+    // Instance buffer slot of every drawn entity, grouped by draw group.
+    std::vector<uint32_t> instanceSlots;
+    // Result of the CPU culling: the surviving slots are packed to the front of their group's range.
+    std::vector<uint32_t> visibleSlots;
+    std::vector<uint32_t> visibleCounts;
+    std::vector<uint8_t> slotVisibility;
+    uint64_t drawListVersion = ~0ull;
+    std::vector<uint64_t> frameDrawListVersions = std::vector<uint64_t>(Swapchain::MAX_FRAMES_IN_FLIGHT, ~0ull);
 
-    std::unique_ptr<DescriptorSetLayout> renderSystemLayout;
+    // Scratch storage of buildDrawGroups(), kept so it is reused.
+    std::vector<uint32_t> drawOrder;
+    std::vector<uint64_t> drawSortKeys;
+    std::vector<uint64_t> sortKeyScratch;
+    std::vector<uint32_t> sortValueScratch;
+    std::unordered_map<DrawGroupKey, uint32_t, DrawGroupKeyHash> drawGroupIndices;
+    // Draw group and instance buffer slot of every drawn entity, in archetype order.
+    std::vector<std::pair<uint32_t, uint32_t>> groupedInstances;
 };
 
 } // namespace vionis
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vionis/job_system.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- OccluderMesh ----------
+
+// Simplified triangle mesh that is rasterized into an OcclusionBuffer in place of a model's render geometry. It must
+// stay inside the model's bounds and should only cover what the model really hides, e.g. the inner box of a wall.
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    // Loads the positions and faces of an .obj file, ignoring every other attribute.
+    static std::shared_ptr<OccluderMesh> createFromFile(const std::string &filepath);
+};
+
+// An occluder mesh placed in the world.
+struct Occluder
+{
+    const OccluderMesh *mesh;
+    glm::mat4 worldMatrix;
+};
+
+// ---------- OcclusionBuffer ----------
+
+// Low resolution depth buffer that occluders are rasterized into on the CPU, so that bounds hidden behind them can be
+// rejected before anything is submitted to the GPU. Depth follows the renderer's [0, 1] convention with 1 at the far
+// plane, and every pixel keeps the nearest occluder depth.
+//
+// Coverage follows pixel centers like the GPU, so that the triangles of a mesh leave no gaps along their shared edges,
+// while depth is conservative: a covered pixel receives the farthest depth the triangle has within it. Tests cover
+// every pixel a box touches and compare against the box's nearest depth, so an occluder never hides its own bounds;
+// only gaps between occluders narrower than a pixel of this buffer can be missed. Rows are split into bands of whole
+// tiles that are rasterized in parallel, and every tile keeps its farthest depth so most tests never look at single
+// pixels. On x86 the inner loop shades four pixels per instruction.
+class OcclusionBuffer
+{
+public:
+    static constexpr uint32_t TILE_SIZE = 8;
+    static constexpr uint32_t DEFAULT_WIDTH = 320;
+    static constexpr uint32_t DEFAULT_HEIGHT = 192;
+
+    // Both sides must be multiples of TILE_SIZE.
+    explicit OcclusionBuffer(uint32_t width = DEFAULT_WIDTH, uint32_t height = DEFAULT_HEIGHT);
+
+    OcclusionBuffer(const OcclusionBuffer &) = delete;
+    OcclusionBuffer &operator=(const OcclusionBuffer &) = delete;
+
+    // Clears the buffer and rasterizes the occluders as seen through viewProjection.
+    void render(const glm::mat4 &viewProjection, const std::vector<Occluder> &occluders, JobSystem &jobSystem);
+
+    // Whether a world space box lies behind the occluders everywhere it covers. Boxes that reach in front of the near
+    // plane are never occluded. Safe to call from several threads once render() has returned.
+    bool isOccluded(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    const float *depth() const { return m_depth.data(); }
+
+private:
+    // Screen space triangle. The edge functions are positive inside and already offset to the pixel center, and the
+    // depth plane is offset to the pixel corner farthest away.
+    struct Triangle
+    {
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        float depthX;
+        float depthY;
+        float depthC;
+        float maxDepth;
+        int32_t minX;
+        int32_t maxX;
+        int32_t minY;
+        int32_t maxY;
+    };
+
+    void setupTriangles(const Occluder &occluder, ScratchAllocator &scratch, uint32_t firstTriangle,
+                        uint32_t &triangleCount);
+    void setupTriangle(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2, uint32_t index,
+                       uint32_t &triangleCount);
+    void rasterizeBand(uint32_t firstRow, uint32_t endRow);
+    void rasterizeRow(const Triangle &triangle, uint32_t row, int32_t minX, int32_t maxX);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_tilesX;
+    uint32_t m_tilesY;
+    std::vector<float> m_depth;
+    // Farthest depth of every tile.
+    std::vector<float> m_tileDepth;
+    glm::mat4 m_viewProjection{1.0f};
+
+    std::vector<Triangle> m_triangles;
+    // Range of m_triangles that belongs to every occluder of the last render().
+    std::vector<uint32_t> m_triangleOffsets;
+    std::vector<uint32_t> m_triangleCounts;
+};
+
+} // namespace vionis
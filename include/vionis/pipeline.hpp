@@ -33,6 +33,7 @@ struct PipelineConfigInfo
 class Pipeline
 {
 public:
+    // An empty fragFilepath creates a pipeline without a fragment stage, e.g. for depth-only passes.
     Pipeline(Device &device, const std::string &vertFilepath, const std::string &fragFilepath,
              const PipelineConfigInfo &configInfo);
     ~Pipeline();
@@ -44,10 +45,13 @@ public:
 
     static void defaultPipelineConfigInfo(PipelineConfigInfo &configInfo);
     static void enableAlphaBlending(PipelineConfigInfo &configInfo);
+    // Writes depth only, reading nothing but the position stream (see Model::bindPositions()).
+    static void enableDepthOnly(PipelineConfigInfo &configInfo);
+    // Shades only the fragments whose depth equals the one a depth pre-pass left, without writing depth. The vertex
+    // shaders of both passes must compute gl_Position the same way and declare it invariant.
+    static void enableDepthEqual(PipelineConfigInfo &configInfo);
 
 private:
-    static std::vector<char> readFile(const std::string &filepath);
-
     void createGraphicsPipeline(const std::string &vertFilepath, const std::string &fragFilepath,
                                 const PipelineConfigInfo &configInfo);
 
@@ -56,7 +60,26 @@ private:
     Device &device;
     VkPipeline graphicsPipeline;
     VkShaderModule vertShaderModule;
-    VkShaderModule fragShaderModule;
+    VkShaderModule fragShaderModule = VK_NULL_HANDLE;
+};
+
+// A compute shader and the layout it is dispatched with. Descriptor sets and push constants are bound against the
+// layout with VK_PIPELINE_BIND_POINT_COMPUTE.
+class ComputePipeline
+{
+public:
+    ComputePipeline(Device &device, const std::string &compFilepath, VkPipelineLayout pipelineLayout);
+    ~ComputePipeline();
+
+    ComputePipeline(const ComputePipeline &) = delete;
+    ComputePipeline &operator=(const ComputePipeline &) = delete;
+
+    void bind(VkCommandBuffer commandBuffer);
+
+private:
+    Device &device;
+    VkPipeline computePipeline;
+    VkShaderModule compShaderModule;
 };
 
 } // namespace vionis
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "vionis/device.hpp"
+#include "vionis/job_system.hpp"
 #include "vionis/swapchain.hpp"
 #include "vionis/window.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <vector>
@@ -30,6 +32,15 @@ public:
         return commandBuffers[currentFrameIndex];
     }
 
+    // Depth buffer of the swapchain image being rendered.
+    VkImageView getCurrentDepthImageView() const
+    {
+        assert(isFrameStarted && "Cannot get depth buffer when frame not in progress");
+        return swapchain->getDepthImageView(currentImageIndex);
+    }
+
+    VkExtent2D getSwapchainExtent() const { return swapchain->getSwapchainExtent(); }
+
     int getFrameIndex() const
     {
         assert(isFrameStarted && "Cannot get frame index when frame not in progress");
@@ -38,22 +49,89 @@ public:
 
     VkCommandBuffer beginFrame();
     void endFrame();
-    void beginSwapchainRenderPass(VkCommandBuffer commandBuffer);
+    // With VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS the render pass may only be filled through
+    // recordSecondaryCommandBuffers().
+    void beginSwapchainRenderPass(VkCommandBuffer commandBuffer,
+                                  VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+    // Begins the swapchain render pass again after it has ended in the same frame, keeping the color and depth drawn
+    // so far. Takes the same contents as beginSwapchainRenderPass().
+    void resumeSwapchainRenderPass(VkCommandBuffer commandBuffer,
+                                   VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void endSwapchainRenderPass(VkCommandBuffer commandBuffer);
 
+    // Splits [0, count) into batches of at least minBatchSize items and calls fn(begin, end, commandBuffer) for every
+    // batch on the job system's workers. Each batch records into its own secondary command buffer, which continues
+    // the swapchain render pass and already has the viewport and scissor set. The primary command buffer executes
+    // them in batch order, so the result is the same as recording [0, count) inline. Secondary command buffers come
+    // from per-worker command pools of the current frame, which are reset once the frame's previous submission has
+    // retired.
+    template <typename Fn>
+    void recordSecondaryCommandBuffers(JobSystem &jobSystem, uint32_t count, uint32_t minBatchSize, Fn &&fn)
+    {
+        assert(isRenderPassStarted && secondaryRenderPass &&
+               "Secondary command buffers need a render pass begun with secondary command buffer contents");
+        if (count == 0)
+        {
+            return;
+        }
+
+        uint32_t workerCount = jobSystem.workerCount();
+        createWorkerCommandPools(workerCount);
+
+        // One batch per worker: every secondary command buffer repeats the binds of its first draw, so more batches
+        // than workers would only add work.
+        uint32_t batchSize = std::max(std::max(1u, minBatchSize), (count + workerCount - 1) / workerCount);
+        uint32_t batchCount = (count + batchSize - 1) / batchSize;
+        std::vector<VkCommandBuffer> secondaryCommandBuffers(batchCount);
+
+        jobSystem.parallelFor(batchCount, 1, [&](uint32_t firstBatch, uint32_t endBatch) {
+            for (uint32_t batch = firstBatch; batch < endBatch; batch++)
+            {
+                VkCommandBuffer commandBuffer = beginSecondaryCommandBuffer(jobSystem.currentWorker());
+                uint32_t begin = batch * batchSize;
+                fn(begin, std::min(begin + batchSize, count), commandBuffer);
+                endSecondaryCommandBuffer(commandBuffer);
+                secondaryCommandBuffers[batch] = commandBuffer;
+            }
+        });
+
+        vkCmdExecuteCommands(getCurrentCommandBuffer(), batchCount, secondaryCommandBuffers.data());
+    }
+
 private:
+    // Command pools are externally synchronized, so every worker records from a pool of its own. The secondary
+    // command buffers are allocated on demand and reused once the pool has been reset.
+    struct WorkerCommandPool
+    {
+        VkCommandPool pool{VK_NULL_HANDLE};
+        std::vector<VkCommandBuffer> commandBuffers;
+        uint32_t usedCommandBuffers{0};
+    };
+
     void createCommandBuffers();
     void freeCommandBuffers();
+    void createWorkerCommandPools(uint32_t workerCount);
+    void destroyWorkerCommandPools();
+    void resetWorkerCommandPools();
+    VkCommandBuffer beginSecondaryCommandBuffer(uint32_t worker);
+    void endSecondaryCommandBuffer(VkCommandBuffer commandBuffer);
+    void beginRenderPass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t clearValueCount,
+                         const VkClearValue *clearValues, VkSubpassContents contents);
+    void setViewportAndScissor(VkCommandBuffer commandBuffer);
     void recreateSwapchain();
 
     Window &window;
     Device &device;
     std::unique_ptr<Swapchain> swapchain;
     std::vector<VkCommandBuffer> commandBuffers;
+    // Indexed by frame in flight, then by job system worker.
+    std::vector<std::vector<WorkerCommandPool>> workerCommandPools{Swapchain::MAX_FRAMES_IN_FLIGHT};
 
     uint32_t currentImageIndex;
     int currentFrameIndex{0};
     bool isFrameStarted{false};
+    bool isRenderPassStarted{false};
+    bool secondaryRenderPass{false};
 };
 
 } // namespace vionis
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vionis/memory_allocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+
+namespace vionis
+{
+
+class Device;
+
+// ---------- StagingRing ----------
+
+// Persistently mapped host visible buffer that every upload is staged through, instead of each creating a staging
+// buffer of its own. Space is taken at the head of the ring and handed back at the tail in the order it was taken:
+// the owner closes the space taken so far whenever it submits the commands reading it, and releases the oldest
+// closed range once those commands have completed. See UploadBatcher. Not thread-safe.
+class StagingRing
+{
+public:
+    static constexpr VkDeviceSize DEFAULT_SIZE = 16ull << 20;
+    // Offset alignment of all space taken, enough for vkCmdCopyBufferToImage with any texel size up to 16 bytes.
+    static constexpr VkDeviceSize ALIGNMENT = 16;
+
+    StagingRing(Device &device, VkDeviceSize size);
+    ~StagingRing();
+
+    StagingRing(const StagingRing &) = delete;
+    StagingRing &operator=(const StagingRing &) = delete;
+
+    // Takes contiguous space of at least minSize and at most maxSize bytes, a multiple of granularity. Fails when
+    // there is less than minSize until more is released; once everything is, minSize up to size() always fits.
+    bool reserve(VkDeviceSize minSize, VkDeviceSize maxSize, VkDeviceSize granularity, VkDeviceSize &offset,
+                 VkDeviceSize &size);
+    // Ends the range that the next release() hands back with everything taken so far. Returns false without closing
+    // anything when no space was taken since the last close(), a range must not be released then.
+    bool close();
+    // Hands back the oldest closed range.
+    void release();
+
+    VkBuffer buffer() const { return m_buffer; }
+    char *mapped() const { return m_mapped; }
+    VkDeviceSize size() const { return m_size; }
+
+private:
+    Device &m_device;
+    VkDeviceSize m_size;
+    VkBuffer m_buffer{VK_NULL_HANDLE};
+    MemoryAllocation m_memory;
+    char *m_mapped{nullptr};
+
+    // Staged data lives in [m_tail, m_head), wrapping around at the end of the ring.
+    VkDeviceSize m_head{0};
+    VkDeviceSize m_tail{0};
+    // Head at every close() that has not been released yet.
+    std::deque<VkDeviceSize> m_closedHeads;
+    // Whether space was taken since the last close().
+    bool m_open{false};
+};
+
+} // namespace vionis
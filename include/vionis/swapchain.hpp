@@ -24,7 +24,13 @@ public:
 
     VkFramebuffer getFrameBuffer(int index) { return swapchainFramebuffers[index]; }
     VkRenderPass getRenderPass() { return renderPass; }
+    // Compatible with getRenderPass(), but loads the attachments it stored instead of clearing them, so drawing can
+    // continue after work that had to happen outside of a render pass.
+    VkRenderPass getResumeRenderPass() { return resumeRenderPass; }
     VkImageView getImageView(int index) { return swapchainImageViews[index]; }
+    // Depth aspect view of an image's depth buffer, which the render pass leaves in
+    // VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL.
+    VkImageView getDepthImageView(int index) { return depthImageViews[index]; }
     size_t imageCount() { return swapchainImages.size(); }
     VkFormat getSwapchainImageFormat() { return swapchainImageFormat; }
     VkExtent2D getSwapchainExtent() { return swapchainExtent; }
@@ -67,9 +73,10 @@ private:
 
     std::vector<VkFramebuffer> swapchainFramebuffers;
     VkRenderPass renderPass;
+    VkRenderPass resumeRenderPass;
 
     std::vector<VkImage> depthImages;
-    std::vector<VkDeviceMemory> depthImageMemorys;
+    std::vector<MemoryAllocation> depthImageMemorys;
     std::vector<VkImageView> depthImageViews;
 
     std::vector<VkImage> swapchainImages;
@@ -28,6 +28,8 @@ public:
     VkImageLayout imageLayout() const { return m_textureLayout; }
     VkExtent3D extent() const { return m_extent; }
     VkFormat format() const { return m_format; }
+    // Completes once the image data and its mip chain are on the GPU.
+    UploadTicket uploadTicket() const { return m_uploadTicket; }
 
     void updateDescriptor();
 
@@ -40,7 +42,7 @@ private:
     VkDescriptorImageInfo m_descriptor{};
     Device &m_device;
     VkImage m_textureImage = VK_NULL_HANDLE;
-    VkDeviceMemory m_textureImageMemory = VK_NULL_HANDLE;
+    MemoryAllocation m_textureImageMemory;
     VkImageView m_textureImageView = VK_NULL_HANDLE;
     VkSampler m_textureSampler = VK_NULL_HANDLE;
     VkFormat m_format = VK_FORMAT_UNDEFINED;
@@ -48,6 +50,7 @@ private:
     uint32_t m_mipLevels = 1;
     uint32_t m_layerCount = 1;
     VkExtent3D m_extent = {};
+    UploadTicket m_uploadTicket = 0;
 };
 
 } // namespace vionis
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace vionis
+{
+
+// ---------- TransformArrays ----------
+
+// Structure of arrays view over a batch of transforms. Every pointer addresses count consecutive floats.
+struct TransformArrays
+{
+    const float *positionX;
+    const float *positionY;
+    const float *positionZ;
+    const float *rotationX;
+    const float *rotationY;
+    const float *rotationZ;
+    const float *scaleX;
+    const float *scaleY;
+    const float *scaleZ;
+};
+
+// ---------- TransformKernel ----------
+
+// Batched equivalent of TransformComponent::toMatrix. Writes the world matrix for count transforms, computing the
+// sines and cosines once per entity and several entities per instruction where the CPU allows it. Normal matrices are
+// derived from the model matrix in the vertex shader.
+using TransformKernelFn = void (*)(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices);
+
+struct TransformKernel
+{
+    const char *name;
+    uint32_t width;
+    TransformKernelFn compute;
+};
+
+// Widest kernel supported by the running CPU, picked on first use.
+const TransformKernel &selectTransformKernel();
+
+// Every kernel that can run on this CPU, from the scalar fallback to the widest one.
+std::vector<TransformKernel> supportedTransformKernels();
+
+inline void computeTransformMatrices(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    selectTransformKernel().compute(transforms, count, worldMatrices);
+}
+
+} // namespace vionis
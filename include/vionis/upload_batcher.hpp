@@ -0,0 +1,117 @@
+#pragma once
+
+#include "vionis/staging_ring.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace vionis
+{
+
+class Buffer;
+class Device;
+
+// Identifies the batch an upload was recorded into. Tickets grow with every batch, so a completed ticket implies that
+// every smaller one has completed as well.
+using UploadTicket = uint64_t;
+
+// ---------- UploadBatcher ----------
+
+// Collects the copies, layout transitions and mip blits of uploads into batches that are submitted with a fence,
+// rather than submitting and waiting for the queue to go idle for every single command. Batches are submitted when
+// the staging ring runs out of space, when flush() is called, and before the Device or Swapchain submit anything
+// else, so uploaded data is always in place before the commands using it run. Callers can poll or wait on the ticket
+// of their upload, e.g. to stream assets in without blocking.
+//
+// When the Device has a transfer queue, every batch has two command buffers: the copies run on the transfer queue,
+// so they overlap rendering, and signal a semaphore that the graphics part of the batch waits for. The graphics part
+// holds whatever needs a graphics queue, like mip blits. Uploaded ranges are released by the transfer family and
+// acquired by the graphics family when the two differ. Without a transfer queue, both parts are the same command
+// buffer on the graphics queue.
+//
+// Every batch ends with a barrier that makes its writes available to all later commands on the graphics queue.
+//
+// Where the device supports direct uploads (see MemoryAllocator::supportsDirectUploads()), buffers created with
+// targetMemoryProperties() are host visible, and uploads to them are written in place without staging or any command
+// at all. Not thread-safe.
+class UploadBatcher
+{
+public:
+    UploadBatcher(Device &device, VkDeviceSize stagingRingSize);
+    ~UploadBatcher();
+
+    UploadBatcher(const UploadBatcher &) = delete;
+    UploadBatcher &operator=(const UploadBatcher &) = delete;
+
+    UploadTicket uploadToBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size);
+    // Writes straight into host visible buffers, and stages the copy like the overload above otherwise.
+    UploadTicket uploadToBuffer(Buffer &buffer, VkDeviceSize offset, const void *data, VkDeviceSize size);
+    // Uploads tightly packed texels into mip level 0 of an image in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, one layer
+    // after the other.
+    UploadTicket uploadToImage(VkImage image, const void *data, uint32_t width, uint32_t height, uint32_t layerCount,
+                               uint32_t texelSize);
+
+    // Command buffers of the open batch, to record further commands of an upload into. Transfer commands run before
+    // the batch's copies are released to the graphics family, graphics commands after they are acquired. Only valid
+    // until the next call to the batcher.
+    VkCommandBuffer transferCommandBuffer();
+    VkCommandBuffer graphicsCommandBuffer();
+    // Ticket of the open batch, which covers every command recorded into it so far.
+    UploadTicket pendingTicket() const { return m_pendingTicket; }
+
+    // Submits the open batch, if anything was recorded into it.
+    void flush();
+    bool isComplete(UploadTicket ticket);
+    void wait(UploadTicket ticket);
+    void waitIdle();
+
+    // Memory properties for buffers that are only filled through uploadToBuffer(Buffer &, ...): device local, and
+    // host visible as well where the device supports direct uploads.
+    VkMemoryPropertyFlags targetMemoryProperties() const;
+    bool directUploads() const { return m_directUploads; }
+
+    StagingRing &stagingRing() { return m_stagingRing; }
+
+private:
+    struct Batch
+    {
+        UploadTicket ticket;
+        VkCommandBuffer transferCommandBuffer;
+        VkCommandBuffer graphicsCommandBuffer;
+        VkSemaphore semaphore;
+        VkFence fence;
+        // Whether the batch staged anything, and so owns the staging ring range to release once it completes.
+        bool stagingRange;
+    };
+
+    VkDeviceSize reserve(VkDeviceSize minSize, VkDeviceSize maxSize, VkDeviceSize granularity, VkDeviceSize &size);
+    void transferOwnership(const VkBufferMemoryBarrier *bufferBarrier, const VkImageMemoryBarrier *imageBarrier);
+    VkCommandBuffer beginCommandBuffer(VkCommandPool commandPool, std::vector<VkCommandBuffer> &freeCommandBuffers);
+    void submit();
+    void reclaim();
+    void waitOldest();
+
+    Device &m_device;
+    StagingRing m_stagingRing;
+
+    // Whether uploads run on a queue of their own, and whether that is in another family than the graphics queue.
+    bool m_transferQueue;
+    bool m_ownershipTransfer;
+    bool m_directUploads;
+
+    VkCommandBuffer m_transferCommandBuffer{VK_NULL_HANDLE};
+    VkCommandBuffer m_graphicsCommandBuffer{VK_NULL_HANDLE};
+    UploadTicket m_pendingTicket{1};
+    UploadTicket m_completedTicket{0};
+
+    std::deque<Batch> m_inFlight;
+    std::vector<VkCommandBuffer> m_freeTransferCommandBuffers;
+    std::vector<VkCommandBuffer> m_freeGraphicsCommandBuffers;
+    std::vector<VkSemaphore> m_freeSemaphores;
+    std::vector<VkFence> m_freeFences;
+};
+
+} // namespace vionis
@@ -12,4 +12,11 @@ void hashCombine(std::size_t &seed, const T &v, const Rest &...rest)
     (hashCombine(seed, rest), ...);
 };
 
+// Rounds value up to the next multiple of alignment, which need not be a power of two.
+template <typename T>
+constexpr T alignUp(T value, T alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
 } // namespace vionis
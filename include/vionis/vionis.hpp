@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vionis/entity_instance.hpp"
+#include "vionis/job_system.hpp"
 
 #include "vionis/buffer.hpp"
 #include "vionis/context.hpp"
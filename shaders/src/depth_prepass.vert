@@ -0,0 +1,37 @@
+#version 450
+
+// Depth-only variant of simple_shader.vert, fed from the position stream. Both compute gl_Position with the same
+// expression and declare it invariant, so the shading pass can test against the pre-pass depth with EQUAL.
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPosition;
+} ubo;
+
+// Matches EntityGpuData: the top three rows of the affine model matrix and an RGBA8 base color, 64 byte stride.
+struct EntityData {
+    vec4 modelRows[3];
+    uint baseColor;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer EntityBuffer {
+    EntityData entities[];
+} entityBuffer;
+
+// Maps the instance index of an instanced draw to the entity's record in EntityBuffer.
+layout(std430, set = 1, binding = 1) readonly buffer InstanceIndexBuffer {
+    uint entityIndices[];
+} instanceIndexBuffer;
+
+void main() {
+    EntityData entity = entityBuffer.entities[instanceIndexBuffer.entityIndices[gl_InstanceIndex]];
+
+    mat3x4 modelRows = mat3x4(entity.modelRows[0], entity.modelRows[1], entity.modelRows[2]);
+    vec4 positionWorld = vec4(vec4(inPosition, 1.0) * modelRows, 1.0);
+    gl_Position = ubo.projection * ubo.view * positionWorld;
+}
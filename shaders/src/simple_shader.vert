@@ -9,6 +9,10 @@ layout(location = 0) out vec3 outColor;
 layout(location = 1) out vec3 outWorldPosition;
 layout(location = 2) out vec3 outNormalWorld;
 layout(location = 3) out vec2 outUVCoordinate;
+layout(location = 4) flat out vec3 outBaseColor;
+
+// The depth pre-pass computes the same position in depth_prepass.vert; invariance keeps the EQUAL depth test exact.
+invariant gl_Position;
 
 layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
     mat4 projection;
@@ -16,22 +20,37 @@ layout(set = 0, binding = 0) uniform GlobalUniformBufferObject {
     vec3 viewPosition;
 } ubo;
 
-layout(set = 1, binding = 0) uniform GameObjectBufferData {
-    mat4 modelMatrix;
-    mat4 normalMatrix;
-    vec3 baseColor;
-} gameObject;
+// Matches EntityGpuData: the top three rows of the affine model matrix and an RGBA8 base color, 64 byte stride.
+struct EntityData {
+    vec4 modelRows[3];
+    uint baseColor;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer EntityBuffer {
+    EntityData entities[];
+} entityBuffer;
 
-layout(push_constant) uniform Push {
-    mat4 modelMatrix;
-    mat4 normalMatrix;
-} push;
+// Maps the instance index of an instanced draw to the entity's record in EntityBuffer.
+layout(std430, set = 1, binding = 1) readonly buffer InstanceIndexBuffer {
+    uint entityIndices[];
+} instanceIndexBuffer;
 
 void main() {
-    vec4 positionWorld = gameObject.modelMatrix * vec4(inPosition, 1.0);
+    EntityData entity = entityBuffer.entities[instanceIndexBuffer.entityIndices[gl_InstanceIndex]];
+
+    // vec4 * mat3x4 dots the point with every column, i.e. with every stored row of the model matrix.
+    mat3x4 modelRows = mat3x4(entity.modelRows[0], entity.modelRows[1], entity.modelRows[2]);
+    vec4 positionWorld = vec4(vec4(inPosition, 1.0) * modelRows, 1.0);
     gl_Position = ubo.projection * ubo.view * positionWorld;
-    outNormalWorld = normalize(mat3(gameObject.normalMatrix) * inNormal);
+
+    // The cofactor matrix equals det(M) * inverse(transpose(M)), so after normalizing only the sign of det matters.
+    mat3 model = transpose(mat3(entity.modelRows[0].xyz, entity.modelRows[1].xyz, entity.modelRows[2].xyz));
+    mat3 cofactor = mat3(cross(model[1], model[2]), cross(model[2], model[0]), cross(model[0], model[1]));
+    float handedness = sign(dot(model[0], cofactor[0]));
+    outNormalWorld = normalize(cofactor * inNormal) * handedness;
+
     outWorldPosition = positionWorld.xyz;
     outColor = inColor;
     outUVCoordinate = inUVCoordinate;
+    outBaseColor = unpackUnorm4x8(entity.baseColor).rgb;
 }
@@ -0,0 +1,343 @@
+#include "vionis/bounding_volume_hierarchy.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace vionis
+{
+
+namespace
+{
+
+constexpr uint32_t SAH_BIN_COUNT = 16;
+// Past this depth the builder falls back to median splits, which bounds the recursion for degenerate inputs.
+constexpr uint32_t MAX_SAH_DEPTH = 48;
+
+double areaOf(const Aabb &bounds) { return bounds.valid() ? bounds.surfaceArea() : 0.0; }
+
+} // namespace
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(float margin) : m_margin{margin} {}
+
+uint32_t BoundingVolumeHierarchy::insert(const Aabb &bounds, uint32_t userData)
+{
+    uint32_t leaf = allocateNode();
+    m_nodes[leaf].bounds = {bounds.min - m_margin, bounds.max + m_margin};
+    m_nodes[leaf].userData = userData;
+
+    insertLeaf(leaf);
+    m_leafCount++;
+    return leaf;
+}
+
+void BoundingVolumeHierarchy::remove(uint32_t proxy)
+{
+    assert(proxy < m_nodes.size() && m_nodes[proxy].isLeaf() && "Invalid BVH proxy");
+
+    removeLeaf(proxy);
+    freeNode(proxy);
+    m_leafCount--;
+}
+
+bool BoundingVolumeHierarchy::update(uint32_t proxy, const Aabb &bounds)
+{
+    assert(proxy < m_nodes.size() && m_nodes[proxy].isLeaf() && "Invalid BVH proxy");
+
+    Node &leaf = m_nodes[proxy];
+    if (leaf.bounds.contains(bounds))
+    {
+        return false;
+    }
+
+    // Refit rather than reinsert: the leaf keeps its place and only its ancestors are adjusted. The loss in tree
+    // quality shows up in the SAH cost and is recovered by the next rebuild.
+    leaf.bounds = {bounds.min - m_margin, bounds.max + m_margin};
+    refitAncestors(leaf.parent);
+    return true;
+}
+
+bool BoundingVolumeHierarchy::needsRebuild() const
+{
+    if (m_leafCount < REBUILD_MIN_LEAVES)
+    {
+        return false;
+    }
+
+    double rootArea = areaOf(m_nodes[m_root].bounds);
+    if (rootArea <= 0.0)
+    {
+        return false;
+    }
+
+    // A tree that was only ever built by insertion gets one rebuild as soon as it is large enough to matter.
+    double cost = m_internalArea / rootArea;
+    return m_rebuiltCost == 0.0 || cost > m_rebuiltCost * REBUILD_COST_RATIO;
+}
+
+void BoundingVolumeHierarchy::rebuild()
+{
+    std::vector<uint32_t> leaves;
+    leaves.reserve(m_leafCount);
+
+    // Collect the leaves and release every internal node. The build needs exactly as many internal nodes as were
+    // freed, so the node array does not grow.
+    std::vector<uint32_t> stack;
+    if (m_root != INVALID_INDEX)
+    {
+        stack.push_back(m_root);
+    }
+    while (!stack.empty())
+    {
+        uint32_t node = stack.back();
+        stack.pop_back();
+
+        if (m_nodes[node].isLeaf())
+        {
+            leaves.push_back(node);
+            continue;
+        }
+        stack.push_back(m_nodes[node].children[0]);
+        stack.push_back(m_nodes[node].children[1]);
+        freeNode(node);
+    }
+
+    m_internalArea = 0.0;
+    m_root = leaves.empty() ? INVALID_INDEX
+                            : buildRange(leaves.data(), static_cast<uint32_t>(leaves.size()), INVALID_INDEX, 0);
+
+    double rootArea = m_root != INVALID_INDEX ? areaOf(m_nodes[m_root].bounds) : 0.0;
+    m_rebuiltCost = rootArea > 0.0 ? m_internalArea / rootArea : 0.0;
+}
+
+uint32_t BoundingVolumeHierarchy::allocateNode()
+{
+    uint32_t node;
+    if (m_freeList != INVALID_INDEX)
+    {
+        node = m_freeList;
+        m_freeList = m_nodes[node].parent;
+    }
+    else
+    {
+        node = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+
+    m_nodes[node] = {Aabb{}, INVALID_INDEX, {INVALID_INDEX, INVALID_INDEX}, 0};
+    return node;
+}
+
+void BoundingVolumeHierarchy::freeNode(uint32_t node)
+{
+    m_nodes[node].parent = m_freeList;
+    m_freeList = node;
+}
+
+void BoundingVolumeHierarchy::insertLeaf(uint32_t leaf)
+{
+    if (m_root == INVALID_INDEX)
+    {
+        m_root = leaf;
+        m_nodes[leaf].parent = INVALID_INDEX;
+        return;
+    }
+
+    // Walk down towards the sibling that minimises the added surface area. Descending into a child costs the growth
+    // of every ancestor on the way, which is carried along as the inherited cost.
+    const Aabb box = m_nodes[leaf].bounds;
+    uint32_t index = m_root;
+    while (!m_nodes[index].isLeaf())
+    {
+        const Node &node = m_nodes[index];
+        double area = areaOf(node.bounds);
+        double combinedArea = areaOf(Aabb::merge(node.bounds, box));
+
+        double cost = 2.0 * combinedArea;
+        double inheritedCost = 2.0 * (combinedArea - area);
+
+        double childCosts[2];
+        for (int i = 0; i < 2; i++)
+        {
+            const Node &child = m_nodes[node.children[i]];
+            double mergedArea = areaOf(Aabb::merge(child.bounds, box));
+            childCosts[i] = (child.isLeaf() ? mergedArea : mergedArea - areaOf(child.bounds)) + inheritedCost;
+        }
+
+        if (cost < childCosts[0] && cost < childCosts[1])
+        {
+            break;
+        }
+        index = childCosts[0] < childCosts[1] ? node.children[0] : node.children[1];
+    }
+
+    uint32_t sibling = index;
+    uint32_t oldParent = m_nodes[sibling].parent;
+    uint32_t newParent = allocateNode();
+
+    m_nodes[newParent].parent = oldParent;
+    m_nodes[newParent].children[0] = sibling;
+    m_nodes[newParent].children[1] = leaf;
+    setBounds(newParent, Aabb::merge(m_nodes[sibling].bounds, box));
+    m_nodes[sibling].parent = newParent;
+    m_nodes[leaf].parent = newParent;
+
+    if (oldParent == INVALID_INDEX)
+    {
+        m_root = newParent;
+        return;
+    }
+
+    Node &parent = m_nodes[oldParent];
+    parent.children[parent.children[0] == sibling ? 0 : 1] = newParent;
+    refitAncestors(oldParent);
+}
+
+void BoundingVolumeHierarchy::removeLeaf(uint32_t leaf)
+{
+    if (leaf == m_root)
+    {
+        m_root = INVALID_INDEX;
+        return;
+    }
+
+    // The sibling takes the place of the leaf's parent, which is released.
+    uint32_t parent = m_nodes[leaf].parent;
+    uint32_t grandParent = m_nodes[parent].parent;
+    uint32_t sibling = m_nodes[parent].children[m_nodes[parent].children[0] == leaf ? 1 : 0];
+
+    m_internalArea -= areaOf(m_nodes[parent].bounds);
+    freeNode(parent);
+    m_nodes[sibling].parent = grandParent;
+
+    if (grandParent == INVALID_INDEX)
+    {
+        m_root = sibling;
+        return;
+    }
+
+    Node &node = m_nodes[grandParent];
+    node.children[node.children[0] == parent ? 0 : 1] = sibling;
+    refitAncestors(grandParent);
+}
+
+void BoundingVolumeHierarchy::refitAncestors(uint32_t node)
+{
+    while (node != INVALID_INDEX)
+    {
+        const Node &current = m_nodes[node];
+        Aabb bounds = Aabb::merge(m_nodes[current.children[0]].bounds, m_nodes[current.children[1]].bounds);
+
+        // Only this subtree changed, so once a node keeps its bounds none of its ancestors change either.
+        if (bounds.min == current.bounds.min && bounds.max == current.bounds.max)
+        {
+            return;
+        }
+        setBounds(node, bounds);
+        node = current.parent;
+    }
+}
+
+void BoundingVolumeHierarchy::setBounds(uint32_t node, const Aabb &bounds)
+{
+    m_internalArea += areaOf(bounds) - areaOf(m_nodes[node].bounds);
+    m_nodes[node].bounds = bounds;
+}
+
+uint32_t BoundingVolumeHierarchy::buildRange(uint32_t *leaves, uint32_t count, uint32_t parent, uint32_t depth)
+{
+    if (count == 1)
+    {
+        m_nodes[leaves[0]].parent = parent;
+        return leaves[0];
+    }
+
+    Aabb centroidBounds{};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        centroidBounds.expand(m_nodes[leaves[i]].bounds.center());
+    }
+
+    glm::vec3 centroidSize = centroidBounds.max - centroidBounds.min;
+    int axis = 0;
+    if (centroidSize.y > centroidSize[axis])
+        axis = 1;
+    if (centroidSize.z > centroidSize[axis])
+        axis = 2;
+
+    uint32_t *middle = leaves + count / 2;
+    if (centroidSize[axis] > 0.0f && depth < MAX_SAH_DEPTH)
+    {
+        // Binned SAH: bucket the centroids along the widest axis and split at the bucket boundary with the lowest
+        // count-weighted surface area.
+        float binScale = SAH_BIN_COUNT / centroidSize[axis];
+        auto binOf = [&](uint32_t leaf) {
+            float offset = m_nodes[leaf].bounds.center()[axis] - centroidBounds.min[axis];
+            return std::min(static_cast<uint32_t>(offset * binScale), SAH_BIN_COUNT - 1);
+        };
+
+        Aabb binBounds[SAH_BIN_COUNT];
+        uint32_t binCounts[SAH_BIN_COUNT] = {};
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t bin = binOf(leaves[i]);
+            binBounds[bin].expand(m_nodes[leaves[i]].bounds);
+            binCounts[bin]++;
+        }
+
+        // Sweep from the right to get the cost of every right-hand side, then from the left to pick the split.
+        double rightCosts[SAH_BIN_COUNT];
+        Aabb accumulated{};
+        uint32_t accumulatedCount = 0;
+        for (uint32_t bin = SAH_BIN_COUNT - 1; bin > 0; bin--)
+        {
+            accumulated.expand(binBounds[bin]);
+            accumulatedCount += binCounts[bin];
+            rightCosts[bin] = accumulatedCount * areaOf(accumulated);
+        }
+
+        uint32_t bestSplit = 0;
+        double bestCost = 0.0;
+        accumulated = Aabb{};
+        accumulatedCount = 0;
+        for (uint32_t split = 1; split < SAH_BIN_COUNT; split++)
+        {
+            accumulated.expand(binBounds[split - 1]);
+            accumulatedCount += binCounts[split - 1];
+            if (accumulatedCount == 0 || accumulatedCount == count)
+            {
+                continue;
+            }
+
+            double cost = accumulatedCount * areaOf(accumulated) + rightCosts[split];
+            if (bestSplit == 0 || cost < bestCost)
+            {
+                bestSplit = split;
+                bestCost = cost;
+            }
+        }
+
+        if (bestSplit != 0)
+        {
+            middle = std::partition(leaves, leaves + count, [&](uint32_t leaf) { return binOf(leaf) < bestSplit; });
+        }
+    }
+    else
+    {
+        std::nth_element(leaves, middle, leaves + count, [&](uint32_t a, uint32_t b) {
+            return m_nodes[a].bounds.center()[axis] < m_nodes[b].bounds.center()[axis];
+        });
+    }
+
+    uint32_t node = allocateNode();
+    uint32_t leftCount = static_cast<uint32_t>(middle - leaves);
+    uint32_t left = buildRange(leaves, leftCount, node, depth + 1);
+    uint32_t right = buildRange(middle, count - leftCount, node, depth + 1);
+
+    m_nodes[node].parent = parent;
+    m_nodes[node].children[0] = left;
+    m_nodes[node].children[1] = right;
+    setBounds(node, Aabb::merge(m_nodes[left].bounds, m_nodes[right].bounds));
+    return node;
+}
+
+} // namespace vionis
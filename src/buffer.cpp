@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <vector>
 
 namespace vionis
 {
@@ -38,37 +39,38 @@ Buffer::~Buffer()
 {
     unmap();
     vkDestroyBuffer(device.device(), buffer, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    device.freeMemory(memory);
 }
 
 /**
  * Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
  *
+ * @note Host visible memory stays mapped as long as it is allocated, so this only looks up the address
+ *
  * @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete
  * buffer range.
  * @param offset (Optional) Byte offset from beginning
  *
- * @return VkResult of the buffer mapping call
+ * @return VK_ERROR_MEMORY_MAP_FAILED if the buffer isn't host visible
  */
-VkResult Buffer::map(VkDeviceSize size, VkDeviceSize offset)
+VkResult Buffer::map([[maybe_unused]] VkDeviceSize size, VkDeviceSize offset)
 {
-    assert(buffer && memory && "Called map on buffer before create");
-    return vkMapMemory(device.device(), memory, offset, size, 0, &mapped);
+    assert(buffer && memory.memory && "Called map on buffer before create");
+    assert((size == VK_WHOLE_SIZE || offset + size <= bufferSize) && "Mapped range exceeds the buffer");
+    if (!memory.mapped)
+    {
+        return VK_ERROR_MEMORY_MAP_FAILED;
+    }
+    mapped = static_cast<char *>(memory.mapped) + offset;
+    return VK_SUCCESS;
 }
 
 /**
  * Unmap a mapped memory range
  *
- * @note Does not return a result as vkUnmapMemory can't fail
+ * @note The memory itself stays mapped until it is freed
  */
-void Buffer::unmap()
-{
-    if (mapped)
-    {
-        vkUnmapMemory(device.device(), memory);
-        mapped = nullptr;
-    }
-}
+void Buffer::unmap() { mapped = nullptr; }
 
 /**
  * Copies the specified data to the mapped buffer. Default value writes whole buffer range
@@ -108,11 +110,12 @@ void Buffer::writeToBuffer(void *data, VkDeviceSize size, VkDeviceSize offset)
  */
 VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
 {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = offset;
-    mappedRange.size = size;
+    if (memory.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+        return VK_SUCCESS;
+    }
+
+    VkMappedMemoryRange mappedRange = device.memoryAllocator().mappedRange(memory, offset, size);
     return vkFlushMappedMemoryRanges(device.device(), 1, &mappedRange);
 }
 
@@ -129,11 +132,12 @@ VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset)
  */
 VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset)
 {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = offset;
-    mappedRange.size = size;
+    if (memory.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+        return VK_SUCCESS;
+    }
+
+    VkMappedMemoryRange mappedRange = device.memoryAllocator().mappedRange(memory, offset, size);
     return vkInvalidateMappedMemoryRanges(device.device(), 1, &mappedRange);
 }
 
@@ -177,6 +181,43 @@ VkResult Buffer::flushIndex(int index)
     return flush(alignmentSize, index * alignmentSize);
 }
 
+/**
+ * Flush several instances with a single call. Runs of consecutive indices are merged into one memory range and
+ * every range is widened to nonCoherentAtomSize, so instances may be packed tighter than the atom size.
+ *
+ * @param sortedIndices Instance indices in ascending order, duplicates are allowed
+ * @param count Number of indices
+ *
+ * @return VkResult of the flush call
+ */
+VkResult Buffer::flushIndices(const uint32_t *sortedIndices, uint32_t count)
+{
+    if (memory.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+        return VK_SUCCESS;
+    }
+
+    const VkDeviceSize atomSize = device.physicalDeviceProperties().limits.nonCoherentAtomSize;
+
+    std::vector<VkMappedMemoryRange> ranges;
+    for (uint32_t i = 0; i < count;)
+    {
+        VkDeviceSize begin = (sortedIndices[i] * alignmentSize) / atomSize * atomSize;
+        VkDeviceSize end = (sortedIndices[i] + 1) * alignmentSize;
+        while (++i < count && sortedIndices[i] * alignmentSize <= (end + atomSize - 1) / atomSize * atomSize)
+        {
+            end = (sortedIndices[i] + 1) * alignmentSize;
+        }
+        ranges.push_back(device.memoryAllocator().mappedRange(memory, begin, end - begin));
+    }
+
+    if (ranges.empty())
+    {
+        return VK_SUCCESS;
+    }
+    return vkFlushMappedMemoryRanges(device.device(), static_cast<uint32_t>(ranges.size()), ranges.data());
+}
+
 /**
  * Create a buffer info descriptor
  *
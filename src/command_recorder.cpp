@@ -0,0 +1,94 @@
+#include "vionis/command_recorder.hpp"
+
+#include <cassert>
+
+namespace vionis
+{
+
+void CommandRecorder::bindPipeline(Pipeline &pipeline)
+{
+    if (m_pipeline == &pipeline)
+    {
+        m_stats.skippedBinds++;
+        return;
+    }
+
+    pipeline.bind(m_commandBuffer);
+    m_pipeline = &pipeline;
+    m_stats.pipelineBinds++;
+}
+
+void CommandRecorder::bindDescriptorSet(VkPipelineLayout layout, uint32_t setIndex, VkDescriptorSet set)
+{
+    assert(setIndex < MAX_DESCRIPTOR_SETS && "Descriptor set index out of range");
+
+    if (m_setLayouts[setIndex] == layout && m_sets[setIndex] == set)
+    {
+        m_stats.skippedBinds++;
+        return;
+    }
+
+    vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, setIndex, 1, &set, 0, nullptr);
+    m_setLayouts[setIndex] = layout;
+    m_sets[setIndex] = set;
+    m_stats.descriptorSetBinds++;
+}
+
+void CommandRecorder::bindVertexBuffer(VkBuffer buffer, VkDeviceSize offset)
+{
+    if (m_vertexBuffer == buffer && m_vertexBufferOffset == offset)
+    {
+        m_stats.skippedBinds++;
+        return;
+    }
+
+    vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &buffer, &offset);
+    m_vertexBuffer = buffer;
+    m_vertexBufferOffset = offset;
+    m_stats.vertexBufferBinds++;
+}
+
+void CommandRecorder::bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType)
+{
+    if (m_indexBuffer == buffer && m_indexBufferOffset == offset && m_indexType == indexType)
+    {
+        m_stats.skippedBinds++;
+        return;
+    }
+
+    vkCmdBindIndexBuffer(m_commandBuffer, buffer, offset, indexType);
+    m_indexBuffer = buffer;
+    m_indexBufferOffset = offset;
+    m_indexType = indexType;
+    m_stats.indexBufferBinds++;
+}
+
+void CommandRecorder::draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance)
+{
+    vkCmdDraw(m_commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+    m_stats.drawCalls++;
+}
+
+void CommandRecorder::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex,
+                                  int32_t vertexOffset, uint32_t firstInstance)
+{
+    vkCmdDrawIndexed(m_commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+    m_stats.drawCalls++;
+}
+
+void CommandRecorder::drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+{
+    vkCmdDrawIndexedIndirect(m_commandBuffer, buffer, offset, drawCount, stride);
+    m_stats.drawCalls++;
+}
+
+void CommandRecorder::drawIndexedIndirectCount(Device &device, VkBuffer buffer, VkDeviceSize offset,
+                                               VkBuffer countBuffer, VkDeviceSize countBufferOffset,
+                                               uint32_t maxDrawCount, uint32_t stride)
+{
+    device.cmdDrawIndexedIndirectCount(m_commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount,
+                                       stride);
+    m_stats.drawCalls++;
+}
+
+} // namespace vionis
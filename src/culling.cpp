@@ -0,0 +1,126 @@
+#include "vionis/culling.hpp"
+
+#include <cmath>
+
+#if defined(VIONIS_X86_KERNELS)
+#include <emmintrin.h>
+#endif
+
+namespace vionis
+{
+
+namespace
+{
+
+bool isSphereVisible(const SphereArrays &spheres, uint32_t i, const CullView &view)
+{
+    const glm::vec3 center{spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]};
+    const float radius = spheres.radius[i];
+
+    for (const auto &plane : view.frustum.planes)
+    {
+        if (glm::dot(glm::vec3{plane}, center) + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+
+    float distance = glm::length(center - view.viewPosition);
+    return radius >= view.minRadius + view.minRadiusPerDistance * distance;
+}
+
+#if defined(VIONIS_X86_KERNELS)
+
+uint32_t cullSpheresSse2(const SphereArrays &spheres, uint32_t count, const CullView &view, uint8_t *visible,
+                         uint32_t &processed)
+{
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p = 0; p < 6; p++)
+    {
+        planeX[p] = _mm_set1_ps(view.frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(view.frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(view.frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(view.frustum.planes[p].w);
+    }
+    const __m128 viewX = _mm_set1_ps(view.viewPosition.x);
+    const __m128 viewY = _mm_set1_ps(view.viewPosition.y);
+    const __m128 viewZ = _mm_set1_ps(view.viewPosition.z);
+    const __m128 minRadius = _mm_set1_ps(view.minRadius);
+    const __m128 minRadiusPerDistance = _mm_set1_ps(view.minRadiusPerDistance);
+
+    uint32_t visibleCount = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(spheres.centerX + i);
+        const __m128 y = _mm_loadu_ps(spheres.centerY + i);
+        const __m128 z = _mm_loadu_ps(spheres.centerZ + i);
+        const __m128 radius = _mm_loadu_ps(spheres.radius + i);
+        const __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+        // The size test also rejects negative radii, since its threshold is never negative.
+        const __m128 dx = _mm_sub_ps(x, viewX);
+        const __m128 dy = _mm_sub_ps(y, viewY);
+        const __m128 dz = _mm_sub_ps(z, viewZ);
+        const __m128 distance =
+            _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        __m128 inside = _mm_cmpge_ps(radius, _mm_add_ps(minRadius, _mm_mul_ps(minRadiusPerDistance, distance)));
+
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 planeDistance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(planeDistance, negativeRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+        }
+        visibleCount += static_cast<uint32_t>(visible[i] + visible[i + 1] + visible[i + 2] + visible[i + 3]);
+    }
+
+    processed = i;
+    return visibleCount;
+}
+
+#endif
+
+} // namespace
+
+CullView CullView::fromCamera(const Camera &camera, float minProjectedSize)
+{
+    const glm::mat4 &projection = camera.getProjection();
+
+    CullView view{};
+    view.frustum = Frustum::fromMatrix(projection * camera.getView());
+    view.viewPosition = camera.getPosition();
+
+    // A sphere of radius r covers r * |P[1][1]| / distance of the viewport height under a perspective projection,
+    // whose w depends on the depth, and r * |P[1][1]| under an orthographic one.
+    float threshold = minProjectedSize > 0.0f ? minProjectedSize / std::abs(projection[1][1]) : 0.0f;
+    bool perspective = projection[2][3] != 0.0f;
+    view.minRadius = perspective ? 0.0f : threshold;
+    view.minRadiusPerDistance = perspective ? threshold : 0.0f;
+    return view;
+}
+
+uint32_t cullSpheres(const SphereArrays &spheres, uint32_t count, const CullView &view, uint8_t *visible)
+{
+    uint32_t visibleCount = 0;
+    uint32_t first = 0;
+#if defined(VIONIS_X86_KERNELS)
+    visibleCount = cullSpheresSse2(spheres, count, view, visible, first);
+#endif
+
+    for (uint32_t i = first; i < count; i++)
+    {
+        visible[i] = isSphereVisible(spheres, i, view) ? 1 : 0;
+        visibleCount += visible[i];
+    }
+    return visibleCount;
+}
+
+} // namespace vionis
@@ -0,0 +1,313 @@
+#include "vionis/depth_pyramid.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace vionis
+{
+
+namespace
+{
+
+constexpr uint32_t WORKGROUP_SIZE = 8;
+
+void computeBarrier(VkCommandBuffer commandBuffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask)
+{
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+} // namespace
+
+DepthPyramid::DepthPyramid(Device &device) : m_device{device}
+{
+    m_setLayout = DescriptorSetLayout::Builder(device)
+                      .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+                      .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT)
+                      .build();
+
+    uint32_t maxSets = MAX_LEVELS * Swapchain::MAX_FRAMES_IN_FLIGHT;
+    m_descriptorPool = DescriptorPool::Builder(device)
+                           .setMaxSets(maxSets)
+                           .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxSets)
+                           .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxSets)
+                           .build();
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstantData);
+
+    VkDescriptorSetLayout setLayout = m_setLayout->getDescriptorSetLayout();
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+    }
+    m_pipeline = std::make_unique<ComputePipeline>(device, "../shaders/bin/depth_pyramid.comp.spv", m_pipelineLayout);
+
+    // Nearest filtering: the shaders only fetch single texels, the sampler is needed for the descriptor type.
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(MAX_LEVELS);
+    if (vkCreateSampler(device.device(), &samplerInfo, nullptr, &m_sampler) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create depth pyramid sampler!");
+    }
+
+    createImage({1, 1});
+}
+
+DepthPyramid::~DepthPyramid()
+{
+    destroyImage();
+    vkDestroySampler(m_device.device(), m_sampler, nullptr);
+    vkDestroyPipelineLayout(m_device.device(), m_pipelineLayout, nullptr);
+}
+
+VkDescriptorImageInfo DepthPyramid::descriptorInfo() const
+{
+    return VkDescriptorImageInfo{m_sampler, m_imageView, VK_IMAGE_LAYOUT_GENERAL};
+}
+
+/**
+ * Creates the image and its views for a level 0 extent and moves it to the general layout
+ *
+ * @param extent Size of level 0
+ */
+void DepthPyramid::createImage(VkExtent2D extent)
+{
+    // Levels halve until both sides reach 1, the narrower side stays at 1 meanwhile.
+    uint32_t levelCount = 1;
+    while (levelCount < MAX_LEVELS && std::max(extent.width, extent.height) >> levelCount > 0)
+    {
+        levelCount++;
+    }
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = extent.width;
+    imageInfo.extent.height = extent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = levelCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.flags = 0;
+    m_device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_imageMemory);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = levelCount;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(m_device.device(), &viewInfo, nullptr, &m_imageView) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create depth pyramid image view!");
+    }
+
+    m_levelViews.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        viewInfo.subresourceRange.baseMipLevel = level;
+        viewInfo.subresourceRange.levelCount = 1;
+        if (vkCreateImageView(m_device.device(), &viewInfo, nullptr, &m_levelViews[level]) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create depth pyramid level view!");
+        }
+    }
+
+    VkCommandBuffer commandBuffer = m_device.beginSingleTimeCommands();
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_image;
+    barrier.subresourceRange = viewInfo.subresourceRange;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0,
+                         nullptr, 0, nullptr, 1, &barrier);
+    m_device.endSingleTimeCommands(commandBuffer);
+
+    m_extent = extent;
+    m_generation++;
+}
+
+void DepthPyramid::destroyImage()
+{
+    for (VkImageView levelView : m_levelViews)
+    {
+        vkDestroyImageView(m_device.device(), levelView, nullptr);
+    }
+    m_levelViews.clear();
+    vkDestroyImageView(m_device.device(), m_imageView, nullptr);
+    vkDestroyImage(m_device.device(), m_image, nullptr);
+    m_device.freeMemory(m_imageMemory);
+}
+
+/**
+ * Returns the descriptor set that reduces into a level, writing it the first time it is used. The first level reads
+ * the depth buffer, which changes with the swapchain image, so its set is rewritten when the depth buffer differs.
+ *
+ * @param frameIndex Frame in flight being recorded
+ * @param level Level the set writes
+ * @param depthView Depth buffer of the frame
+ *
+ * @return Descriptor set for the reduction of the level
+ */
+VkDescriptorSet DepthPyramid::getLevelDescriptorSet(int frameIndex, uint32_t level, VkImageView depthView)
+{
+    std::vector<VkDescriptorSet> &sets = m_levelSets[frameIndex];
+    if (sets.size() <= level)
+    {
+        sets.resize(level + 1, VK_NULL_HANDLE);
+    }
+
+    VkDescriptorImageInfo sourceInfo =
+        level == 0 ? VkDescriptorImageInfo{m_sampler, depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL}
+                   : VkDescriptorImageInfo{m_sampler, m_levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL};
+    VkDescriptorImageInfo targetInfo{VK_NULL_HANDLE, m_levelViews[level], VK_IMAGE_LAYOUT_GENERAL};
+
+    if (sets[level] == VK_NULL_HANDLE)
+    {
+        if (!DescriptorWriter(*m_setLayout, *m_descriptorPool)
+                 .writeImage(0, &sourceInfo)
+                 .writeImage(1, &targetInfo)
+                 .build(sets[level]))
+        {
+            throw std::runtime_error("failed to allocate depth pyramid descriptor set!");
+        }
+    }
+    else if (level == 0 && m_depthViews[frameIndex] != depthView)
+    {
+        // The frame's previous submission has retired, so the set can be rewritten in place.
+        DescriptorWriter(*m_setLayout, *m_descriptorPool).writeImage(0, &sourceInfo).overwrite(sets[level]);
+    }
+
+    if (level == 0)
+    {
+        m_depthViews[frameIndex] = depthView;
+    }
+    return sets[level];
+}
+
+/**
+ * Sizes the pyramid for a depth buffer, recreating it when the extent changed
+ *
+ * @param depthExtent Size of the depth buffer the pyramid is built from
+ */
+void DepthPyramid::resize(VkExtent2D depthExtent)
+{
+    assert(depthExtent.width > 0 && depthExtent.height > 0 && "Cannot build a depth pyramid of an empty depth buffer");
+
+    if (depthExtent.width == m_depthExtent.width && depthExtent.height == m_depthExtent.height)
+    {
+        return;
+    }
+
+    // Frames in flight may still read the pyramid and every descriptor set points at it.
+    vkDeviceWaitIdle(m_device.device());
+    destroyImage();
+    createImage({std::max(1u, depthExtent.width / 2), std::max(1u, depthExtent.height / 2)});
+    m_depthExtent = depthExtent;
+
+    m_descriptorPool->resetPool();
+    for (auto &sets : m_levelSets)
+    {
+        sets.clear();
+    }
+    std::fill(m_depthViews.begin(), m_depthViews.end(), VK_NULL_HANDLE);
+}
+
+/**
+ * Records the reduction of the frame's depth buffer into every level of the pyramid
+ *
+ * @param commandBuffer Command buffer of the frame, outside of any render pass
+ * @param frameIndex Frame in flight being recorded
+ * @param depthView Depth aspect view of the frame's depth buffer, of the extent last passed to resize()
+ */
+void DepthPyramid::build(VkCommandBuffer commandBuffer, int frameIndex, VkImageView depthView)
+{
+    assert(m_depthExtent.width > 0 && "The depth pyramid must be sized before it is built");
+
+    // Every level is overwritten, so the previous contents are discarded. The barrier also waits for the compute
+    // reads of the previous pyramid.
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = levelCount();
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+
+    m_pipeline->bind(commandBuffer);
+
+    glm::ivec2 sourceSize{static_cast<int>(m_depthExtent.width), static_cast<int>(m_depthExtent.height)};
+    glm::ivec2 targetSize{static_cast<int>(m_extent.width), static_cast<int>(m_extent.height)};
+    for (uint32_t level = 0; level < levelCount(); level++)
+    {
+        VkDescriptorSet set = getLevelDescriptorSet(frameIndex, level, depthView);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &set, 0,
+                                nullptr);
+
+        PushConstantData push{sourceSize, targetSize};
+        vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(commandBuffer, (targetSize.x + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                      (targetSize.y + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+        // The next level reads this one; after the last, the culling reads the whole chain.
+        computeBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+        sourceSize = targetSize;
+        targetSize = glm::max(targetSize / 2, glm::ivec2{1});
+    }
+}
+
+} // namespace vionis
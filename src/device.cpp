@@ -1,5 +1,7 @@
 #include "vionis/device.hpp"
 
+#include <cassert>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <set>
@@ -7,19 +9,28 @@
 namespace vionis
 {
 
-Device::Device(Context &context, Window &window) : m_context(context), m_window(window)
+Device::Device(Context &context, Window &window, VkDeviceSize stagingRingSize)
+    : m_context(context), m_window(window)
 {
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice();
     createCommandPool();
+
+    m_uploadBatcher = std::make_unique<UploadBatcher>(*this, stagingRingSize);
 }
 
 Device::~Device()
 {
     m_surface.reset();
 
+    m_uploadBatcher.reset();
+    m_allocator.reset();
     vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    if (m_transferCommandPool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(m_device, m_transferCommandPool, nullptr);
+    }
     vkDestroyDevice(m_device, nullptr);
 }
 
@@ -78,23 +89,32 @@ void Device::pickPhysicalDevice()
 void Device::createLogicalDevice()
 {
     QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
+    m_queueFamilies = indices;
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily, indices.presentFamily};
+    if (indices.transferFamilyHasValue)
+    {
+        uniqueQueueFamilies.insert(indices.transferFamily);
+    }
 
-    float queuePriority = 1.0f;
+    float queuePriorities[] = {1.0f, 1.0f};
     for (uint32_t queueFamily : uniqueQueueFamilies)
     {
+        const bool transferFamily = indices.transferFamilyHasValue && queueFamily == indices.transferFamily;
         VkDeviceQueueCreateInfo queueCreateInfo = {};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = queueFamily;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfo.queueCount = transferFamily ? indices.transferQueueIndex + 1 : 1;
+        queueCreateInfo.pQueuePriorities = queuePriorities;
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+    // Optional, the indirect render path falls back to single draws without them.
+    deviceFeatures.multiDrawIndirect = m_physicalDeviceFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance = m_physicalDeviceFeatures.drawIndirectFirstInstance;
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -102,9 +122,26 @@ void Device::createLogicalDevice()
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
+    // Optional as well, GPU culling writes one command per draw group instead of compacting them without it.
+    std::vector<const char *> enabledExtensions = m_deviceExtensions;
+    bool drawIndirectCount = isDeviceExtensionAvailable(m_physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCount)
+    {
+        enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+    // Lets the memory allocator give resources memory of their own where the driver asks for it.
+    bool dedicatedAllocation =
+        isDeviceExtensionAvailable(m_physicalDevice, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME) &&
+        isDeviceExtensionAvailable(m_physicalDevice, VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+    if (dedicatedAllocation)
+    {
+        enabledExtensions.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
+        enabledExtensions.push_back(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
+    }
+
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(m_deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = m_deviceExtensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
     if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) != VK_SUCCESS)
     {
@@ -113,6 +150,18 @@ void Device::createLogicalDevice()
 
     vkGetDeviceQueue(m_device, indices.graphicsFamily, 0, &m_graphicsQueue);
     vkGetDeviceQueue(m_device, indices.presentFamily, 0, &m_presentQueue);
+    if (indices.transferFamilyHasValue)
+    {
+        vkGetDeviceQueue(m_device, indices.transferFamily, indices.transferQueueIndex, &m_transferQueue);
+    }
+
+    if (drawIndirectCount)
+    {
+        m_cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR"));
+    }
+
+    m_allocator = std::make_unique<MemoryAllocator>(m_device, m_physicalDevice, dedicatedAllocation);
 }
 
 void Device::createCommandPool()
@@ -128,6 +177,15 @@ void Device::createCommandPool()
     {
         throw std::runtime_error("failed to create command pool!");
     }
+
+    if (queueFamilyIndices.transferFamilyHasValue)
+    {
+        poolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+        if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_transferCommandPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create transfer command pool!");
+        }
+    }
 }
 
 void Device::createSurface() { m_surface = m_window.createVulkanSurface(m_context.instance()); }
@@ -169,6 +227,24 @@ bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device)
     return requiredExtensions.empty();
 }
 
+bool Device::isDeviceExtensionAvailable(VkPhysicalDevice device, const char *extensionName)
+{
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto &extension : availableExtensions)
+    {
+        if (strcmp(extension.extensionName, extensionName) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices;
@@ -202,6 +278,44 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device)
         i++;
     }
 
+    // Uploads prefer a transfer-only family, usually the DMA engines of discrete GPUs, then a compute-only one, then a
+    // second queue of the graphics family. Families that can only copy whole mip levels are skipped, since large
+    // images are uploaded in chunks of rows.
+    auto rank = [&](uint32_t family) {
+        const VkQueueFamilyProperties &properties = queueFamilies[family];
+        const VkExtent3D &granularity = properties.minImageTransferGranularity;
+        if (properties.queueCount == 0 || granularity.width != 1 || granularity.height != 1 || granularity.depth != 1)
+        {
+            return 0;
+        }
+        if (indices.graphicsFamilyHasValue && family == indices.graphicsFamily)
+        {
+            return properties.queueCount > 1 ? 1 : 0;
+        }
+        if (properties.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            return 0;
+        }
+        if (properties.queueFlags & VK_QUEUE_COMPUTE_BIT)
+        {
+            return 2;
+        }
+        return properties.queueFlags & VK_QUEUE_TRANSFER_BIT ? 3 : 0;
+    };
+
+    int bestRank = 0;
+    for (uint32_t family = 0; family < queueFamilyCount; family++)
+    {
+        int familyRank = rank(family);
+        if (familyRank > bestRank)
+        {
+            bestRank = familyRank;
+            indices.transferFamily = family;
+            indices.transferQueueIndex = familyRank == 1 ? 1 : 0;
+            indices.transferFamilyHasValue = true;
+        }
+    }
+
     return indices;
 }
 
@@ -267,7 +381,7 @@ uint32_t Device::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags prope
 }
 
 void Device::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-                          VkBuffer &buffer, VkDeviceMemory &bufferMemory)
+                          VkBuffer &buffer, MemoryAllocation &bufferMemory)
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -280,20 +394,7 @@ void Device::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryP
         throw std::runtime_error("failed to create vertex buffer!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to allocate vertex buffer memory!");
-    }
-
-    vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
+    bufferMemory = m_allocator->allocateBufferMemory(buffer, properties);
 }
 
 VkCommandBuffer Device::beginSingleTimeCommands()
@@ -319,6 +420,12 @@ void Device::endSingleTimeCommands(VkCommandBuffer commandBuffer)
 {
     vkEndCommandBuffer(commandBuffer);
 
+    // Pending uploads go first, the commands may depend on them.
+    if (m_uploadBatcher)
+    {
+        m_uploadBatcher->flush();
+    }
+
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
@@ -330,19 +437,28 @@ void Device::endSingleTimeCommands(VkCommandBuffer commandBuffer)
     vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
 }
 
-void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+void Device::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset,
+                        VkDeviceSize dstOffset)
 {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
     VkBufferCopy copyRegion{};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
     copyRegion.size = size;
     vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
     endSingleTimeCommands(commandBuffer);
 }
 
+void Device::cmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset,
+                                         VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint32_t maxDrawCount,
+                                         uint32_t stride)
+{
+    assert(m_cmdDrawIndexedIndirectCount != nullptr && "VK_KHR_draw_indirect_count is not enabled");
+    m_cmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+}
+
 void Device::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, uint32_t layerCount)
 {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
@@ -365,37 +481,30 @@ void Device::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, u
 }
 
 void Device::createImageWithInfo(const VkImageCreateInfo &imageInfo, VkMemoryPropertyFlags properties, VkImage &image,
-                                 VkDeviceMemory &imageMemory)
+                                 MemoryAllocation &imageMemory)
 {
     if (vkCreateImage(m_device, &imageInfo, nullptr, &image) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(m_device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    if (vkBindImageMemory(m_device, image, imageMemory, 0) != VK_SUCCESS)
-    {
-        throw std::runtime_error("failed to bind image memory!");
-    }
+    imageMemory = m_allocator->allocateImageMemory(image, imageInfo.tiling, properties);
 }
 
+void Device::freeMemory(MemoryAllocation &memory) { m_allocator->free(memory); }
+
 void Device::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,
                                    uint32_t mipLevels, uint32_t layerCount)
 {
     VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    cmdTransitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, mipLevels, layerCount);
+    endSingleTimeCommands(commandBuffer);
+}
 
+void Device::cmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format,
+                                      VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels,
+                                      uint32_t layerCount)
+{
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -464,8 +573,6 @@ void Device::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout
         throw std::invalid_argument("unsupported layout transition!");
     }
     vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 std::string Device::physicalDeviceTypeToString(VkPhysicalDeviceType type) const
@@ -0,0 +1,67 @@
+#include "vionis/draw_sort.hpp"
+
+#include <cassert>
+
+namespace vionis
+{
+
+/**
+ * Sorts keys in ascending order and applies the same permutation to values
+ *
+ * @param keys Keys to sort
+ * @param values One value per key
+ * @param keyScratch Scratch storage for the keys
+ * @param valueScratch Scratch storage for the values
+ */
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, std::vector<uint64_t> &keyScratch,
+               std::vector<uint32_t> &valueScratch)
+{
+    assert(keys.size() == values.size() && "Every key needs a value");
+
+    const auto count = static_cast<uint32_t>(keys.size());
+    if (count < 2)
+    {
+        return;
+    }
+
+    // Histogram every byte in one pass over the keys.
+    uint32_t histograms[8][256] = {};
+    for (uint64_t key : keys)
+    {
+        for (int digit = 0; digit < 8; digit++)
+        {
+            histograms[digit][(key >> (8 * digit)) & 0xff]++;
+        }
+    }
+
+    keyScratch.resize(count);
+    valueScratch.resize(count);
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        uint32_t *histogram = histograms[digit];
+        if (histogram[(keys[0] >> (8 * digit)) & 0xff] == count)
+        {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t destination = histogram[(keys[i] >> (8 * digit)) & 0xff]++;
+            keyScratch[destination] = keys[i];
+            valueScratch[destination] = values[i];
+        }
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+} // namespace vionis
@@ -0,0 +1,105 @@
+#include "vionis/entity_archetype.hpp"
+
+#include <cassert>
+
+namespace vionis
+{
+
+/**
+ * Appends a new row with default constructed components
+ *
+ * @param id Entity that owns the row
+ *
+ * @return Index of the new row
+ */
+uint32_t EntityArchetype::push(EntityId id)
+{
+    uint32_t row = size();
+    m_ids.push_back(id);
+
+    if (has(COMPONENT_TRANSFORM_BIT))
+    {
+        m_transforms.emplace_back();
+        m_worldMatrices.emplace_back(1.0f);
+        m_pendingFrames.push_back(0);
+        m_matricesDirty.push_back(0);
+    }
+    if (has(COMPONENT_MATERIAL_BIT))
+        m_materials.emplace_back();
+    if (has(COMPONENT_MODEL_BIT))
+        m_models.emplace_back();
+    if (has(COMPONENT_TEXTURE_BIT))
+        m_textures.emplace_back();
+
+    return row;
+}
+
+/**
+ * Removes a row by moving the last row into its place
+ *
+ * @param row Row to remove
+ *
+ * @return Id of the entity that now occupies row, or INVALID_ID if the removed row was the last one
+ */
+EntityId EntityArchetype::swapRemove(uint32_t row)
+{
+    assert(row < size() && "Archetype row out of range");
+
+    uint32_t last = size() - 1;
+    EntityId movedId = row != last ? m_ids[last] : INVALID_ID;
+
+    auto removeRow = [row, last](auto &array) {
+        if (array.empty())
+            return;
+        if (row != last)
+            array[row] = std::move(array[last]);
+        array.pop_back();
+    };
+
+    removeRow(m_ids);
+    removeRow(m_transforms);
+    removeRow(m_materials);
+    removeRow(m_models);
+    removeRow(m_textures);
+    removeRow(m_worldMatrices);
+    removeRow(m_pendingFrames);
+    removeRow(m_matricesDirty);
+
+    return movedId;
+}
+
+/**
+ * Moves a row into another archetype. Components present in both archetypes are carried over, components only
+ * present in the target are default constructed and the rest are dropped. The source row is left in place and
+ * has to be released with swapRemove afterwards.
+ *
+ * @param row Row to move
+ * @param target Archetype receiving the entity
+ *
+ * @return Index of the row in the target archetype
+ */
+uint32_t EntityArchetype::moveTo(uint32_t row, EntityArchetype &target)
+{
+    assert(&target != this && "Cannot move an entity into its own archetype");
+
+    uint32_t targetRow = target.push(m_ids[row]);
+    ComponentMask shared = m_mask & target.m_mask;
+
+    if (shared & COMPONENT_TRANSFORM_BIT)
+    {
+        target.m_transforms[targetRow] = m_transforms[row];
+        target.m_worldMatrices[targetRow] = m_worldMatrices[row];
+        target.m_pendingFrames[targetRow] = m_pendingFrames[row];
+        target.m_matricesDirty[targetRow] = m_matricesDirty[row];
+    }
+    if (shared & COMPONENT_MATERIAL_BIT)
+        target.m_materials[targetRow] = m_materials[row];
+    if (shared & COMPONENT_MODEL_BIT)
+        target.m_models[targetRow] = std::move(m_models[row]);
+    if (shared & COMPONENT_TEXTURE_BIT)
+        target.m_textures[targetRow] = std::move(m_textures[row]);
+
+    return targetRow;
+}
+
+} // namespace vionis
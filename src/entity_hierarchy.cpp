@@ -0,0 +1,291 @@
+#include "vionis/entity_hierarchy.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace vionis
+{
+
+/**
+ * Attaches child to parent, detaching it from its previous parent first
+ *
+ * @param child Entity to attach
+ * @param parent New parent, must not be child itself or one of its descendants
+ */
+void EntityHierarchy::setParent(EntityId child, EntityId parent)
+{
+    uint32_t childSlot = entityIndex(child);
+    uint32_t parentSlot = entityIndex(parent);
+    ensureSlot(std::max(childSlot, parentSlot));
+
+    for (uint32_t ancestor = parentSlot; ancestor != INVALID_INDEX; ancestor = m_parent[ancestor])
+    {
+        assert(ancestor != childSlot && "Cannot parent an entity to itself or one of its descendants");
+    }
+
+    if (m_parent[childSlot] == parentSlot)
+    {
+        return;
+    }
+
+    unlink(childSlot);
+    m_ids[childSlot] = child;
+    m_ids[parentSlot] = parent;
+
+    m_parent[childSlot] = parentSlot;
+    m_prevSibling[childSlot] = INVALID_INDEX;
+    m_nextSibling[childSlot] = m_firstChild[parentSlot];
+    if (m_firstChild[parentSlot] != INVALID_INDEX)
+    {
+        m_prevSibling[m_firstChild[parentSlot]] = childSlot;
+    }
+    m_firstChild[parentSlot] = childSlot;
+
+    m_layoutDirty = true;
+}
+
+void EntityHierarchy::clearParent(EntityId child)
+{
+    uint32_t slot = entityIndex(child);
+    if (slot < m_parent.size() && m_parent[slot] != INVALID_INDEX)
+    {
+        unlink(slot);
+        m_layoutDirty = true;
+    }
+}
+
+EntityId EntityHierarchy::parent(EntityId child) const
+{
+    uint32_t slot = entityIndex(child);
+    if (slot >= m_parent.size() || m_parent[slot] == INVALID_INDEX)
+    {
+        return EntityArchetype::INVALID_ID;
+    }
+    return m_ids[m_parent[slot]];
+}
+
+void EntityHierarchy::removeEntity(EntityId entity, std::vector<EntityId> &orphans)
+{
+    if (!isLinked(entity))
+    {
+        return;
+    }
+
+    uint32_t slot = entityIndex(entity);
+    unlink(slot);
+
+    for (uint32_t child = m_firstChild[slot]; child != INVALID_INDEX;)
+    {
+        uint32_t next = m_nextSibling[child];
+        m_parent[child] = INVALID_INDEX;
+        m_prevSibling[child] = INVALID_INDEX;
+        m_nextSibling[child] = INVALID_INDEX;
+        orphans.push_back(m_ids[child]);
+        child = next;
+    }
+    m_firstChild[slot] = INVALID_INDEX;
+
+    m_layoutDirty = true;
+}
+
+void EntityHierarchy::rebuild()
+{
+    m_entities.clear();
+    m_parentNodes.clear();
+    m_levelOffsets.clear();
+    std::fill(m_nodeOf.begin(), m_nodeOf.end(), INVALID_INDEX);
+
+    // Roots are linked slots without a parent. Every following level is the concatenation of the children of the
+    // previous level, which keeps siblings next to each other.
+    std::vector<uint32_t> level;
+    for (uint32_t slot = 0; slot < m_parent.size(); slot++)
+    {
+        if (m_parent[slot] == INVALID_INDEX && m_firstChild[slot] != INVALID_INDEX)
+        {
+            level.push_back(slot);
+        }
+    }
+
+    std::vector<uint32_t> nextLevel;
+    while (!level.empty())
+    {
+        m_levelOffsets.push_back(size());
+        nextLevel.clear();
+
+        for (uint32_t slot : level)
+        {
+            m_nodeOf[slot] = size();
+            m_entities.push_back(m_ids[slot]);
+            m_parentNodes.push_back(m_parent[slot] != INVALID_INDEX ? m_nodeOf[m_parent[slot]] : INVALID_INDEX);
+
+            for (uint32_t child = m_firstChild[slot]; child != INVALID_INDEX; child = m_nextSibling[child])
+            {
+                nextLevel.push_back(child);
+            }
+        }
+        level.swap(nextLevel);
+    }
+    m_levelOffsets.push_back(size());
+
+    // Children were appended in the order of their parents, so the parents of the nodes below the roots never
+    // decrease and every node's children start where those of the nodes before it end.
+    m_childOffsets.assign(size() + 1, size());
+    uint32_t child = m_levelOffsets.size() > 1 ? m_levelOffsets[1] : size();
+    for (uint32_t node = 0; node < size(); node++)
+    {
+        while (child < size() && m_parentNodes[child] < node)
+        {
+            child++;
+        }
+        m_childOffsets[node] = child;
+    }
+
+    m_localMatrices.resize(size());
+    m_worldMatrices.resize(size());
+    m_changed.assign(size(), 1);
+    m_changedNodes.resize(size());
+    for (uint32_t node = 0; node < size(); node++)
+    {
+        m_changedNodes[node] = node;
+    }
+
+    m_layoutDirty = false;
+}
+
+void EntityHierarchy::propagate(JobSystem &jobSystem)
+{
+    assert(!m_layoutDirty && "Hierarchy layout must be rebuilt before propagating transforms");
+
+    m_updatedNodes.clear();
+    if (m_changedNodes.empty())
+    {
+        return;
+    }
+
+    // Node indices grow level by level, so the sorted changed nodes can be walked alongside the levels.
+    std::sort(m_changedNodes.begin(), m_changedNodes.end());
+    size_t nextChanged = 0;
+
+    // Runs [begin, end) of nodes to recompute on the current level, sorted and disjoint.
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    std::vector<std::pair<uint32_t, uint32_t>> nextRuns;
+    for (size_t level = 0; level + 1 < m_levelOffsets.size(); level++)
+    {
+        // Merge the children of the runs above with the changed nodes of this level, both sorted by index.
+        nextRuns.clear();
+        auto appendRun = [&](uint32_t begin, uint32_t end) {
+            if (!nextRuns.empty() && begin <= nextRuns.back().second)
+            {
+                nextRuns.back().second = std::max(nextRuns.back().second, end);
+            }
+            else
+            {
+                nextRuns.emplace_back(begin, end);
+            }
+        };
+
+        const uint32_t levelEnd = m_levelOffsets[level + 1];
+        size_t run = 0;
+        while (run < runs.size() || (nextChanged < m_changedNodes.size() && m_changedNodes[nextChanged] < levelEnd))
+        {
+            uint32_t childBegin = run < runs.size() ? m_childOffsets[runs[run].first] : levelEnd;
+            if (nextChanged < m_changedNodes.size() && m_changedNodes[nextChanged] < std::min(childBegin, levelEnd))
+            {
+                appendRun(m_changedNodes[nextChanged], m_changedNodes[nextChanged] + 1);
+                nextChanged++;
+            }
+            else
+            {
+                uint32_t childEnd = m_childOffsets[runs[run].second];
+                if (childBegin < childEnd)
+                {
+                    appendRun(childBegin, childEnd);
+                }
+                run++;
+            }
+        }
+        runs.swap(nextRuns);
+        if (runs.empty())
+        {
+            if (nextChanged == m_changedNodes.size())
+            {
+                break;
+            }
+            continue;
+        }
+
+        const size_t levelBegin = m_updatedNodes.size();
+        for (const auto &[begin, end] : runs)
+        {
+            for (uint32_t node = begin; node < end; node++)
+            {
+                m_updatedNodes.push_back(node);
+            }
+        }
+
+        // Parents live on the previous level, so once a level is done all of its children can run independently.
+        const uint32_t *levelNodes = m_updatedNodes.data() + levelBegin;
+        const uint32_t levelSize = static_cast<uint32_t>(m_updatedNodes.size() - levelBegin);
+        jobSystem.parallelFor(levelSize, 1024, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t node = levelNodes[i];
+                uint32_t parentNode = m_parentNodes[node];
+                m_worldMatrices[node] = parentNode == INVALID_INDEX
+                                            ? m_localMatrices[node]
+                                            : m_worldMatrices[parentNode] * m_localMatrices[node];
+            }
+        });
+    }
+
+    for (uint32_t node : m_changedNodes)
+    {
+        m_changed[node] = 0;
+    }
+    m_changedNodes.clear();
+}
+
+void EntityHierarchy::ensureSlot(uint32_t slot)
+{
+    if (slot < m_parent.size())
+    {
+        return;
+    }
+
+    size_t size = static_cast<size_t>(slot) + 1;
+    m_ids.resize(size, EntityArchetype::INVALID_ID);
+    m_parent.resize(size, INVALID_INDEX);
+    m_firstChild.resize(size, INVALID_INDEX);
+    m_nextSibling.resize(size, INVALID_INDEX);
+    m_prevSibling.resize(size, INVALID_INDEX);
+    m_nodeOf.resize(size, INVALID_INDEX);
+}
+
+void EntityHierarchy::unlink(uint32_t slot)
+{
+    uint32_t parentSlot = m_parent[slot];
+    if (parentSlot == INVALID_INDEX)
+    {
+        return;
+    }
+
+    if (m_prevSibling[slot] != INVALID_INDEX)
+    {
+        m_nextSibling[m_prevSibling[slot]] = m_nextSibling[slot];
+    }
+    else
+    {
+        m_firstChild[parentSlot] = m_nextSibling[slot];
+    }
+    if (m_nextSibling[slot] != INVALID_INDEX)
+    {
+        m_prevSibling[m_nextSibling[slot]] = m_prevSibling[slot];
+    }
+
+    m_parent[slot] = INVALID_INDEX;
+    m_prevSibling[slot] = INVALID_INDEX;
+    m_nextSibling[slot] = INVALID_INDEX;
+}
+
+} // namespace vionis
@@ -1,47 +1,598 @@
 #include "vionis/entity_instance.hpp"
 
-#include <numeric>
+#include "vionis/transform_kernel.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstring>
 
 namespace vionis
 {
 
-EntityRegistry::EntityRegistry(Device &device)
+EntityRegistry::EntityRegistry(Device &device, JobSystem &jobSystem) : m_device{device}, m_jobSystem{jobSystem}
+{
+    for (int i = 0; i < m_instanceBuffers.size(); i++)
+    {
+        m_instanceBuffers[i] = createInstanceBuffer(INITIAL_CAPACITY);
+    }
+}
+
+EntityInstance EntityRegistry::createEntity()
+{
+    uint32_t index;
+    if (!m_freeSlots.empty())
+    {
+        index = m_freeSlots.top();
+        m_freeSlots.pop();
+    }
+    else
+    {
+        assert(m_locations.size() < MAX_ENTITIES && "Max entity count exceeded!");
+        index = static_cast<uint32_t>(m_locations.size());
+        m_locations.push_back({makeEntityId(index, 0), nullptr, 0});
+        m_spatialProxies.push_back(BoundingVolumeHierarchy::INVALID_INDEX);
+        m_worldBounds.emplace_back();
+        m_sphereCenterX.push_back(0.0f);
+        m_sphereCenterY.push_back(0.0f);
+        m_sphereCenterZ.push_back(0.0f);
+        m_sphereRadii.push_back(-1.0f);
+    }
+    m_slotHighWater = std::max(m_slotHighWater, index + 1);
+
+    ComponentMask mask = COMPONENT_TRANSFORM_BIT | COMPONENT_MATERIAL_BIT;
+    if (m_defaultDiffuseTexture)
+    {
+        mask |= COMPONENT_TEXTURE_BIT;
+    }
+
+    EntityLocation &entity = m_locations[index];
+    EntityArchetype &archetype = getOrCreateArchetype(mask);
+    entity.archetype = &archetype;
+    entity.row = archetype.push(entity.id);
+    if (m_defaultDiffuseTexture)
+    {
+        archetype.textures()[entity.row] = m_defaultDiffuseTexture;
+    }
+
+    markDirty(entity.id, true);
+    m_drawListVersion++;
+    return EntityInstance{entity.id, *this};
+}
+
+void EntityRegistry::destroyEntity(EntityInstance::ID entityId)
+{
+    assert(isAlive(entityId) && "Cannot destroy an unknown or already destroyed entity");
+
+    // Children of a destroyed entity become roots and keep their transform as their new world transform.
+    std::vector<EntityInstance::ID> orphans;
+    m_hierarchy.removeEntity(entityId, orphans);
+
+    uint32_t index = entityIndex(entityId);
+    EntityLocation &entity = m_locations[index];
+    removeRow(*entity.archetype, entity.row);
+    removeFromSpatialIndex(index);
+
+    // Bumping the generation invalidates outstanding handles and any queued dirty entries for this slot.
+    entity.id = makeEntityId(index, entityGeneration(entityId) + 1);
+    entity.archetype = nullptr;
+    entity.row = 0;
+    m_freeSlots.push(index);
+    m_drawListVersion++;
+
+    while (m_slotHighWater > 0 && !m_locations[m_slotHighWater - 1].archetype)
+    {
+        m_slotHighWater--;
+    }
+
+    for (EntityInstance::ID orphan : orphans)
+    {
+        markDirty(orphan, true);
+    }
+}
+
+void EntityRegistry::updateTransforms()
+{
+    // A rebuild flags every linked entity as changed.
+    bool hierarchyChanged = false;
+    if (m_hierarchy.layoutDirty())
+    {
+        m_hierarchy.rebuild();
+        hierarchyChanged = true;
+    }
+
+    // Linked entities are flagged in the hierarchy and recomputed by propagation, the rest are independent of each
+    // other and go straight through the batched kernel.
+    const uint32_t staleCount = static_cast<uint32_t>(m_staleEntities.size());
+    EntityInstance::ID *flatEntities = m_jobSystem.scratch().allocate<EntityInstance::ID>(staleCount);
+    uint32_t flatCount = 0;
+    for (EntityInstance::ID entityId : m_staleEntities)
+    {
+        if (!isAlive(entityId))
+        {
+            continue;
+        }
+
+        uint32_t node = m_hierarchy.nodeIndex(entityId);
+        if (node != EntityHierarchy::INVALID_INDEX)
+        {
+            m_hierarchy.markChanged(node);
+            hierarchyChanged = true;
+        }
+        else
+        {
+            flatEntities[flatCount++] = entityId;
+        }
+    }
+    m_staleEntities.clear();
+
+    m_jobSystem.parallelFor(flatCount, 256, [&](uint32_t begin, uint32_t end) {
+        ScratchAllocator &scratch = m_jobSystem.scratch();
+        glm::mat4 *worldMatrices = scratch.allocate<glm::mat4>(end - begin);
+        computeLocalMatrices(flatEntities + begin, end - begin, worldMatrices);
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const EntityLocation &entity = m_locations[entityIndex(flatEntities[i])];
+            entity.archetype->worldMatrices()[entity.row] = worldMatrices[i - begin];
+            entity.archetype->matricesDirty()[entity.row] = 0;
+        }
+    });
+    m_movedEntities.insert(m_movedEntities.end(), flatEntities, flatEntities + flatCount);
+
+    if (hierarchyChanged)
+    {
+        updateHierarchy();
+    }
+    updateSpatialIndex();
+}
+
+void EntityRegistry::updateInstanceBuffers(int frameIndex)
+{
+    updateTransforms();
+    resizeInstanceBuffer(frameIndex);
+
+    auto &dirtyEntities = m_dirtyEntities[frameIndex];
+    if (dirtyEntities.empty())
+    {
+        return;
+    }
+
+    const uint8_t frameBit = static_cast<uint8_t>(1u << frameIndex);
+    const uint32_t dirtyCount = static_cast<uint32_t>(dirtyEntities.size());
+    Buffer &instanceBuffer = *m_instanceBuffers[frameIndex];
+
+    // Every dirty entity appears at most once per frame list, so batches only ever touch their own archetype rows
+    // and buffer slots. Slots that were not written are marked with INVALID_ID and dropped before flushing.
+    uint32_t *writtenSlots = m_jobSystem.scratch().allocate<uint32_t>(dirtyCount);
+
+    m_jobSystem.parallelFor(dirtyCount, 256, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            EntityInstance::ID entityId = dirtyEntities[i];
+            writtenSlots[i] = EntityArchetype::INVALID_ID;
+            if (!isAlive(entityId))
+            {
+                continue;
+            }
+
+            uint32_t slot = entityIndex(entityId);
+            const EntityLocation &entity = m_locations[slot];
+            EntityArchetype &archetype = *entity.archetype;
+
+            if (!archetype.has(COMPONENT_TRANSFORM_BIT))
+            {
+                continue;
+            }
+            archetype.pendingFrames()[entity.row] &= ~frameBit;
+            if (!archetype.has(COMPONENT_MATERIAL_BIT))
+            {
+                continue;
+            }
+            writtenSlots[i] = slot;
+
+            // updateTransforms() has already refreshed the cached matrices of every changed entity.
+            const glm::mat4 &worldMatrix = archetype.worldMatrices()[entity.row];
+
+            EntityGpuData data{};
+            for (int row = 0; row < 3; row++)
+            {
+                data.modelRows[row] = {worldMatrix[0][row], worldMatrix[1][row], worldMatrix[2][row],
+                                       worldMatrix[3][row]};
+            }
+            data.baseColor = glm::packUnorm4x8(glm::vec4{archetype.materials()[entity.row].baseColor, 1.0f});
+
+            instanceBuffer.writeToIndex(&data, slot);
+        }
+    });
+
+    uint32_t *writtenEnd = std::remove(writtenSlots, writtenSlots + dirtyCount, EntityArchetype::INVALID_ID);
+    std::sort(writtenSlots, writtenEnd);
+    instanceBuffer.flushIndices(writtenSlots, static_cast<uint32_t>(writtenEnd - writtenSlots));
+    dirtyEntities.clear();
+}
+
+void EntityRegistry::updateHierarchy()
+{
+    const auto &nodes = m_hierarchy.entities();
+    const uint32_t *changedNodes = m_hierarchy.changedNodes().data();
+    const uint32_t changedCount = static_cast<uint32_t>(m_hierarchy.changedNodes().size());
+
+    // Refresh the local matrices of the nodes whose own transform changed, then push the changes down the tree.
+    EntityInstance::ID *changedEntities = m_jobSystem.scratch().allocate<EntityInstance::ID>(changedCount);
+    for (uint32_t i = 0; i < changedCount; i++)
+    {
+        changedEntities[i] = nodes[changedNodes[i]];
+    }
+
+    m_jobSystem.parallelFor(changedCount, 256, [&](uint32_t begin, uint32_t end) {
+        ScratchAllocator &scratch = m_jobSystem.scratch();
+        glm::mat4 *localMatrices = scratch.allocate<glm::mat4>(end - begin);
+        computeLocalMatrices(changedEntities + begin, end - begin, localMatrices);
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            m_hierarchy.localMatrices()[changedNodes[i]] = localMatrices[i - begin];
+        }
+    });
+
+    m_hierarchy.propagate(m_jobSystem);
+
+    for (uint32_t node : m_hierarchy.updatedNodes())
+    {
+        const EntityLocation &entity = location(nodes[node]);
+        entity.archetype->worldMatrices()[entity.row] = m_hierarchy.worldMatrices()[node];
+        entity.archetype->matricesDirty()[entity.row] = 0;
+        queueUpload(nodes[node]);
+        m_movedEntities.push_back(nodes[node]);
+    }
+}
+
+void EntityRegistry::updateSpatialIndex()
+{
+    const uint32_t movedCount = static_cast<uint32_t>(m_movedEntities.size());
+
+    // Every moved entity is listed once, so its bounds can be transformed in parallel. Only the tree updates that
+    // follow have to run serially.
+    m_jobSystem.parallelFor(movedCount, 1024, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            EntityInstance::ID entityId = m_movedEntities[i];
+            if (!isAlive(entityId))
+            {
+                continue;
+            }
+
+            uint32_t slot = entityIndex(entityId);
+            const EntityLocation &entity = m_locations[slot];
+            if (entity.archetype->has(COMPONENT_MODEL_BIT) && entity.archetype->models()[entity.row])
+            {
+                const Model &model = *entity.archetype->models()[entity.row];
+                const glm::mat4 &worldMatrix = entity.archetype->worldMatrices()[entity.row];
+                m_worldBounds[slot] = model.getBounds().transformed(worldMatrix);
+
+                Sphere sphere = model.getBoundingSphere().transformed(worldMatrix);
+                m_sphereCenterX[slot] = sphere.center.x;
+                m_sphereCenterY[slot] = sphere.center.y;
+                m_sphereCenterZ[slot] = sphere.center.z;
+                m_sphereRadii[slot] = sphere.radius;
+            }
+        }
+    });
+
+    for (EntityInstance::ID entityId : m_movedEntities)
+    {
+        if (!isAlive(entityId))
+        {
+            continue;
+        }
+
+        uint32_t slot = entityIndex(entityId);
+        const EntityLocation &entity = m_locations[slot];
+        if (!entity.archetype->has(COMPONENT_MODEL_BIT) || !entity.archetype->models()[entity.row])
+        {
+            continue;
+        }
+
+        uint32_t &proxy = m_spatialProxies[slot];
+        if (proxy == BoundingVolumeHierarchy::INVALID_INDEX)
+        {
+            proxy = m_spatialIndex.insert(m_worldBounds[slot], entityId);
+        }
+        else
+        {
+            m_spatialIndex.update(proxy, m_worldBounds[slot]);
+        }
+    }
+    m_movedEntities.clear();
+
+    if (m_spatialIndex.needsRebuild())
+    {
+        m_spatialIndex.rebuild();
+    }
+}
+
+void EntityRegistry::removeFromSpatialIndex(uint32_t slot)
+{
+    m_sphereRadii[slot] = -1.0f;
+
+    uint32_t &proxy = m_spatialProxies[slot];
+    if (proxy != BoundingVolumeHierarchy::INVALID_INDEX)
+    {
+        m_spatialIndex.remove(proxy);
+        proxy = BoundingVolumeHierarchy::INVALID_INDEX;
+    }
+}
+
+EntityInstance::ID EntityRegistry::raycast(const Ray &ray, float maxDistance, float *hitDistance) const
+{
+    EntityInstance::ID closest = EntityArchetype::INVALID_ID;
+    float closestDistance = maxDistance;
+
+    m_spatialIndex.raycast(ray, maxDistance, [&](uint32_t entityId, float currentMaxDistance) {
+        float distance = ray.intersect(m_worldBounds[entityIndex(entityId)], currentMaxDistance);
+        if (distance < 0.0f)
+        {
+            return currentMaxDistance;
+        }
+
+        closest = entityId;
+        closestDistance = distance;
+        return distance;
+    });
+
+    if (hitDistance && closest != EntityArchetype::INVALID_ID)
+    {
+        *hitDistance = closestDistance;
+    }
+    return closest;
+}
+
+void EntityRegistry::computeLocalMatrices(const EntityInstance::ID *entities, uint32_t count, glm::mat4 *worldMatrices)
+{
+    // Pack the transforms into structure of arrays form for the batched kernel.
+    float *packed = m_jobSystem.scratch().allocate<float>(count * 9);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const EntityLocation &entity = m_locations[entityIndex(entities[i])];
+        const TransformComponent &transform = entity.archetype->transforms()[entity.row];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            packed[axis * count + i] = transform.position[axis];
+            packed[(3 + axis) * count + i] = transform.rotation[axis];
+            packed[(6 + axis) * count + i] = transform.scale[axis];
+        }
+    }
+
+    TransformArrays transforms{packed,
+                               packed + count,
+                               packed + 2 * count,
+                               packed + 3 * count,
+                               packed + 4 * count,
+                               packed + 5 * count,
+                               packed + 6 * count,
+                               packed + 7 * count,
+                               packed + 8 * count};
+    computeTransformMatrices(transforms, count, worldMatrices);
+}
+
+std::unique_ptr<Buffer> EntityRegistry::createInstanceBuffer(uint32_t capacity)
+{
+    // Records are tightly packed; Buffer::flushIndices widens the flushed ranges to nonCoherentAtomSize itself.
+    auto buffer = std::make_unique<Buffer>(m_device, sizeof(EntityGpuData), capacity,
+                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    buffer->map();
+    return buffer;
+}
+
+void EntityRegistry::resizeInstanceBuffer(int frameIndex)
 {
-    int alignment = std::lcm(device.physicalDeviceProperties().limits.nonCoherentAtomSize,
-                             device.physicalDeviceProperties().limits.minUniformBufferOffsetAlignment);
+    // Grow to the next power of two that holds every live slot, shrink by half once three quarters are unused. The
+    // gap between both thresholds keeps a population hovering around a boundary from reallocating every frame.
+    uint32_t capacity = m_instanceBuffers[frameIndex]->getInstanceCount();
+    uint32_t required = std::max(m_slotHighWater, INITIAL_CAPACITY);
 
-    for (int i = 0; i < m_uniformBuffers.size(); i++)
+    uint32_t newCapacity = capacity;
+    while (newCapacity < required)
+    {
+        newCapacity *= 2;
+    }
+    while (newCapacity > INITIAL_CAPACITY && required <= newCapacity / 4)
+    {
+        newCapacity /= 2;
+    }
+    if (newCapacity == capacity)
     {
-        m_uniformBuffers[i] = std::make_unique<Buffer>(device, sizeof(EntityUniformData), MAX_ENTITIES,
-                                                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, alignment);
-        m_uniformBuffers[i]->map();
+        return;
     }
+
+    // Only this frame's buffer is replaced. Its previous submission has already retired (beginFrame waited on the
+    // frame's fence), while the other frames in flight keep reading their own buffers until their turn comes.
+    std::unique_ptr<Buffer> buffer = createInstanceBuffer(newCapacity);
+    VkDeviceSize preserved = std::min(buffer->getBufferSize(), m_instanceBuffers[frameIndex]->getBufferSize());
+    memcpy(buffer->getMappedMemory(), m_instanceBuffers[frameIndex]->getMappedMemory(), preserved);
+    buffer->flush();
+
+    m_instanceBuffers[frameIndex] = std::move(buffer);
 }
 
-void EntityRegistry::updateUniformBuffers(int frameIndex)
+EntityArchetype &EntityRegistry::getOrCreateArchetype(ComponentMask mask)
 {
-    for (const auto &kv : m_entities)
+    for (auto &archetype : m_archetypes)
     {
-        const auto &obj = kv.second;
-        EntityUniformData data{};
-        data.modelMatrix = obj.transformComponent.toMatrix();
-        data.normalMatrix = obj.transformComponent.computeNormalMatrix();
-        data.baseColor = obj.materialComponent.baseColor;
+        if (archetype->mask() == mask)
+        {
+            return *archetype;
+        }
+    }
+
+    m_archetypes.push_back(std::make_unique<EntityArchetype>(mask));
+    return *m_archetypes.back();
+}
+
+void EntityRegistry::changeComponents(EntityInstance::ID entityId, ComponentMask mask)
+{
+    EntityLocation &entity = m_locations[entityIndex(entityId)];
+    if (entity.archetype->mask() == mask)
+    {
+        return;
+    }
+
+    EntityArchetype &target = getOrCreateArchetype(mask);
+    uint32_t targetRow = entity.archetype->moveTo(entity.row, target);
+    removeRow(*entity.archetype, entity.row);
+
+    entity.archetype = &target;
+    entity.row = targetRow;
+}
+
+void EntityRegistry::removeRow(EntityArchetype &archetype, uint32_t row)
+{
+    EntityInstance::ID movedId = archetype.swapRemove(row);
+    if (movedId != EntityArchetype::INVALID_ID)
+    {
+        m_locations[entityIndex(movedId)].row = row;
+    }
+}
+
+void EntityRegistry::markDirty(EntityInstance::ID entityId, bool transformChanged)
+{
+    const EntityLocation &entity = location(entityId);
+    if (!entity.archetype->has(COMPONENT_TRANSFORM_BIT))
+    {
+        return;
+    }
+
+    if (transformChanged)
+    {
+        uint8_t &matricesDirty = entity.archetype->matricesDirty()[entity.row];
+        if (!matricesDirty)
+        {
+            m_staleEntities.push_back(entityId);
+        }
+        matricesDirty = 1;
+    }
+
+    queueUpload(entityId);
+}
 
-        m_uniformBuffers[frameIndex]->writeToIndex(&data, kv.first);
+void EntityRegistry::queueUpload(EntityInstance::ID entityId)
+{
+    const EntityLocation &entity = location(entityId);
+
+    // Queue the entity once for every frame slot that does not already have it pending.
+    uint8_t &pendingFrames = entity.archetype->pendingFrames()[entity.row];
+    for (int i = 0; i < Swapchain::MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        if (!(pendingFrames & (1u << i)))
+        {
+            m_dirtyEntities[i].push_back(entityId);
+            pendingFrames |= static_cast<uint8_t>(1u << i);
+        }
     }
+}
+
+void EntityRegistry::setParent(EntityInstance::ID child, EntityInstance::ID parent)
+{
+    assert(isAlive(child) && isAlive(parent) && "Cannot link unknown or destroyed entities");
 
-    m_uniformBuffers[frameIndex]->flush();
+    m_hierarchy.setParent(child, parent);
+    markDirty(child, true);
+}
+
+void EntityRegistry::clearParent(EntityInstance::ID child)
+{
+    m_hierarchy.clearParent(child);
+    markDirty(child, true);
 }
 
 // ---------- EntityInstance ----------
 
-VkDescriptorBufferInfo EntityInstance::getUniformBufferInfo(int frameIndex) const
+bool EntityInstance::valid() const { return registry->isAlive(id); }
+
+EntityInstance::ID EntityInstance::getParentId() const { return registry->m_hierarchy.parent(id); }
+
+void EntityInstance::setParent(const EntityInstance &parent) { registry->setParent(id, parent.id); }
+
+void EntityInstance::clearParent() { registry->clearParent(id); }
+
+TransformComponent &EntityInstance::transform()
+{
+    registry->markDirty(id, true);
+
+    const auto &entity = registry->location(id);
+    return entity.archetype->transforms()[entity.row];
+}
+
+const TransformComponent &EntityInstance::transform() const
+{
+    const auto &entity = registry->location(id);
+    return entity.archetype->transforms()[entity.row];
+}
+
+MaterialComponent &EntityInstance::material()
+{
+    registry->markDirty(id, false);
+
+    const auto &entity = registry->location(id);
+    return entity.archetype->materials()[entity.row];
+}
+
+const MaterialComponent &EntityInstance::material() const
 {
-    return registryRef.getEntityUniformBufferInfo(id, frameIndex);
+    const auto &entity = registry->location(id);
+    return entity.archetype->materials()[entity.row];
+}
+
+const std::shared_ptr<Model> &EntityInstance::model() const
+{
+    static const std::shared_ptr<Model> none;
+
+    const auto &entity = registry->location(id);
+    return entity.archetype->has(COMPONENT_MODEL_BIT) ? entity.archetype->models()[entity.row] : none;
+}
+
+void EntityInstance::setModel(std::shared_ptr<Model> model)
+{
+    ComponentMask mask = registry->location(id).archetype->mask();
+    registry->changeComponents(id, model ? mask | COMPONENT_MODEL_BIT : mask & ~COMPONENT_MODEL_BIT);
+    registry->m_drawListVersion++;
+
+    if (model)
+    {
+        const auto &entity = registry->location(id);
+        entity.archetype->models()[entity.row] = std::move(model);
+
+        // Routes the entity through updateTransforms(), which refits its bounds for the new model.
+        registry->markDirty(id, true);
+    }
+    else
+    {
+        registry->removeFromSpatialIndex(entityIndex(id));
+    }
+}
+
+const std::shared_ptr<Texture> &EntityInstance::diffuseTexture() const
+{
+    static const std::shared_ptr<Texture> none;
+
+    const auto &entity = registry->location(id);
+    return entity.archetype->has(COMPONENT_TEXTURE_BIT) ? entity.archetype->textures()[entity.row] : none;
+}
+
+void EntityInstance::setDiffuseTexture(std::shared_ptr<Texture> texture)
+{
+    ComponentMask mask = registry->location(id).archetype->mask();
+    registry->changeComponents(id, texture ? mask | COMPONENT_TEXTURE_BIT : mask & ~COMPONENT_TEXTURE_BIT);
+    registry->m_drawListVersion++;
+
+    if (texture)
+    {
+        const auto &entity = registry->location(id);
+        entity.archetype->textures()[entity.row] = std::move(texture);
+    }
 }
 
-EntityInstance::EntityInstance(ID objId, const EntityRegistry &registry) : id{objId}, registryRef{registry} {}
+EntityInstance::EntityInstance(ID objId, EntityRegistry &registry) : id{objId}, registry{&registry} {}
 
 } // namespace vionis
@@ -0,0 +1,97 @@
+#include "vionis/geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace vionis
+{
+
+Aabb Aabb::transformed(const glm::mat4 &transform) const
+{
+    if (!valid())
+    {
+        return {};
+    }
+
+    // Transform the center, then project the extent onto each world axis through the absolute rotation/scale block.
+    glm::vec3 newCenter{transform * glm::vec4{center(), 1.0f}};
+    glm::vec3 halfExtent = extent();
+    glm::vec3 newExtent{0.0f};
+    for (int axis = 0; axis < 3; axis++)
+    {
+        newExtent += glm::abs(glm::vec3{transform[axis]}) * halfExtent[axis];
+    }
+
+    return {newCenter - newExtent, newCenter + newExtent};
+}
+
+Sphere Sphere::transformed(const glm::mat4 &transform) const
+{
+    float maxScaleSquared = 0.0f;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        glm::vec3 column{transform[axis]};
+        maxScaleSquared = std::max(maxScaleSquared, glm::dot(column, column));
+    }
+
+    return {glm::vec3{transform * glm::vec4{center, 1.0f}}, radius * std::sqrt(maxScaleSquared)};
+}
+
+float Ray::intersect(const Aabb &box, float maxDistance) const
+{
+    float entry = 0.0f;
+    float exit = maxDistance;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (direction[axis] == 0.0f)
+        {
+            if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis])
+            {
+                return -1.0f;
+            }
+            continue;
+        }
+
+        float inverse = 1.0f / direction[axis];
+        float near = (box.min[axis] - origin[axis]) * inverse;
+        float far = (box.max[axis] - origin[axis]) * inverse;
+        if (near > far)
+        {
+            std::swap(near, far);
+        }
+
+        entry = std::max(entry, near);
+        exit = std::min(exit, far);
+        if (entry > exit)
+        {
+            return -1.0f;
+        }
+    }
+
+    return entry;
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4 &projectionView)
+{
+    auto row = [&projectionView](int index) {
+        return glm::vec4{projectionView[0][index], projectionView[1][index], projectionView[2][index],
+                         projectionView[3][index]};
+    };
+
+    Frustum frustum{};
+    frustum.planes[0] = row(3) + row(0); // left
+    frustum.planes[1] = row(3) - row(0); // right
+    frustum.planes[2] = row(3) + row(1); // bottom
+    frustum.planes[3] = row(3) - row(1); // top
+    frustum.planes[4] = row(2);          // near, depth range is [0, 1]
+    frustum.planes[5] = row(3) - row(2); // far
+
+    for (auto &plane : frustum.planes)
+    {
+        plane /= glm::length(glm::vec3{plane});
+    }
+    return frustum;
+}
+
+} // namespace vionis
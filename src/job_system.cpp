@@ -0,0 +1,266 @@
+#include "vionis/job_system.hpp"
+
+#include <cassert>
+
+namespace vionis
+{
+
+namespace
+{
+
+// Worker identity of the current thread. Threads that are not workers of any job system report worker 0.
+thread_local const JobSystem *t_jobSystem = nullptr;
+thread_local uint32_t t_workerIndex = 0;
+
+} // namespace
+
+// ---------- ScratchAllocator ----------
+
+/**
+ * Allocate memory from the current block, starting a new block when it does not fit
+ *
+ * @param size Size of the allocation in bytes
+ * @param alignment Required alignment, must be a power of two
+ *
+ * @return Pointer to the allocation, valid until the next reset()
+ */
+void *ScratchAllocator::allocate(size_t size, size_t alignment)
+{
+    assert((alignment & (alignment - 1)) == 0 && "Scratch alignment must be a power of two");
+
+    while (m_currentBlock < m_blocks.size())
+    {
+        Block &block = m_blocks[m_currentBlock];
+        auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+        size_t offset = ((base + m_offset + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset + size <= block.size)
+        {
+            m_offset = offset + size;
+            return block.memory.get() + offset;
+        }
+
+        m_currentBlock++;
+        m_offset = 0;
+    }
+
+    size_t blockSize = std::max(m_blockSize, size + alignment);
+    m_blocks.push_back({std::make_unique<std::byte[]>(blockSize), blockSize});
+    m_currentBlock = m_blocks.size() - 1;
+    m_offset = 0;
+    return allocate(size, alignment);
+}
+
+void ScratchAllocator::reset()
+{
+    m_currentBlock = 0;
+    m_offset = 0;
+}
+
+// ---------- JobSystem ----------
+
+JobSystem::JobSystem(uint32_t workerCount)
+{
+    if (workerCount == 0)
+    {
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+        m_scratch.push_back(std::make_unique<ScratchAllocator>());
+    }
+
+    // Worker 0 is the owning thread, only the remaining workers get their own thread.
+    for (uint32_t i = 1; i < workerCount; i++)
+    {
+        m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock{m_sleepMutex};
+        m_stopping = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for (auto &thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+JobSystem::JobHandle JobSystem::schedule(std::function<void()> fn, std::initializer_list<JobHandle> dependencies)
+{
+    return schedule(std::move(fn), std::vector<JobHandle>(dependencies));
+}
+
+JobSystem::JobHandle JobSystem::schedule(std::function<void()> fn, const std::vector<JobHandle> &dependencies)
+{
+    auto job = std::make_shared<Job>();
+    job->m_fn = std::move(fn);
+    for (const auto &dependency : dependencies)
+    {
+        addDependency(job, dependency);
+    }
+
+    // Drop the guard reference taken at construction, queueing the job if nothing else holds it back.
+    release(job);
+    return job;
+}
+
+void JobSystem::wait(const JobHandle &job)
+{
+    uint32_t workerIndex = currentWorker();
+    while (!job->finished())
+    {
+        if (!runOne(workerIndex))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+ScratchAllocator &JobSystem::scratch() { return *m_scratch[currentWorker()]; }
+
+void JobSystem::resetScratch()
+{
+    for (auto &scratch : m_scratch)
+    {
+        scratch->reset();
+    }
+}
+
+void JobSystem::workerLoop(uint32_t workerIndex)
+{
+    t_jobSystem = this;
+    t_workerIndex = workerIndex;
+
+    while (true)
+    {
+        if (runOne(workerIndex))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{m_sleepMutex};
+        m_wakeCondition.wait(lock, [this]() { return m_stopping || m_queuedJobs.load() > 0; });
+        if (m_stopping)
+        {
+            return;
+        }
+    }
+}
+
+void JobSystem::enqueue(JobHandle job)
+{
+    WorkerQueue &queue = *m_queues[currentWorker()];
+    {
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.jobs.push_back(std::move(job));
+    }
+
+    // Taking the sleep mutex orders the counter update against a worker that is about to go to sleep.
+    {
+        std::lock_guard<std::mutex> lock{m_sleepMutex};
+        m_queuedJobs++;
+    }
+    m_wakeCondition.notify_one();
+}
+
+void JobSystem::execute(const JobHandle &job)
+{
+    job->m_fn();
+    job->m_fn = nullptr;
+
+    std::vector<JobHandle> continuations;
+    {
+        std::lock_guard<std::mutex> lock{job->m_mutex};
+        job->m_finished.store(true, std::memory_order_release);
+        continuations.swap(job->m_continuations);
+    }
+
+    for (const auto &continuation : continuations)
+    {
+        release(continuation);
+    }
+}
+
+bool JobSystem::runOne(uint32_t workerIndex)
+{
+    JobHandle job = pop(workerIndex);
+    if (!job)
+    {
+        job = steal(workerIndex);
+    }
+    if (!job)
+    {
+        return false;
+    }
+
+    m_queuedJobs--;
+    execute(job);
+    return true;
+}
+
+JobSystem::JobHandle JobSystem::pop(uint32_t workerIndex)
+{
+    WorkerQueue &queue = *m_queues[workerIndex];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.jobs.empty())
+    {
+        return nullptr;
+    }
+
+    JobHandle job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return job;
+}
+
+JobSystem::JobHandle JobSystem::steal(uint32_t thiefIndex)
+{
+    uint32_t count = workerCount();
+    for (uint32_t i = 1; i < count; i++)
+    {
+        WorkerQueue &queue = *m_queues[(thiefIndex + i) % count];
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        if (!queue.jobs.empty())
+        {
+            JobHandle job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::addDependency(const JobHandle &job, const JobHandle &dependency)
+{
+    if (!dependency)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{dependency->m_mutex};
+    if (dependency->m_finished.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    job->m_pendingDependencies++;
+    dependency->m_continuations.push_back(job);
+}
+
+void JobSystem::release(const JobHandle &job)
+{
+    if (job->m_pendingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        enqueue(job);
+    }
+}
+
+uint32_t JobSystem::currentWorker() const { return t_jobSystem == this ? t_workerIndex : 0; }
+
+} // namespace vionis
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <memory>
 #include <random>
+#include <utility>
 #include <vector>
 
 int main(int argc, char **argv)
@@ -27,47 +28,45 @@ int main(int argc, char **argv)
                 .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, vionis::Swapchain::MAX_FRAMES_IN_FLIGHT)
                 .build();
 
-        std::vector<std::unique_ptr<vionis::DescriptorPool>> framePools(vionis::Swapchain::MAX_FRAMES_IN_FLIGHT);
-        auto framePoolBuilder =
-            vionis::DescriptorPool::Builder(device)
-                .setMaxSets(vionis::EntityRegistry::MAX_ENTITIES)
-                .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, vionis::EntityRegistry::MAX_ENTITIES)
-                .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, vionis::EntityRegistry::MAX_ENTITIES)
-                .setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
-        for (int i = 0; i < framePools.size(); i++)
-        {
-            framePools[i] = framePoolBuilder.build();
-        }
+        // Declared before the registry, whose entities keep models suballocated from the pool alive.
+        vionis::MeshPool meshPool{device, sizeof(vionis::Model::Vertex)};
 
-        vionis::EntityRegistry entityRegistry{device};
+        vionis::JobSystem jobSystem;
+        vionis::EntityRegistry entityRegistry{device, jobSystem};
 
         std::shared_ptr<vionis::Model> model =
-            vionis::Model::createFromFile(device, "../assets/models/tiny_frog/model.obj");
+            vionis::Model::createFromFile(device, "../assets/models/tiny_frog/model.obj", &meshPool);
 
         std::shared_ptr<vionis::Texture> texture =
             vionis::Texture::createFromFile(device, "../assets/models/tiny_frog/textures/baseColor.png");
 
-        auto &tinyFrog = entityRegistry.createEntity();
-        tinyFrog.model = model;
-        tinyFrog.diffuseTexture = texture;
+        auto tinyFrog = entityRegistry.createEntity();
+        tinyFrog.setModel(model);
+        tinyFrog.setDiffuseTexture(texture);
 
-        tinyFrog.transformComponent.position = {0.0f, 0.0f, 0.0f};
-        tinyFrog.transformComponent.scale = {1.0f, 1.0f, 1.0f};
-        tinyFrog.transformComponent.rotation = {0.0f, 0.0f, 0.0f};
+        tinyFrog.transform().position = {0.0f, 0.0f, 0.0f};
+        tinyFrog.transform().scale = {1.0f, 1.0f, 1.0f};
+        tinyFrog.transform().rotation = {0.0f, 0.0f, 0.0f};
 
-        tinyFrog.materialComponent.baseColor = {0.8f, 0.8f, 0.8f};
+        tinyFrog.material().baseColor = {0.8f, 0.8f, 0.8f};
 
+        // Uniforms are written every frame, so they go to device local memory only where the host can write it.
+        VkMemoryPropertyFlags uboMemoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        if (device.uploadBatcher().directUploads())
+        {
+            uboMemoryProperties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        }
         std::vector<std::unique_ptr<vionis::Buffer>> uboBuffers(vionis::Swapchain::MAX_FRAMES_IN_FLIGHT);
         for (int i = 0; i < uboBuffers.size(); i++)
         {
             uboBuffers[i] = std::make_unique<vionis::Buffer>(device, sizeof(vionis::GlobalUniformBufferObject), 1,
-                                                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+                                                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, uboMemoryProperties);
             uboBuffers[i]->map();
         }
 
         auto globalSetLayout = vionis::DescriptorSetLayout::Builder(device)
-                                   .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS)
+                                   .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                               VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT)
                                    .build();
 
         std::vector<VkDescriptorSet> globalDescriptorSets(vionis::Swapchain::MAX_FRAMES_IN_FLIGHT);
@@ -83,8 +82,8 @@ int main(int argc, char **argv)
                                                          globalSetLayout->getDescriptorSetLayout()};
 
         vionis::Camera camera{};
-        auto &viewerObject = entityRegistry.createEntity();
-        viewerObject.transformComponent.position = {1.0f, 1.0f, 1.0f};
+        auto viewerObject = entityRegistry.createEntity();
+        viewerObject.transform().position = {1.0f, 1.0f, 1.0f};
 
         auto currentTime = std::chrono::high_resolution_clock::now();
 
@@ -98,19 +97,15 @@ int main(int argc, char **argv)
 
             float aspect = renderer.getAspectRatio();
             camera.setPerspectiveProjection(75.f, aspect, 0.1f, 4096.0f);
-            camera.setViewTarget(viewerObject.transformComponent.position, glm::vec3(0.0f, 0.0f, 0.0f));
+            camera.setViewTarget(std::as_const(viewerObject).transform().position, glm::vec3(0.0f, 0.0f, 0.0f));
+
+            jobSystem.resetScratch();
 
             if (auto commandBuffer = renderer.beginFrame())
             {
                 int frameIndex = renderer.getFrameIndex();
-                framePools[frameIndex]->resetPool();
-                vionis::FrameInfo frameInfo{frameIndex,
-                                            frameTime,
-                                            commandBuffer,
-                                            camera,
-                                            globalDescriptorSets[frameIndex],
-                                            *framePools[frameIndex],
-                                            entityRegistry.entities()};
+                vionis::FrameInfo frameInfo{frameIndex, frameTime, commandBuffer, camera,
+                                            globalDescriptorSets[frameIndex], entityRegistry};
 
                 vionis::GlobalUniformBufferObject ubo{};
                 ubo.projection = camera.getProjection();
@@ -119,13 +114,22 @@ int main(int argc, char **argv)
                 uboBuffers[frameIndex]->writeToBuffer(&ubo);
                 uboBuffers[frameIndex]->flush();
 
-                entityRegistry.updateUniformBuffers(frameIndex);
+                entityRegistry.updateInstanceBuffers(frameIndex);
+                simpleRenderSystem.cullGameObjects(frameInfo, renderer.getSwapchainExtent());
 
-                renderer.beginSwapchainRenderPass(commandBuffer);
+                renderer.beginSwapchainRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-                simpleRenderSystem.renderGameObjects(frameInfo);
+                simpleRenderSystem.renderGameObjects(frameInfo, renderer, jobSystem);
 
                 renderer.endSwapchainRenderPass(commandBuffer);
+
+                // Draws what the first pass skipped as occluded last frame and turns out visible against its depth.
+                if (simpleRenderSystem.cullOccludedGameObjects(frameInfo, renderer.getCurrentDepthImageView()))
+                {
+                    renderer.resumeSwapchainRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                    simpleRenderSystem.renderGameObjects(frameInfo, renderer, jobSystem);
+                    renderer.endSwapchainRenderPass(commandBuffer);
+                }
                 renderer.endFrame();
             }
         }
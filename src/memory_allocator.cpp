@@ -0,0 +1,793 @@
+#include "vionis/memory_allocator.hpp"
+
+#include "vionis/utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace vionis
+{
+
+namespace
+{
+
+// Every range starts and ends at a multiple of this, so alignments up to it come for free.
+constexpr VkDeviceSize MIN_ALIGNMENT = 16;
+
+// Second level classes per power of two.
+constexpr uint32_t SECOND_LEVEL_BITS = 4;
+constexpr uint32_t SECOND_LEVEL_COUNT = 1u << SECOND_LEVEL_BITS;
+// Sizes below this are split linearly into MIN_ALIGNMENT steps and share the first first-level class.
+constexpr uint32_t SMALL_SIZE_BITS = 8;
+constexpr VkDeviceSize SMALL_SIZE = 1ull << SMALL_SIZE_BITS;
+constexpr uint32_t FIRST_LEVEL_COUNT = 64 - SMALL_SIZE_BITS + 1;
+
+static_assert(SMALL_SIZE / SECOND_LEVEL_COUNT == MIN_ALIGNMENT, "small size classes must be MIN_ALIGNMENT apart");
+
+// Heaps up to this size get blocks of an eighth of the heap instead of DEFAULT_BLOCK_SIZE.
+constexpr VkDeviceSize SMALL_HEAP_SIZE = 1ull << 30;
+
+uint32_t floorLog2(VkDeviceSize value)
+{
+    uint32_t log = 0;
+    while (value >>= 1)
+    {
+        log++;
+    }
+    return log;
+}
+
+uint32_t lowestBit(uint64_t bits)
+{
+    uint32_t index = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+}
+
+} // namespace
+
+// ---------- MemoryBlock ----------
+
+// One VkDeviceMemory and the TLSF bookkeeping of its ranges, called regions. Regions are linked in address order to
+// find the neighbours to merge with, and free regions are additionally linked into the list of their size class.
+class MemoryBlock
+{
+public:
+    static constexpr uint32_t INVALID_REGION = ~0u;
+    // A dedicated block is exactly as large as its resource, which holds this region from the block's creation on.
+    static constexpr uint32_t DEDICATED_REGION = 0;
+
+    MemoryBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void *mapped,
+                bool optimalImages, bool dedicated);
+    ~MemoryBlock();
+
+    MemoryBlock(const MemoryBlock &) = delete;
+    MemoryBlock &operator=(const MemoryBlock &) = delete;
+
+    // Finds a free range of size bytes at the given power of two alignment. size is rounded up to MIN_ALIGNMENT.
+    bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, uint32_t &region);
+    void free(uint32_t region);
+
+    VkDeviceMemory memory() const { return m_memory; }
+    VkDeviceSize size() const { return m_size; }
+    uint32_t memoryType() const { return m_memoryType; }
+    void *mapped() const { return m_mapped; }
+    bool optimalImages() const { return m_optimalImages; }
+    bool dedicated() const { return m_dedicated; }
+    bool empty() const { return m_allocationCount == 0; }
+    uint32_t allocationCount() const { return m_allocationCount; }
+    VkDeviceSize allocatedBytes() const { return m_allocatedBytes; }
+
+private:
+    struct Region
+    {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        uint32_t previousPhysical;
+        uint32_t nextPhysical;
+        uint32_t previousFree;
+        uint32_t nextFree;
+        bool free;
+    };
+
+    static void mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel);
+    uint32_t findFree(VkDeviceSize size) const;
+    uint32_t findFitInClass(VkDeviceSize size, VkDeviceSize alignment) const;
+    uint32_t createRegion(VkDeviceSize offset, VkDeviceSize size);
+    void releaseRegion(uint32_t region);
+    void insertFree(uint32_t region);
+    void removeFree(uint32_t region);
+
+    VkDevice m_device;
+    VkDeviceMemory m_memory;
+    VkDeviceSize m_size;
+    uint32_t m_memoryType;
+    void *m_mapped;
+    bool m_optimalImages;
+    bool m_dedicated;
+
+    std::vector<Region> m_regions;
+    std::vector<uint32_t> m_unusedRegions;
+    uint64_t m_firstLevelBitmap{0};
+    uint32_t m_secondLevelBitmaps[FIRST_LEVEL_COUNT]{};
+    uint32_t m_freeHeads[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+
+    uint32_t m_allocationCount{0};
+    VkDeviceSize m_allocatedBytes{0};
+};
+
+MemoryBlock::MemoryBlock(VkDevice device, VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, void *mapped,
+                         bool optimalImages, bool dedicated)
+    : m_device{device}, m_memory{memory}, m_size{size}, m_memoryType{memoryType}, m_mapped{mapped},
+      m_optimalImages{optimalImages}, m_dedicated{dedicated}
+{
+    for (auto &heads : m_freeHeads)
+    {
+        std::fill(std::begin(heads), std::end(heads), INVALID_REGION);
+    }
+
+    if (dedicated)
+    {
+        createRegion(0, size);
+        m_allocationCount = 1;
+        m_allocatedBytes = size;
+        return;
+    }
+
+    // The tail beyond the last multiple of MIN_ALIGNMENT is never handed out.
+    uint32_t region = createRegion(0, size / MIN_ALIGNMENT * MIN_ALIGNMENT);
+    insertFree(region);
+}
+
+MemoryBlock::~MemoryBlock()
+{
+    if (m_mapped)
+    {
+        vkUnmapMemory(m_device, m_memory);
+    }
+    vkFreeMemory(m_device, m_memory, nullptr);
+}
+
+/**
+ * Maps a size to its first and second level class
+ *
+ * @param size Size in bytes, a multiple of MIN_ALIGNMENT
+ * @param firstLevel Receives the first level class
+ * @param secondLevel Receives the second level class
+ */
+void MemoryBlock::mapping(VkDeviceSize size, uint32_t &firstLevel, uint32_t &secondLevel)
+{
+    if (size < SMALL_SIZE)
+    {
+        firstLevel = 0;
+        secondLevel = static_cast<uint32_t>(size / MIN_ALIGNMENT);
+        return;
+    }
+
+    uint32_t log = floorLog2(size);
+    firstLevel = log - SMALL_SIZE_BITS + 1;
+    secondLevel = static_cast<uint32_t>(size >> (log - SECOND_LEVEL_BITS)) - SECOND_LEVEL_COUNT;
+}
+
+/**
+ * Finds a free region of at least size bytes in constant time. The size is rounded up to the next class first, so
+ * that every region of the class found is large enough.
+ *
+ * @param size Size in bytes, a multiple of MIN_ALIGNMENT
+ * @return The region, or INVALID_REGION
+ */
+uint32_t MemoryBlock::findFree(VkDeviceSize size) const
+{
+    if (size >= SMALL_SIZE)
+    {
+        size += (1ull << (floorLog2(size) - SECOND_LEVEL_BITS)) - 1;
+    }
+
+    uint32_t firstLevel, secondLevel;
+    mapping(size, firstLevel, secondLevel);
+    if (firstLevel >= FIRST_LEVEL_COUNT)
+    {
+        return INVALID_REGION;
+    }
+
+    uint32_t secondLevelMap = m_secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+    if (secondLevelMap == 0)
+    {
+        uint64_t firstLevelMap = firstLevel + 1 < 64 ? m_firstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+        if (firstLevelMap == 0)
+        {
+            return INVALID_REGION;
+        }
+        firstLevel = lowestBit(firstLevelMap);
+        secondLevelMap = m_secondLevelBitmaps[firstLevel];
+    }
+    return m_freeHeads[firstLevel][lowestBit(secondLevelMap)];
+}
+
+/**
+ * Looks through the regions of the class size falls into for one that fits, which findFree() skips since not all of
+ * them do. Used before giving up on the block.
+ *
+ * @param size Size in bytes, a multiple of MIN_ALIGNMENT
+ * @param alignment Required alignment of the offset
+ * @return The region, or INVALID_REGION
+ */
+uint32_t MemoryBlock::findFitInClass(VkDeviceSize size, VkDeviceSize alignment) const
+{
+    uint32_t firstLevel, secondLevel;
+    mapping(size, firstLevel, secondLevel);
+    if (firstLevel >= FIRST_LEVEL_COUNT)
+    {
+        return INVALID_REGION;
+    }
+
+    for (uint32_t region = m_freeHeads[firstLevel][secondLevel]; region != INVALID_REGION;
+         region = m_regions[region].nextFree)
+    {
+        const Region &candidate = m_regions[region];
+        if (alignUp(candidate.offset, alignment) + size <= candidate.offset + candidate.size)
+        {
+            return region;
+        }
+    }
+    return INVALID_REGION;
+}
+
+/**
+ * Carves a range out of the best fitting free region, splitting off the alignment padding in front and the unused
+ * tail as free regions of their own
+ *
+ * @param size Size in bytes
+ * @param alignment Required alignment of the offset, a power of two
+ * @param offset Receives the offset of the range
+ * @param region Receives the region to free the range with
+ * @return Whether the block had room
+ */
+bool MemoryBlock::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset, uint32_t &region)
+{
+    size = alignUp(size, MIN_ALIGNMENT);
+    alignment = std::max(alignment, MIN_ALIGNMENT);
+
+    uint32_t candidate = findFree(size + alignment - MIN_ALIGNMENT);
+    if (candidate == INVALID_REGION)
+    {
+        candidate = findFitInClass(size, alignment);
+        if (candidate == INVALID_REGION)
+        {
+            return false;
+        }
+    }
+    removeFree(candidate);
+
+    const VkDeviceSize regionOffset = m_regions[candidate].offset;
+    const VkDeviceSize alignedOffset = alignUp(regionOffset, alignment);
+    if (alignedOffset > regionOffset)
+    {
+        // The physical neighbour in front is in use, free neighbours are always merged.
+        uint32_t padding = createRegion(regionOffset, alignedOffset - regionOffset);
+        m_regions[padding].previousPhysical = m_regions[candidate].previousPhysical;
+        m_regions[padding].nextPhysical = candidate;
+        if (m_regions[candidate].previousPhysical != INVALID_REGION)
+        {
+            m_regions[m_regions[candidate].previousPhysical].nextPhysical = padding;
+        }
+        m_regions[candidate].previousPhysical = padding;
+        m_regions[candidate].offset = alignedOffset;
+        m_regions[candidate].size -= alignedOffset - regionOffset;
+        insertFree(padding);
+    }
+
+    const VkDeviceSize remaining = m_regions[candidate].size - size;
+    if (remaining >= MIN_ALIGNMENT)
+    {
+        uint32_t tail = createRegion(alignedOffset + size, remaining);
+        m_regions[tail].previousPhysical = candidate;
+        m_regions[tail].nextPhysical = m_regions[candidate].nextPhysical;
+        if (m_regions[candidate].nextPhysical != INVALID_REGION)
+        {
+            m_regions[m_regions[candidate].nextPhysical].previousPhysical = tail;
+        }
+        m_regions[candidate].nextPhysical = tail;
+        m_regions[candidate].size = size;
+        insertFree(tail);
+    }
+
+    m_allocationCount++;
+    m_allocatedBytes += m_regions[candidate].size;
+    offset = alignedOffset;
+    region = candidate;
+    return true;
+}
+
+/**
+ * Returns a region to the free lists, merged with its free neighbours
+ *
+ * @param region Region returned by allocate()
+ */
+void MemoryBlock::free(uint32_t region)
+{
+    assert(!m_regions[region].free && "Freeing memory that is already free");
+
+    m_allocationCount--;
+    m_allocatedBytes -= m_regions[region].size;
+
+    uint32_t previous = m_regions[region].previousPhysical;
+    if (previous != INVALID_REGION && m_regions[previous].free)
+    {
+        removeFree(previous);
+        m_regions[previous].size += m_regions[region].size;
+        m_regions[previous].nextPhysical = m_regions[region].nextPhysical;
+        if (m_regions[region].nextPhysical != INVALID_REGION)
+        {
+            m_regions[m_regions[region].nextPhysical].previousPhysical = previous;
+        }
+        releaseRegion(region);
+        region = previous;
+    }
+
+    uint32_t next = m_regions[region].nextPhysical;
+    if (next != INVALID_REGION && m_regions[next].free)
+    {
+        removeFree(next);
+        m_regions[region].size += m_regions[next].size;
+        m_regions[region].nextPhysical = m_regions[next].nextPhysical;
+        if (m_regions[next].nextPhysical != INVALID_REGION)
+        {
+            m_regions[m_regions[next].nextPhysical].previousPhysical = region;
+        }
+        releaseRegion(next);
+    }
+
+    insertFree(region);
+}
+
+uint32_t MemoryBlock::createRegion(VkDeviceSize offset, VkDeviceSize size)
+{
+    Region region{offset, size, INVALID_REGION, INVALID_REGION, INVALID_REGION, INVALID_REGION, false};
+    if (!m_unusedRegions.empty())
+    {
+        uint32_t index = m_unusedRegions.back();
+        m_unusedRegions.pop_back();
+        m_regions[index] = region;
+        return index;
+    }
+
+    m_regions.push_back(region);
+    return static_cast<uint32_t>(m_regions.size() - 1);
+}
+
+void MemoryBlock::releaseRegion(uint32_t region) { m_unusedRegions.push_back(region); }
+
+void MemoryBlock::insertFree(uint32_t region)
+{
+    uint32_t firstLevel, secondLevel;
+    mapping(m_regions[region].size, firstLevel, secondLevel);
+
+    uint32_t head = m_freeHeads[firstLevel][secondLevel];
+    m_regions[region].free = true;
+    m_regions[region].previousFree = INVALID_REGION;
+    m_regions[region].nextFree = head;
+    if (head != INVALID_REGION)
+    {
+        m_regions[head].previousFree = region;
+    }
+    m_freeHeads[firstLevel][secondLevel] = region;
+    m_firstLevelBitmap |= 1ull << firstLevel;
+    m_secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+void MemoryBlock::removeFree(uint32_t region)
+{
+    uint32_t firstLevel, secondLevel;
+    mapping(m_regions[region].size, firstLevel, secondLevel);
+
+    Region &removed = m_regions[region];
+    if (removed.previousFree != INVALID_REGION)
+    {
+        m_regions[removed.previousFree].nextFree = removed.nextFree;
+    }
+    else
+    {
+        m_freeHeads[firstLevel][secondLevel] = removed.nextFree;
+    }
+    if (removed.nextFree != INVALID_REGION)
+    {
+        m_regions[removed.nextFree].previousFree = removed.previousFree;
+    }
+    removed.free = false;
+
+    if (m_freeHeads[firstLevel][secondLevel] == INVALID_REGION)
+    {
+        m_secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+        if (m_secondLevelBitmaps[firstLevel] == 0)
+        {
+            m_firstLevelBitmap &= ~(1ull << firstLevel);
+        }
+    }
+}
+
+// ---------- MemoryAllocator ----------
+
+MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physicalDevice, bool dedicatedAllocation)
+    : m_device{device}
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    m_bufferImageGranularity = properties.limits.bufferImageGranularity;
+    m_nonCoherentAtomSize = std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+    if (dedicatedAllocation)
+    {
+        m_getBufferMemoryRequirements2 = reinterpret_cast<PFN_vkGetBufferMemoryRequirements2KHR>(
+            vkGetDeviceProcAddr(device, "vkGetBufferMemoryRequirements2KHR"));
+        m_getImageMemoryRequirements2 = reinterpret_cast<PFN_vkGetImageMemoryRequirements2KHR>(
+            vkGetDeviceProcAddr(device, "vkGetImageMemoryRequirements2KHR"));
+    }
+
+    const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++)
+    {
+        const VkMemoryType &type = m_memoryProperties.memoryTypes[i];
+        if ((type.propertyFlags & directFlags) == directFlags &&
+            m_memoryProperties.memoryHeaps[type.heapIndex].size > BAR_WINDOW_SIZE)
+        {
+            m_directUploads = true;
+        }
+    }
+
+    m_pools.resize(2 * m_memoryProperties.memoryTypeCount);
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    for (const auto &pool : m_pools)
+    {
+        for (const auto &block : pool.blocks)
+        {
+            assert(block->empty() && "Destroying the memory allocator while memory is still allocated");
+        }
+    }
+    assert(m_dedicatedBlocks.empty() && "Destroying the memory allocator while memory is still allocated");
+}
+
+/**
+ * Allocates memory for a buffer and binds the buffer to it
+ *
+ * @param buffer Buffer without memory
+ * @param properties Required memory properties
+ * @return The memory range the buffer is bound to
+ */
+MemoryAllocation MemoryAllocator::allocateBufferMemory(VkBuffer buffer, VkMemoryPropertyFlags properties)
+{
+    VkMemoryRequirements requirements;
+    bool dedicated = false;
+    if (m_getBufferMemoryRequirements2)
+    {
+        VkMemoryDedicatedRequirements dedicatedRequirements{};
+        dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+        VkMemoryRequirements2 requirements2{};
+        requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+        requirements2.pNext = &dedicatedRequirements;
+
+        VkBufferMemoryRequirementsInfo2 requirementsInfo{};
+        requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+        requirementsInfo.buffer = buffer;
+
+        m_getBufferMemoryRequirements2(m_device, &requirementsInfo, &requirements2);
+        requirements = requirements2.memoryRequirements;
+        dedicated =
+            dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vkGetBufferMemoryRequirements(m_device, buffer, &requirements);
+    }
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.buffer = buffer;
+
+    MemoryAllocation allocation = allocate(requirements, properties, false, dedicated, &dedicatedInfo);
+    if (vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+    {
+        free(allocation);
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+    return allocation;
+}
+
+/**
+ * Allocates memory for an image and binds the image to it
+ *
+ * @param image Image without memory
+ * @param tiling Tiling the image was created with
+ * @param properties Required memory properties
+ * @return The memory range the image is bound to
+ */
+MemoryAllocation MemoryAllocator::allocateImageMemory(VkImage image, VkImageTiling tiling,
+                                                      VkMemoryPropertyFlags properties)
+{
+    VkMemoryRequirements requirements;
+    bool dedicated = false;
+    if (m_getImageMemoryRequirements2)
+    {
+        VkMemoryDedicatedRequirements dedicatedRequirements{};
+        dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+        VkMemoryRequirements2 requirements2{};
+        requirements2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+        requirements2.pNext = &dedicatedRequirements;
+
+        VkImageMemoryRequirementsInfo2 requirementsInfo{};
+        requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+        requirementsInfo.image = image;
+
+        m_getImageMemoryRequirements2(m_device, &requirementsInfo, &requirements2);
+        requirements = requirements2.memoryRequirements;
+        dedicated =
+            dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    }
+    else
+    {
+        vkGetImageMemoryRequirements(m_device, image, &requirements);
+    }
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.image = image;
+
+    MemoryAllocation allocation =
+        allocate(requirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL, dedicated, &dedicatedInfo);
+    if (vkBindImageMemory(m_device, image, allocation.memory, allocation.offset) != VK_SUCCESS)
+    {
+        free(allocation);
+        throw std::runtime_error("failed to bind image memory!");
+    }
+    return allocation;
+}
+
+/**
+ * Finds room for a resource in the blocks of its pool, adding a block when none has any
+ *
+ * @param requirements Memory requirements of the resource
+ * @param properties Required memory properties
+ * @param optimalImage Whether the resource is an optimally tiled image
+ * @param dedicated Whether the resource gets memory of its own
+ * @param dedicatedInfo Chained into the allocation of dedicated memory
+ * @return The allocated range
+ */
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+                                           bool optimalImage, bool dedicated,
+                                           const VkMemoryDedicatedAllocateInfo *dedicatedInfo)
+{
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    const uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    const VkMemoryPropertyFlags propertyFlags = m_memoryProperties.memoryTypes[memoryType].propertyFlags;
+
+    VkDeviceSize size = requirements.size;
+    MemoryBlock *block = nullptr;
+    VkDeviceSize offset = 0;
+    uint32_t region = 0;
+
+    if (dedicated)
+    {
+        // Nothing shares the memory and a flush may always reach its end, so the size is taken as is.
+        auto dedicatedBlock = createBlock(memoryType, size, optimalImage, dedicatedInfo);
+        if (!dedicatedBlock)
+        {
+            throw std::runtime_error("failed to allocate dedicated device memory!");
+        }
+        region = MemoryBlock::DEDICATED_REGION;
+        block = dedicatedBlock.get();
+        m_dedicatedBlocks.push_back(std::move(dedicatedBlock));
+    }
+    else
+    {
+        VkDeviceSize alignment = requirements.alignment;
+        if (propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            size = alignUp(size, m_nonCoherentAtomSize);
+            alignment = std::max(alignment, m_nonCoherentAtomSize);
+        }
+
+        Pool &blocks = pool(memoryType, optimalImage);
+        for (const auto &candidate : blocks.blocks)
+        {
+            if (candidate->allocate(size, alignment, offset, region))
+            {
+                block = candidate.get();
+                break;
+            }
+        }
+
+        if (!block)
+        {
+            // Resources larger than a block get a block of their own size, which later ones can share. When the heap
+            // is running low, settle for smaller blocks.
+            const VkDeviceSize minBlockSize = alignUp(size + alignment, MIN_ALIGNMENT);
+            VkDeviceSize blockSize = std::max(preferredBlockSize(memoryType), minBlockSize);
+            std::unique_ptr<MemoryBlock> newBlock;
+            while (!(newBlock = createBlock(memoryType, blockSize, optimalImage, nullptr)) && blockSize > minBlockSize)
+            {
+                blockSize = std::max(blockSize / 2, minBlockSize);
+            }
+            if (!newBlock || !newBlock->allocate(size, alignment, offset, region))
+            {
+                throw std::runtime_error("failed to allocate device memory!");
+            }
+            block = newBlock.get();
+            blocks.blocks.push_back(std::move(newBlock));
+        }
+    }
+
+    MemoryAllocation allocation{};
+    allocation.memory = block->memory();
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = block->mapped() ? static_cast<char *>(block->mapped()) + offset : nullptr;
+    allocation.propertyFlags = propertyFlags;
+    allocation.block = block;
+    allocation.region = region;
+    return allocation;
+}
+
+/**
+ * Returns an allocation's range to its block. Empty blocks are released, except for the last one of a pool, which
+ * is kept so that a resource that is recreated over and over does not allocate device memory every time.
+ *
+ * @param allocation Allocation to free, reset afterwards
+ */
+void MemoryAllocator::free(MemoryAllocation &allocation)
+{
+    if (!allocation.block)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    MemoryBlock *block = allocation.block;
+    block->free(allocation.region);
+    allocation = {};
+
+    if (!block->empty())
+    {
+        return;
+    }
+
+    auto owns = [block](const std::unique_ptr<MemoryBlock> &candidate) { return candidate.get() == block; };
+    if (block->dedicated())
+    {
+        m_dedicatedBlocks.erase(std::find_if(m_dedicatedBlocks.begin(), m_dedicatedBlocks.end(), owns));
+        return;
+    }
+
+    Pool &blocks = pool(block->memoryType(), block->optimalImages());
+    if (blocks.blocks.size() > 1)
+    {
+        blocks.blocks.erase(std::find_if(blocks.blocks.begin(), blocks.blocks.end(), owns));
+    }
+}
+
+VkMappedMemoryRange MemoryAllocator::mappedRange(const MemoryAllocation &allocation, VkDeviceSize offset,
+                                                 VkDeviceSize size) const
+{
+    const VkDeviceSize allocationEnd = allocation.offset + allocation.size;
+    const VkDeviceSize begin = (allocation.offset + offset) / m_nonCoherentAtomSize * m_nonCoherentAtomSize;
+    VkDeviceSize end = size == VK_WHOLE_SIZE ? allocationEnd : allocation.offset + offset + size;
+    end = std::min(alignUp(end, m_nonCoherentAtomSize), allocationEnd);
+
+    VkMappedMemoryRange range{};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    return range;
+}
+
+MemoryAllocator::Stats MemoryAllocator::stats()
+{
+    std::lock_guard<std::mutex> lock{m_mutex};
+
+    Stats stats{};
+    auto add = [&stats](const MemoryBlock &block) {
+        stats.deviceMemoryCount++;
+        stats.allocationCount += block.allocationCount();
+        stats.blockBytes += block.size();
+        stats.allocatedBytes += block.allocatedBytes();
+    };
+    for (const auto &pool : m_pools)
+    {
+        for (const auto &block : pool.blocks)
+        {
+            add(*block);
+        }
+    }
+    for (const auto &block : m_dedicatedBlocks)
+    {
+        add(*block);
+    }
+    return stats;
+}
+
+/**
+ * Allocates a block of device memory and maps it when it is host visible
+ *
+ * @param memoryType Memory type to allocate from
+ * @param size Size of the block
+ * @param optimalImages Whether the block holds optimally tiled images
+ * @param dedicatedInfo Resource the block is dedicated to, or null
+ * @return The block, or null when the device is out of memory
+ */
+std::unique_ptr<MemoryBlock> MemoryAllocator::createBlock(uint32_t memoryType, VkDeviceSize size, bool optimalImages,
+                                                          const VkMemoryDedicatedAllocateInfo *dedicatedInfo)
+{
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = dedicatedInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+    {
+        return nullptr;
+    }
+
+    void *mapped = nullptr;
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        if (vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        {
+            vkFreeMemory(m_device, memory, nullptr);
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+
+    return std::make_unique<MemoryBlock>(m_device, memory, size, memoryType, mapped, optimalImages,
+                                         dedicatedInfo != nullptr);
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    // Device local memory the host can see is looked for outside the BAR window first, which is left to the driver.
+    const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    const bool skipBarWindow = m_directUploads && (properties & directFlags) == directFlags;
+    for (int pass = skipBarWindow ? 0 : 1; pass < 2; pass++)
+    {
+        for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++)
+        {
+            const VkMemoryType &type = m_memoryProperties.memoryTypes[i];
+            if ((typeFilter & (1 << i)) && (type.propertyFlags & properties) == properties &&
+                (pass == 1 || m_memoryProperties.memoryHeaps[type.heapIndex].size > BAR_WINDOW_SIZE))
+            {
+                return i;
+            }
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+VkDeviceSize MemoryAllocator::preferredBlockSize(uint32_t memoryType) const
+{
+    const VkDeviceSize heapSize =
+        m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    return heapSize <= SMALL_HEAP_SIZE ? alignUp(heapSize / 8, MIN_ALIGNMENT) : DEFAULT_BLOCK_SIZE;
+}
+
+MemoryAllocator::Pool &MemoryAllocator::pool(uint32_t memoryType, bool optimalImage)
+{
+    return m_pools[2 * memoryType + (optimalImage && m_bufferImageGranularity > 1 ? 1 : 0)];
+}
+
+} // namespace vionis
@@ -0,0 +1,123 @@
+#include "vionis/mesh_pool.hpp"
+
+#include <cassert>
+#include <stdexcept>
+
+namespace vionis
+{
+
+MeshPool::MeshPool(Device &device, VkDeviceSize vertexSize, uint32_t maxVertices, uint32_t maxIndices)
+    : device{device}, vertexSize{vertexSize}, vertexRanges{maxVertices}, indexRanges{maxIndices}
+{
+    vertexBuffer = std::make_unique<Buffer>(device, vertexSize, maxVertices,
+                                            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                            device.uploadBatcher().targetMemoryProperties());
+    positionBuffer = std::make_unique<Buffer>(device, sizeof(glm::vec3), maxVertices,
+                                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              device.uploadBatcher().targetMemoryProperties());
+    indexBuffer = std::make_unique<Buffer>(device, sizeof(uint32_t), maxIndices,
+                                           VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                           device.uploadBatcher().targetMemoryProperties());
+}
+
+/**
+ * Reserves vertex and index ranges for a mesh and uploads its data into them
+ *
+ * @param vertices Vertex data, vertexSize bytes per vertex
+ * @param positions Position of every vertex
+ * @param vertexCount Number of vertices
+ * @param indices Indices relative to the mesh's first vertex
+ * @param indexCount Number of indices
+ *
+ * @return The ranges the mesh occupies
+ */
+MeshPool::Allocation MeshPool::allocate(const void *vertices, const glm::vec3 *positions, uint32_t vertexCount,
+                                        const uint32_t *indices, uint32_t indexCount)
+{
+    assert(vertexCount > 0 && indexCount > 0 && "Pooled meshes must be indexed");
+
+    Allocation allocation{0, vertexCount, 0, indexCount};
+    if (!vertexRanges.allocate(vertexCount, allocation.firstVertex))
+    {
+        throw std::runtime_error("failed to allocate mesh vertices, mesh pool is full!");
+    }
+    if (!indexRanges.allocate(indexCount, allocation.firstIndex))
+    {
+        vertexRanges.free(allocation.firstVertex, vertexCount);
+        throw std::runtime_error("failed to allocate mesh indices, mesh pool is full!");
+    }
+
+    upload(*vertexBuffer, vertices, vertexSize * vertexCount, vertexSize * allocation.firstVertex);
+    upload(*positionBuffer, positions, sizeof(glm::vec3) * vertexCount, sizeof(glm::vec3) * allocation.firstVertex);
+    upload(*indexBuffer, indices, sizeof(uint32_t) * indexCount, sizeof(uint32_t) * allocation.firstIndex);
+    return allocation;
+}
+
+void MeshPool::free(const Allocation &allocation)
+{
+    vertexRanges.free(allocation.firstVertex, allocation.vertexCount);
+    indexRanges.free(allocation.firstIndex, allocation.indexCount);
+}
+
+void MeshPool::bind(VkCommandBuffer commandBuffer)
+{
+    VkBuffer buffers[] = {vertexBuffer->getBuffer()};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+}
+
+void MeshPool::upload(Buffer &target, const void *data, VkDeviceSize size, VkDeviceSize offset)
+{
+    device.uploadBatcher().uploadToBuffer(target, offset, data, size);
+}
+
+// ---------- RangeAllocator ----------
+
+bool MeshPool::RangeAllocator::allocate(uint32_t count, uint32_t &offset)
+{
+    for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+    {
+        if (it->second < count)
+        {
+            continue;
+        }
+
+        offset = it->first;
+        uint32_t remaining = it->second - count;
+        freeRanges.erase(it);
+        if (remaining > 0)
+        {
+            freeRanges.emplace(offset + count, remaining);
+        }
+        return true;
+    }
+    return false;
+}
+
+void MeshPool::RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+    auto next = freeRanges.lower_bound(offset);
+    assert((next == freeRanges.end() || offset + count <= next->first) && "Freeing a range that is already free");
+
+    // Merge with the free range that ends where this one starts and with the one that starts where it ends.
+    if (next != freeRanges.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            count += previous->second;
+            freeRanges.erase(previous);
+        }
+    }
+    if (next != freeRanges.end() && offset + count == next->first)
+    {
+        count += next->second;
+        freeRanges.erase(next);
+    }
+
+    freeRanges.emplace(offset, count);
+}
+
+} // namespace vionis
@@ -6,7 +6,9 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 
 namespace std
 {
@@ -26,7 +28,7 @@ struct hash<vionis::Model::Vertex>
 namespace vionis
 {
 
-Model::Model(Device &device, const std::string &filepath) : device{device}
+Model::Model(Device &device, const std::string &filepath, MeshPool *meshPool) : device{device}, meshPool{meshPool}
 {
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
@@ -80,21 +82,57 @@ Model::Model(Device &device, const std::string &filepath) : device{device}
             {
                 uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
                 vertices.push_back(vertex);
+                bounds.expand(vertex.position);
             }
 
             indices.push_back(uniqueVertices[vertex]);
         }
     }
 
-    createVertexBuffers(vertices);
-    createIndexBuffers(indices);
+    // Centering the sphere on the box is never far from the optimal sphere and needs just one more pass.
+    if (bounds.valid())
+    {
+        float radiusSquared = 0.0f;
+        for (const auto &vertex : vertices)
+        {
+            glm::vec3 offset = vertex.position - bounds.center();
+            radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+        }
+        boundingSphere = {bounds.center(), std::sqrt(radiusSquared)};
+    }
+
+    std::vector<glm::vec3> positions(vertices.size());
+    std::transform(vertices.begin(), vertices.end(), positions.begin(),
+                   [](const Vertex &vertex) { return vertex.position; });
+
+    if (meshPool)
+    {
+        vertexCount = static_cast<uint32_t>(vertices.size());
+        indexCount = static_cast<uint32_t>(indices.size());
+        hasIndexBuffer = true;
+        meshAllocation =
+            meshPool->allocate(vertices.data(), positions.data(), vertexCount, indices.data(), indexCount);
+    }
+    else
+    {
+        createVertexBuffers(vertices);
+        createPositionBuffer(positions);
+        createIndexBuffers(indices);
+    }
+    uploadTicket = device.uploadBatcher().pendingTicket();
 }
 
-Model::~Model() {}
+Model::~Model()
+{
+    if (meshPool)
+    {
+        meshPool->free(meshAllocation);
+    }
+}
 
-std::unique_ptr<Model> Model::createFromFile(Device &device, const std::string &filePath)
+std::unique_ptr<Model> Model::createFromFile(Device &device, const std::string &filePath, MeshPool *meshPool)
 {
-    return std::make_unique<Model>(device, filePath);
+    return std::make_unique<Model>(device, filePath, meshPool);
 }
 
 void Model::createVertexBuffers(const std::vector<Vertex> &vertices)
@@ -105,22 +143,24 @@ void Model::createVertexBuffers(const std::vector<Vertex> &vertices)
     VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
     uint32_t vertexSize = sizeof(vertices[0]);
 
-    Buffer stagingBuffer{
-        device,
-        vertexSize,
-        vertexCount,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
-
-    stagingBuffer.map();
-    stagingBuffer.writeToBuffer((void *)vertices.data());
-
     vertexBuffer = std::make_unique<Buffer>(device, vertexSize, vertexCount,
                                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                                            device.uploadBatcher().targetMemoryProperties());
+
+    device.uploadBatcher().uploadToBuffer(*vertexBuffer, 0, vertices.data(), bufferSize);
+}
+
+void Model::createPositionBuffer(const std::vector<glm::vec3> &positions)
+{
+    uint32_t positionSize = sizeof(positions[0]);
+    auto positionCount = static_cast<uint32_t>(positions.size());
+
+    positionBuffer = std::make_unique<Buffer>(device, positionSize, positionCount,
+                                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              device.uploadBatcher().targetMemoryProperties());
 
-    device.copyBuffer(stagingBuffer.getBuffer(), vertexBuffer->getBuffer(), bufferSize);
+    device.uploadBatcher().uploadToBuffer(*positionBuffer, 0, positions.data(),
+                                          static_cast<VkDeviceSize>(positionSize) * positionCount);
 }
 
 void Model::createIndexBuffers(const std::vector<uint32_t> &indices)
@@ -134,38 +174,47 @@ void Model::createIndexBuffers(const std::vector<uint32_t> &indices)
     VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
     uint32_t indexSize = sizeof(indices[0]);
 
-    Buffer stagingBuffer{
-        device,
-        indexSize,
-        indexCount,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-    };
-
-    stagingBuffer.map();
-    stagingBuffer.writeToBuffer((void *)indices.data());
-
     indexBuffer = std::make_unique<Buffer>(device, indexSize, indexCount,
                                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                                           device.uploadBatcher().targetMemoryProperties());
 
-    device.copyBuffer(stagingBuffer.getBuffer(), indexBuffer->getBuffer(), bufferSize);
+    device.uploadBatcher().uploadToBuffer(*indexBuffer, 0, indices.data(), bufferSize);
 }
 
-void Model::draw(VkCommandBuffer commandBuffer)
+void Model::draw(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint32_t firstInstance)
 {
     if (hasIndexBuffer)
     {
-        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+        vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, meshAllocation.firstIndex,
+                         static_cast<int32_t>(meshAllocation.firstVertex), firstInstance);
     }
     else
     {
-        vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+        vkCmdDraw(commandBuffer, vertexCount, instanceCount, 0, firstInstance);
     }
 }
 
+VkDrawIndexedIndirectCommand Model::drawCommand(uint32_t instanceCount, uint32_t firstInstance) const
+{
+    assert(hasIndexBuffer && "Indirect draws require an indexed model");
+
+    VkDrawIndexedIndirectCommand command{};
+    command.indexCount = indexCount;
+    command.instanceCount = instanceCount;
+    command.firstIndex = meshAllocation.firstIndex;
+    command.vertexOffset = static_cast<int32_t>(meshAllocation.firstVertex);
+    command.firstInstance = firstInstance;
+    return command;
+}
+
 void Model::bind(VkCommandBuffer commandBuffer)
 {
+    if (meshPool)
+    {
+        meshPool->bind(commandBuffer);
+        return;
+    }
+
     VkBuffer buffers[] = {vertexBuffer->getBuffer()};
     VkDeviceSize offsets[] = {0};
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
@@ -176,6 +225,37 @@ void Model::bind(VkCommandBuffer commandBuffer)
     }
 }
 
+void Model::bind(CommandRecorder &recorder)
+{
+    recorder.bindVertexBuffer(getVertexBuffer());
+    if (hasIndexBuffer)
+    {
+        recorder.bindIndexBuffer(getIndexBuffer());
+    }
+}
+
+void Model::bindPositions(CommandRecorder &recorder)
+{
+    recorder.bindVertexBuffer(getPositionBuffer());
+    if (hasIndexBuffer)
+    {
+        recorder.bindIndexBuffer(getIndexBuffer());
+    }
+}
+
+void Model::draw(CommandRecorder &recorder, uint32_t instanceCount, uint32_t firstInstance)
+{
+    if (hasIndexBuffer)
+    {
+        recorder.drawIndexed(indexCount, instanceCount, meshAllocation.firstIndex,
+                             static_cast<int32_t>(meshAllocation.firstVertex), firstInstance);
+    }
+    else
+    {
+        recorder.draw(vertexCount, instanceCount, 0, firstInstance);
+    }
+}
+
 std::vector<VkVertexInputBindingDescription> Model::Vertex::getBindingDescriptions()
 {
     std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
@@ -197,4 +277,18 @@ std::vector<VkVertexInputAttributeDescription> Model::Vertex::getAttributeDescri
     return attributeDescriptions;
 }
 
+std::vector<VkVertexInputBindingDescription> Model::Vertex::getPositionBindingDescriptions()
+{
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(glm::vec3);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    return bindingDescriptions;
+}
+
+std::vector<VkVertexInputAttributeDescription> Model::Vertex::getPositionAttributeDescriptions()
+{
+    return {{0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+}
+
 } // namespace vionis
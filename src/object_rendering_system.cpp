@@ -1,54 +1,119 @@
 #include "vionis/object_rendering_system.hpp"
 
+#include "vionis/draw_sort.hpp"
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <mutex>
 #include <stdexcept>
 
 namespace vionis
 {
 
-struct SimplePushConstantData
+namespace
+{
+
+constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+// Below this many draw runs a secondary command buffer costs more than recording the runs on the calling thread.
+constexpr uint32_t MIN_RUNS_PER_COMMAND_BUFFER = 64;
+
+/**
+ * Makes sure a per-frame buffer holds at least count instances, growing it by powers of two. Only called for the
+ * frame being recorded, whose previous submission has retired, so the old buffer can be released. Host visible
+ * buffers are mapped.
+ *
+ * @param device Device that owns the buffer
+ * @param buffer Buffer to grow, created on first use
+ * @param instanceSize Size of one element
+ * @param count Number of elements required
+ * @param usageFlags Usage of the buffer
+ * @param memoryPropertyFlags Memory the buffer lives in
+ */
+void reserveFrameBuffer(Device &device, std::unique_ptr<Buffer> &buffer, VkDeviceSize instanceSize, uint32_t count,
+                        VkBufferUsageFlags usageFlags,
+                        VkMemoryPropertyFlags memoryPropertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+{
+    uint32_t capacity = buffer ? buffer->getInstanceCount() : EntityRegistry::INITIAL_CAPACITY;
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+    if (buffer && capacity == buffer->getInstanceCount())
+    {
+        return;
+    }
+
+    auto newBuffer = std::make_unique<Buffer>(device, instanceSize, capacity, usageFlags, memoryPropertyFlags);
+    if (memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        newBuffer->map();
+    }
+    buffer = std::move(newBuffer);
+}
+
+/**
+ * Makes the writes of one stage available to the accesses of a later one
+ *
+ * @param commandBuffer Command buffer being recorded
+ * @param srcStageMask Stages that wrote
+ * @param srcAccessMask Writes to make available
+ * @param dstStageMask Stages that access the data next
+ * @param dstAccessMask Accesses of the later stages
+ */
+void memoryBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccessMask,
+                   VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
 {
-    glm::mat4 modelMatrix{1.f};
-    glm::mat4 normalMatrix{1.f};
-};
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+} // namespace
 
 ObjectRenderingSystem::ObjectRenderingSystem(Device &device, VkRenderPass renderPass,
                                              VkDescriptorSetLayout globalSetLayout)
-    : device{device}
+    : device{device}, depthPyramid{device}
 {
     createPipelineLayout(globalSetLayout);
     createPipeline(renderPass);
+    createDescriptorPool();
+    createCullPipelines(globalSetLayout);
 }
 
-ObjectRenderingSystem::~ObjectRenderingSystem() { vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr); }
+ObjectRenderingSystem::~ObjectRenderingSystem()
+{
+    vkDestroyPipelineLayout(device.device(), cullPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
+}
 
 void ObjectRenderingSystem::createPipelineLayout(VkDescriptorSetLayout globalSetLayout)
 {
-    VkPushConstantRange pushConstantRange{};
-    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-    pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(SimplePushConstantData);
+    // Everything per entity comes from the storage buffers of set 1, so the layout has no push constants.
+    entitySetLayout = DescriptorSetLayout::Builder(device)
+                          .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+                          .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+                          .build();
+    textureSetLayout = DescriptorSetLayout::Builder(device)
+                           .addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+                           .build();
 
-    renderSystemLayout =
-        DescriptorSetLayout::Builder(device)
-            .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
-            .addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-            .build();
-
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout,
-                                                            renderSystemLayout->getDescriptorSetLayout()};
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout, entitySetLayout->getDescriptorSetLayout(),
+                                                            textureSetLayout->getDescriptorSetLayout()};
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
     pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
     if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to create pipeline layout!");
@@ -65,45 +130,947 @@ void ObjectRenderingSystem::createPipeline(VkRenderPass renderPass)
     pipelineConfig.pipelineLayout = pipelineLayout;
     pipeline = std::make_unique<Pipeline>(device, "../shaders/bin/simple_shader.vert.spv",
                                           "../shaders/bin/simple_shader.frag.spv", pipelineConfig);
+
+    PipelineConfigInfo depthEqualConfig{};
+    Pipeline::defaultPipelineConfigInfo(depthEqualConfig);
+    Pipeline::enableDepthEqual(depthEqualConfig);
+    depthEqualConfig.renderPass = renderPass;
+    depthEqualConfig.pipelineLayout = pipelineLayout;
+    depthEqualPipeline = std::make_unique<Pipeline>(device, "../shaders/bin/simple_shader.vert.spv",
+                                                    "../shaders/bin/simple_shader.frag.spv", depthEqualConfig);
+
+    // Both passes share the subpass, so the pre-pass keeps the color attachment and just masks all its writes.
+    PipelineConfigInfo depthPrepassConfig{};
+    Pipeline::defaultPipelineConfigInfo(depthPrepassConfig);
+    Pipeline::enableDepthOnly(depthPrepassConfig);
+    depthPrepassConfig.renderPass = renderPass;
+    depthPrepassConfig.pipelineLayout = pipelineLayout;
+    depthPrepassPipeline =
+        std::make_unique<Pipeline>(device, "../shaders/bin/depth_prepass.vert.spv", "", depthPrepassConfig);
+}
+
+void ObjectRenderingSystem::createDescriptorPool()
+{
+    entityDescriptorPool = DescriptorPool::Builder(device)
+                               .setMaxSets(Swapchain::MAX_FRAMES_IN_FLIGHT)
+                               .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * Swapchain::MAX_FRAMES_IN_FLIGHT)
+                               .build();
+    textureDescriptorPool = DescriptorPool::Builder(device)
+                                .setMaxSets(MAX_TEXTURE_SETS)
+                                .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURE_SETS)
+                                .setPoolFlags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT)
+                                .build();
+}
+
+/**
+ * Creates the culling and draw compaction pipelines, which share one layout, and one descriptor set per frame
+ *
+ * @param globalSetLayout Layout of the global set, which has to be visible to compute shaders
+ */
+void ObjectRenderingSystem::createCullPipelines(VkDescriptorSetLayout globalSetLayout)
+{
+    cullSetLayout = DescriptorSetLayout::Builder(device)
+                        .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .addBinding(7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+                        .build();
+
+    cullDescriptorPool = DescriptorPool::Builder(device)
+                             .setMaxSets(Swapchain::MAX_FRAMES_IN_FLIGHT)
+                             .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7 * Swapchain::MAX_FRAMES_IN_FLIGHT)
+                             .addPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, Swapchain::MAX_FRAMES_IN_FLIGHT)
+                             .build();
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstantData);
+
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts{globalSetLayout, cullSetLayout->getDescriptorSetLayout()};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create culling pipeline layout!");
+    }
+
+    cullPipeline = std::make_unique<ComputePipeline>(device, "../shaders/bin/cull.comp.spv", cullPipelineLayout);
+    compactPipeline =
+        std::make_unique<ComputePipeline>(device, "../shaders/bin/compact_draws.comp.spv", cullPipelineLayout);
+}
+
+bool ObjectRenderingSystem::compactDraws() const
+{
+    return device.supportsDrawIndirectCount() && device.supportsMultiDrawIndirect();
+}
+
+/**
+ * Groups the drawable entities by model and texture, orders the groups for drawing and splits them into runs
+ *
+ * @param entities Registry whose entities are drawn
+ */
+void ObjectRenderingSystem::buildDrawGroups(EntityRegistry &entities)
+{
+    drawGroups.clear();
+    drawGroupIndices.clear();
+    groupedInstances.clear();
+
+    // Consecutive entities of an archetype usually share their model and texture, so the last group found is
+    // checked before the hash lookup.
+    DrawGroupKey lastKey{nullptr, nullptr};
+    uint32_t lastGroup = 0;
+
+    entities.forEachArchetype(COMPONENT_MODEL_BIT | COMPONENT_TEXTURE_BIT, [&](EntityArchetype &archetype) {
+        const auto &ids = archetype.ids();
+        const auto &models = archetype.models();
+        const auto &textures = archetype.textures();
+
+        for (uint32_t i = 0; i < archetype.size(); i++)
+        {
+            if (models[i] == nullptr || textures[i] == nullptr)
+                continue;
+
+            DrawGroupKey key{models[i].get(), textures[i].get()};
+            if (!(key == lastKey))
+            {
+                auto [it, inserted] = drawGroupIndices.try_emplace(key, static_cast<uint32_t>(drawGroups.size()));
+                if (inserted)
+                {
+                    drawGroups.push_back({models[i].get(), textures[i], 0, 0});
+                }
+                lastKey = key;
+                lastGroup = it->second;
+            }
+
+            drawGroups[lastGroup].instanceCount++;
+            groupedInstances.emplace_back(lastGroup, entityIndex(ids[i]));
+        }
+    });
+
+    // Order the draws by sort key, so that groups sharing a texture and a vertex buffer are adjacent and can be
+    // merged into one multi-draw indirect call. There is a single opaque pass and pipeline, and draws of a group are
+    // instanced across the scene, so the depth bucket stays 0. Instances are laid out in draw order.
+    std::unordered_map<const Texture *, uint32_t> materialIds;
+    std::unordered_map<VkBuffer, uint32_t> vertexBufferIds;
+    std::unordered_map<const Model *, uint32_t> meshIds;
+    auto denseId = [](auto &ids, auto key) {
+        return ids.try_emplace(key, static_cast<uint32_t>(ids.size())).first->second;
+    };
+
+    drawOrder.resize(drawGroups.size());
+    drawSortKeys.resize(drawGroups.size());
+    for (uint32_t i = 0; i < drawGroups.size(); i++)
+    {
+        const DrawGroup &group = drawGroups[i];
+        DrawSortKey key{};
+        key.material = denseId(materialIds, group.texture.get());
+        key.vertexBuffer = denseId(vertexBufferIds, group.model->getVertexBuffer());
+        key.mesh = denseId(meshIds, static_cast<const Model *>(group.model));
+        drawSortKeys[i] = key.pack();
+        drawOrder[i] = i;
+    }
+    radixSort(drawSortKeys, drawOrder, sortKeyScratch, sortValueScratch);
+
+    uint32_t instanceCount = 0;
+    for (uint32_t groupIndex : drawOrder)
+    {
+        drawGroups[groupIndex].firstInstance = instanceCount;
+        instanceCount += drawGroups[groupIndex].instanceCount;
+    }
+
+    // Scatter every entity's slot to the next free place of its group.
+    instanceSlots.resize(instanceCount);
+    for (auto &group : drawGroups)
+    {
+        group.instanceCount = 0;
+    }
+    for (const auto &[groupIndex, slot] : groupedInstances)
+    {
+        DrawGroup &group = drawGroups[groupIndex];
+        instanceSlots[group.firstInstance + group.instanceCount++] = slot;
+    }
+
+    // Store the groups themselves in draw order, so a group's index is also the index of its indirect command.
+    std::vector<DrawGroup> orderedGroups;
+    orderedGroups.reserve(drawGroups.size());
+    for (uint32_t groupIndex : drawOrder)
+    {
+        orderedGroups.push_back(std::move(drawGroups[groupIndex]));
+    }
+    drawGroups = std::move(orderedGroups);
+
+    drawRuns.clear();
+    for (uint32_t first = 0; first < drawGroups.size();)
+    {
+        const DrawGroup &group = drawGroups[first];
+        uint32_t end = first + 1;
+        while (group.model->isIndexed() && end < drawGroups.size())
+        {
+            const DrawGroup &next = drawGroups[end];
+            if (next.texture != group.texture || next.model->getVertexBuffer() != group.model->getVertexBuffer() ||
+                !next.model->isIndexed())
+                break;
+            end++;
+        }
+
+        drawRuns.push_back({first, end - first});
+        first = end;
+    }
+}
+
+/**
+ * Culls every drawn instance against the camera on the CPU and packs the survivors of each group to the front of its
+ * range
+ *
+ * @param frameInfo Frame being recorded
+ */
+void ObjectRenderingSystem::cullInstances(FrameInfo &frameInfo)
+{
+    const uint32_t slotCount = frameInfo.entities.slotCount();
+    slotVisibility.resize(slotCount);
+    cullSpheres(frameInfo.entities.worldSpheres(), slotCount, CullView::fromCamera(frameInfo.camera, minProjectedSize),
+                slotVisibility.data());
+    const uint32_t occludedInstances = softwareOcclusion ? cullOccludedSlots(frameInfo) : 0;
+
+    visibleSlots.resize(instanceSlots.size());
+    visibleCounts.resize(drawGroups.size());
+
+    uint32_t visibleInstances = 0;
+    for (uint32_t i = 0; i < drawGroups.size(); i++)
+    {
+        const DrawGroup &group = drawGroups[i];
+        uint32_t count = 0;
+        for (uint32_t instance = group.firstInstance; instance < group.firstInstance + group.instanceCount; instance++)
+        {
+            uint32_t slot = instanceSlots[instance];
+            // Non-indexed groups are drawn in full on the GPU path as well.
+            if (slotVisibility[slot] || !group.model->isIndexed())
+            {
+                visibleSlots[group.firstInstance + count++] = slot;
+            }
+        }
+        visibleCounts[i] = count;
+        visibleInstances += count;
+    }
+
+    frameStats.visibleInstances = visibleInstances;
+    frameStats.culledInstances = static_cast<uint32_t>(instanceSlots.size()) - visibleInstances;
+    frameStats.occludedInstances = occludedInstances;
+}
+
+/**
+ * Rasterizes the occluders among the frustum culled instances into the occlusion buffer, then clears the visibility
+ * of the slots whose bounds lie behind them. Instances of non-indexed groups are always drawn and left alone.
+ *
+ * @param frameInfo Frame being recorded
+ * @return Number of drawn instances found occluded
+ */
+uint32_t ObjectRenderingSystem::cullOccludedSlots(FrameInfo &frameInfo)
+{
+    // Occluder meshes stay inside their model's bounds, so occluders outside the frustum could not cover anything.
+    occluders.clear();
+    frameInfo.entities.forEachArchetype(COMPONENT_MODEL_BIT, [&](EntityArchetype &archetype) {
+        const auto &ids = archetype.ids();
+        const auto &models = archetype.models();
+        const auto &worldMatrices = archetype.worldMatrices();
+
+        for (uint32_t i = 0; i < archetype.size(); i++)
+        {
+            if (models[i] == nullptr || models[i]->getOccluder() == nullptr || !slotVisibility[entityIndex(ids[i])])
+                continue;
+            occluders.push_back({models[i]->getOccluder(), worldMatrices[i]});
+        }
+    });
+    if (occluders.empty())
+    {
+        return 0;
+    }
+
+    JobSystem &jobSystem = frameInfo.entities.jobSystem();
+    const Camera &camera = frameInfo.camera;
+    occlusionBuffer.render(camera.getProjection() * camera.getView(), occluders, jobSystem);
+
+    // Bounds are tested as the box around the world sphere. Occluders never hide themselves: they only cover pixels
+    // they cover entirely, with their farthest depth there, while their bounds are tested with the nearest depth.
+    const SphereArrays spheres = frameInfo.entities.worldSpheres();
+    std::atomic<uint32_t> occludedInstances{0};
+    jobSystem.parallelFor(static_cast<uint32_t>(instanceSlots.size()), 256, [&](uint32_t begin, uint32_t end) {
+        // Groups are stored in instance order, start at the one holding the first instance of the range.
+        auto group = std::upper_bound(drawGroups.begin(), drawGroups.end(), begin,
+                                      [](uint32_t instance, const DrawGroup &other) {
+                                          return instance < other.firstInstance + other.instanceCount;
+                                      });
+        uint32_t occluded = 0;
+        for (uint32_t instance = begin; instance < end; group++)
+        {
+            const uint32_t groupEnd = std::min(group->firstInstance + group->instanceCount, end);
+            // Instances of non-indexed groups are drawn in full anyway, see cullInstances().
+            if (!group->model->isIndexed())
+            {
+                instance = groupEnd;
+                continue;
+            }
+
+            for (; instance < groupEnd; instance++)
+            {
+                uint32_t slot = instanceSlots[instance];
+                if (!slotVisibility[slot])
+                    continue;
+
+                const glm::vec3 center{spheres.centerX[slot], spheres.centerY[slot], spheres.centerZ[slot]};
+                const glm::vec3 extent{spheres.radius[slot]};
+                if (occlusionBuffer.isOccluded(center - extent, center + extent))
+                {
+                    slotVisibility[slot] = 0;
+                    occluded++;
+                }
+            }
+        }
+        occludedInstances.fetch_add(occluded, std::memory_order_relaxed);
+    });
+    return occludedInstances.load();
+}
+
+/**
+ * Writes the frame's instance index and indirect buffers from the CPU culling results
+ *
+ * @param frameIndex Frame in flight being recorded
+ */
+void ObjectRenderingSystem::writeDrawBuffers(int frameIndex)
+{
+    const auto instanceCount = static_cast<uint32_t>(visibleSlots.size());
+    std::unique_ptr<Buffer> &indexBuffer = instanceIndexBuffers[frameIndex];
+    reserveFrameBuffer(device, indexBuffer, sizeof(uint32_t), instanceCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    if (instanceCount > 0)
+    {
+        indexBuffer->writeToBuffer(visibleSlots.data(), sizeof(uint32_t) * instanceCount);
+        indexBuffer->flush();
+    }
+
+    // One indirect command per group. Non-indexed models are always drawn directly, their slot stays empty.
+    std::unique_ptr<Buffer> &indirectBuffer = indirectBuffers[frameIndex];
+    reserveFrameBuffer(device, indirectBuffer, sizeof(VkDrawIndexedIndirectCommand),
+                       static_cast<uint32_t>(drawGroups.size()), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+    auto *commands = static_cast<VkDrawIndexedIndirectCommand *>(indirectBuffer->getMappedMemory());
+    for (uint32_t i = 0; i < drawGroups.size(); i++)
+    {
+        const DrawGroup &group = drawGroups[i];
+        commands[i] = group.model->isIndexed() ? group.model->drawCommand(visibleCounts[i], group.firstInstance)
+                                               : VkDrawIndexedIndirectCommand{};
+    }
+    if (!drawGroups.empty())
+    {
+        indirectBuffer->flush();
+    }
+}
+
+/**
+ * Writes the frame's culling inputs and sizes the buffers the culling pass writes
+ *
+ * @param frameIndex Frame in flight being recorded
+ */
+void ObjectRenderingSystem::writeCullBuffers(int frameIndex)
+{
+    FrameCullBuffers &buffers = cullBuffers[frameIndex];
+    const auto groupCount = static_cast<uint32_t>(drawGroups.size());
+    const auto instanceCount = static_cast<uint32_t>(instanceSlots.size());
+    const auto runCount = static_cast<uint32_t>(drawRuns.size());
+
+    reserveFrameBuffer(device, buffers.drawGroups, sizeof(CullDrawGroup), groupCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    reserveFrameBuffer(device, buffers.candidates, sizeof(uint32_t) * 2, instanceCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    reserveFrameBuffer(device, buffers.counters, sizeof(uint32_t), groupCount + runCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                           VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    reserveFrameBuffer(device, buffers.statsReadback, sizeof(uint32_t), 2 * groupCount,
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    reserveFrameBuffer(device, buffers.visibleInstances, sizeof(uint32_t), instanceCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    reserveFrameBuffer(device, buffers.drawCommands, sizeof(VkDrawIndexedIndirectCommand), groupCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    auto *groups = static_cast<CullDrawGroup *>(buffers.drawGroups->getMappedMemory());
+    auto *candidates = static_cast<uint32_t *>(buffers.candidates->getMappedMemory());
+    for (uint32_t run = 0; run < runCount; run++)
+    {
+        const DrawRun &drawRun = drawRuns[run];
+        for (uint32_t i = drawRun.firstDraw; i < drawRun.firstDraw + drawRun.drawCount; i++)
+        {
+            const DrawGroup &group = drawGroups[i];
+            const Aabb &bounds = group.model->getBounds();
+            VkDrawIndexedIndirectCommand command =
+                group.model->isIndexed() ? group.model->drawCommand() : VkDrawIndexedIndirectCommand{};
+
+            CullDrawGroup &gpuGroup = groups[i];
+            gpuGroup.boundsCenter = bounds.valid() ? glm::vec4{bounds.center(), 0.0f} : glm::vec4{0.0f};
+            gpuGroup.boundsExtent = bounds.valid() ? glm::vec4{bounds.extent(), 0.0f} : glm::vec4{0.0f};
+            gpuGroup.indexCount = command.indexCount;
+            gpuGroup.firstIndex = command.firstIndex;
+            gpuGroup.vertexOffset = command.vertexOffset;
+            gpuGroup.firstInstance = group.firstInstance;
+            gpuGroup.firstDraw = drawRun.firstDraw;
+            gpuGroup.run = run;
+
+            for (uint32_t instance = group.firstInstance; instance < group.firstInstance + group.instanceCount;
+                 instance++)
+            {
+                candidates[2 * instance] = instanceSlots[instance];
+                candidates[2 * instance + 1] = i;
+            }
+        }
+    }
+    if (groupCount > 0)
+    {
+        buffers.drawGroups->flush();
+        buffers.candidates->flush();
+    }
+}
+
+/**
+ * Makes sure the visibility history covers every entity slot. Growing it forgets the history, so the next first
+ * phase draws nothing and the second one everything visible.
+ *
+ * @param frameInfo Frame being recorded
+ */
+void ObjectRenderingSystem::reserveInstanceVisibility(FrameInfo &frameInfo)
+{
+    const uint32_t slotCount = frameInfo.entities.slotCount();
+    if (instanceVisibility && instanceVisibility->getInstanceCount() >= slotCount)
+    {
+        return;
+    }
+
+    // Every frame in flight reads the history, so it is only replaced once the device is idle. The other frames'
+    // sets still point at the old buffer and are rewritten when they are recorded next.
+    vkDeviceWaitIdle(device.device());
+    reserveFrameBuffer(device, instanceVisibility, sizeof(uint32_t), slotCount,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (FrameCullBuffers &buffers : cullBuffers)
+    {
+        buffers.boundBuffers[6] = VK_NULL_HANDLE;
+    }
+    vkCmdFillBuffer(frameInfo.commandBuffer, instanceVisibility->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+}
+
+/**
+ * Records a culling phase: clears the counters, culls the instances into the visible instance buffer and writes the
+ * indirect commands, with barriers up to the draws that consume them
+ *
+ * @param frameInfo Frame being recorded
+ */
+void ObjectRenderingSystem::recordCulling(FrameInfo &frameInfo)
+{
+    FrameCullBuffers &buffers = cullBuffers[frameInfo.frameIndex];
+    VkCommandBuffer commandBuffer = frameInfo.commandBuffer;
+
+    VkDescriptorBufferInfo bufferInfos[7] = {
+        frameInfo.entities.getInstanceBufferInfo(frameInfo.frameIndex),
+        buffers.drawGroups->descriptorInfo(),
+        buffers.candidates->descriptorInfo(),
+        buffers.counters->descriptorInfo(),
+        buffers.visibleInstances->descriptorInfo(),
+        buffers.drawCommands->descriptorInfo(),
+        instanceVisibility->descriptorInfo(),
+    };
+
+    // Buffers are only replaced while the frame's previous submission has retired, and the depth pyramid and the
+    // visibility history only after waiting for the device, so the set can be rewritten. Nothing changes between the
+    // phases of a frame, so the second one never rewrites the set the first one bound.
+    bool changed =
+        buffers.descriptorSet == VK_NULL_HANDLE || buffers.boundPyramidGeneration != depthPyramid.generation();
+    for (uint32_t binding = 0; binding < 7; binding++)
+    {
+        changed |= buffers.boundBuffers[binding] != bufferInfos[binding].buffer;
+        buffers.boundBuffers[binding] = bufferInfos[binding].buffer;
+    }
+    if (changed)
+    {
+        assert(cullPhase != CullPhase::SECOND && "The second culling phase must not rewrite the culling set");
+        VkDescriptorImageInfo pyramidInfo = depthPyramid.descriptorInfo();
+        DescriptorWriter writer{*cullSetLayout, *cullDescriptorPool};
+        for (uint32_t binding = 0; binding < 7; binding++)
+        {
+            writer.writeBuffer(binding, &bufferInfos[binding]);
+        }
+        writer.writeImage(7, &pyramidInfo);
+        buffers.boundPyramidGeneration = depthPyramid.generation();
+
+        if (buffers.descriptorSet == VK_NULL_HANDLE)
+        {
+            if (!writer.build(buffers.descriptorSet))
+            {
+                throw std::runtime_error("failed to allocate culling descriptor set!");
+            }
+        }
+        else
+        {
+            writer.overwrite(buffers.descriptorSet);
+        }
+    }
+
+    const auto groupCount = static_cast<uint32_t>(drawGroups.size());
+    const auto runCount = static_cast<uint32_t>(drawRuns.size());
+    CullView view = CullView::fromCamera(frameInfo.camera, minProjectedSize);
+    const VkExtent2D pyramidExtent = depthPyramid.extent();
+    CullPushConstantData push{static_cast<uint32_t>(instanceSlots.size()),
+                              groupCount,
+                              compactDraws() ? 1u : 0u,
+                              view.minRadius,
+                              view.minRadiusPerDistance,
+                              cullPhase,
+                              glm::vec2{static_cast<float>(pyramidExtent.width),
+                                        static_cast<float>(pyramidExtent.height)}};
+
+    // Also waits for the visibility history that the second phase of an earlier frame wrote.
+    vkCmdFillBuffer(commandBuffer, buffers.counters->getBuffer(), 0, sizeof(uint32_t) * (groupCount + runCount), 0);
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    VkDescriptorSet descriptorSets[] = {frameInfo.globalDescriptorSet, buffers.descriptorSet};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 2, descriptorSets, 0,
+                            nullptr);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+
+    if (push.candidateCount > 0)
+    {
+        cullPipeline->bind(commandBuffer);
+        vkCmdDispatch(commandBuffer, (push.candidateCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+    }
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    compactPipeline->bind(commandBuffer);
+    vkCmdDispatch(commandBuffer, (groupCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+
+    // The second phase's counts go after the first one's.
+    const bool secondPhase = cullPhase == CullPhase::SECOND;
+    VkBufferCopy copyRegion{};
+    copyRegion.dstOffset = secondPhase ? sizeof(uint32_t) * groupCount : 0;
+    copyRegion.size = sizeof(uint32_t) * groupCount;
+    vkCmdCopyBuffer(commandBuffer, buffers.counters->getBuffer(), buffers.statsReadback->getBuffer(), 1, &copyRegion);
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    buffers.readbackCounts = (secondPhase ? 2 : 1) * groupCount;
+    buffers.readbackInstanceCount = push.candidateCount;
+}
+
+bool ObjectRenderingSystem::cullOccludedGameObjects(FrameInfo &frameInfo, VkImageView depthView)
+{
+    if (cullPhase != CullPhase::FIRST)
+    {
+        return false;
+    }
+
+    // The second phase refills the counters and outputs once the first phase's draws and statistics copy are done
+    // with them.
+    memoryBarrier(frameInfo.commandBuffer,
+                  VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  0, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+
+    depthPyramid.build(frameInfo.commandBuffer, frameInfo.frameIndex, depthView);
+    cullPhase = CullPhase::SECOND;
+    recordCulling(frameInfo);
+    framePrepared = true;
+    return true;
+}
+
+/**
+ * Sums the visible counts that the culling phases of the frame's previous submission copied back. The frame's fence has
+ * been waited on, so the copy is complete.
+ *
+ * @param frameIndex Frame in flight being recorded
+ */
+void ObjectRenderingSystem::readCullingStats(int frameIndex)
+{
+    FrameCullBuffers &buffers = cullBuffers[frameIndex];
+    if (buffers.readbackCounts == 0)
+    {
+        return;
+    }
+
+    buffers.statsReadback->invalidate();
+    const auto *counts = static_cast<const uint32_t *>(buffers.statsReadback->getMappedMemory());
+    uint32_t visibleInstances = 0;
+    for (uint32_t i = 0; i < buffers.readbackCounts; i++)
+    {
+        visibleInstances += counts[i];
+    }
+    frameStats.visibleInstances = visibleInstances;
+    frameStats.culledInstances = buffers.readbackInstanceCount - visibleInstances;
+    frameStats.occludedInstances = 0;
+    buffers.readbackCounts = 0;
+}
+
+/**
+ * Returns the frame's entity descriptor set, pointing it at the frame's current instance and instance index buffers
+ *
+ * @param frameIndex Frame in flight being recorded
+ * @param instanceBufferInfo The registry's instance buffer for the frame
+ * @param instanceIndexBufferInfo The frame's instance index buffer
+ *
+ * @return Descriptor set for the entity set layout
+ */
+VkDescriptorSet ObjectRenderingSystem::getEntityDescriptorSet(int frameIndex,
+                                                              const VkDescriptorBufferInfo &instanceBufferInfo,
+                                                              const VkDescriptorBufferInfo &instanceIndexBufferInfo)
+{
+    EntityDescriptorSet &entry = entityDescriptorSets[frameIndex];
+    bool instanceBufferChanged = entry.instanceBufferInfo.buffer != instanceBufferInfo.buffer;
+    bool instanceIndexBufferChanged = entry.instanceIndexBufferInfo.buffer != instanceIndexBufferInfo.buffer;
+    entry.instanceBufferInfo = instanceBufferInfo;
+    entry.instanceIndexBufferInfo = instanceIndexBufferInfo;
+
+    if (entry.set == VK_NULL_HANDLE)
+    {
+        if (!DescriptorWriter(*entitySetLayout, *entityDescriptorPool)
+                 .writeBuffer(0, &entry.instanceBufferInfo)
+                 .writeBuffer(1, &entry.instanceIndexBufferInfo)
+                 .build(entry.set))
+        {
+            throw std::runtime_error("failed to allocate entity descriptor set!");
+        }
+        return entry.set;
+    }
+
+    // A buffer was replaced. Replacements are created before the old buffer is released, so the handles always
+    // differ, and the frame's previous submission has retired, so the set can be rewritten in place.
+    if (instanceBufferChanged || instanceIndexBufferChanged)
+    {
+        DescriptorWriter writer{*entitySetLayout, *entityDescriptorPool};
+        if (instanceBufferChanged)
+        {
+            writer.writeBuffer(0, &entry.instanceBufferInfo);
+        }
+        if (instanceIndexBufferChanged)
+        {
+            writer.writeBuffer(1, &entry.instanceIndexBufferInfo);
+        }
+        writer.overwrite(entry.set);
+    }
+    return entry.set;
+}
+
+/**
+ * Returns the descriptor set of a diffuse texture, writing one only the first time the texture is drawn
+ *
+ * @param texture Diffuse texture of the draw
+ *
+ * @return Descriptor set for the texture set layout
+ */
+VkDescriptorSet ObjectRenderingSystem::getTextureDescriptorSet(const std::shared_ptr<Texture> &texture)
+{
+    auto it = textureSets.find(texture.get());
+    if (it != textureSets.end() && !it->second.texture.expired())
+    {
+        it->second.lastUsedFrame = frameNumber;
+        return it->second.set;
+    }
+
+    // Frames in flight may still draw with the set of a texture that is gone, so it is not rewritten but retired and
+    // the texture now living at its address gets a set of its own.
+    if (it != textureSets.end())
+    {
+        retiredTextureSets.push_back(it->second);
+        textureSets.erase(it);
+    }
+    releaseExpiredTextureSets();
+
+    auto imageInfo = texture->descriptorInfo();
+    VkDescriptorSet set;
+    if (!DescriptorWriter(*textureSetLayout, *textureDescriptorPool).writeImage(0, &imageInfo).build(set))
+    {
+        throw std::runtime_error("failed to allocate texture descriptor set!");
+    }
+
+    textureSets.emplace(texture.get(), TextureDescriptorSet{texture, set, frameNumber});
+    return set;
+}
+
+void ObjectRenderingSystem::releaseExpiredTextureSets()
+{
+    for (auto it = textureSets.begin(); it != textureSets.end();)
+    {
+        if (it->second.texture.expired())
+        {
+            retiredTextureSets.push_back(it->second);
+            it = textureSets.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    std::vector<VkDescriptorSet> released;
+    auto retired = std::remove_if(retiredTextureSets.begin(), retiredTextureSets.end(),
+                                  [this, &released](const TextureDescriptorSet &entry) {
+                                      if (entry.lastUsedFrame + Swapchain::MAX_FRAMES_IN_FLIGHT > frameNumber)
+                                      {
+                                          return false;
+                                      }
+                                      released.push_back(entry.set);
+                                      return true;
+                                  });
+    retiredTextureSets.erase(retired, retiredTextureSets.end());
+
+    if (!released.empty())
+    {
+        textureDescriptorPool->freeDescriptors(released);
+    }
+}
+
+void ObjectRenderingSystem::cullGameObjects(FrameInfo &frameInfo, VkExtent2D depthExtent)
+{
+    frameNumber++;
+    frameStats.commands = {};
+    cullPhase = CullPhase::SINGLE;
+    uint64_t version = frameInfo.entities.drawListVersion();
+    if (version != drawListVersion)
+    {
+        buildDrawGroups(frameInfo.entities);
+        drawListVersion = version;
+    }
+
+    // The culled commands carry each group's first instance, which needs drawIndirectFirstInstance.
+    frameCulled = gpuCulling && device.supportsDrawIndirectFirstInstance();
+    framePrepared = true;
+
+    if (!frameCulled)
+    {
+        cullInstances(frameInfo);
+        writeDrawBuffers(frameInfo.frameIndex);
+        return;
+    }
+
+    readCullingStats(frameInfo.frameIndex);
+    if (frameDrawListVersions[frameInfo.frameIndex] != drawListVersion)
+    {
+        writeCullBuffers(frameInfo.frameIndex);
+        frameDrawListVersions[frameInfo.frameIndex] = drawListVersion;
+    }
+
+    if (drawGroups.empty())
+    {
+        frameStats.visibleInstances = 0;
+        frameStats.culledInstances = 0;
+        frameStats.occludedInstances = 0;
+        return;
+    }
+
+    // Sized before anything binds the pyramid, recreating it later would invalidate the frame's commands.
+    if (occlusionCulling)
+    {
+        depthPyramid.resize(depthExtent);
+        cullPhase = CullPhase::FIRST;
+    }
+    reserveInstanceVisibility(frameInfo);
+    recordCulling(frameInfo);
+}
+
+/**
+ * Resolves the descriptor sets of the frame's draws, which is not thread-safe and so happens before any recording
+ *
+ * @param frameInfo Frame being recorded
+ *
+ * @return Whether there is anything to draw
+ */
+bool ObjectRenderingSystem::prepareDescriptorSets(FrameInfo &frameInfo)
+{
+    assert(framePrepared && "cullGameObjects must be called before renderGameObjects");
+    framePrepared = false;
+    if (drawGroups.empty())
+    {
+        return false;
+    }
+
+    // The second culling phase draws with the sets the first one resolved.
+    if (cullPhase == CullPhase::SECOND)
+    {
+        return true;
+    }
+
+    frameEntityDescriptorSet = getEntityDescriptorSet(
+        frameInfo.frameIndex, frameInfo.entities.getInstanceBufferInfo(frameInfo.frameIndex),
+        frameCulled ? cullBuffers[frameInfo.frameIndex].visibleInstances->descriptorInfo()
+                    : instanceIndexBuffers[frameInfo.frameIndex]->descriptorInfo());
+
+    runTextureDescriptorSets.resize(drawRuns.size());
+    for (uint32_t run = 0; run < drawRuns.size(); run++)
+    {
+        runTextureDescriptorSets[run] = getTextureDescriptorSet(drawGroups[drawRuns[run].firstDraw].texture);
+    }
+    return true;
 }
 
 void ObjectRenderingSystem::renderGameObjects(FrameInfo &frameInfo)
 {
-    pipeline->bind(frameInfo.commandBuffer);
+    if (!prepareDescriptorSets(frameInfo))
+    {
+        return;
+    }
 
-    vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1,
-                            &frameInfo.globalDescriptorSet, 0, nullptr);
+    const auto runCount = static_cast<uint32_t>(drawRuns.size());
+    CommandRecorder recorder{frameInfo.commandBuffer};
+    if (depthPrepass)
+    {
+        recordDrawRuns(recorder, frameInfo, 0, runCount, DrawPass::DEPTH_PREPASS);
+        recordDrawRuns(recorder, frameInfo, 0, runCount, DrawPass::SHADING_AFTER_PREPASS);
+    }
+    else
+    {
+        recordDrawRuns(recorder, frameInfo, 0, runCount, DrawPass::SHADING);
+    }
+    frameStats.commands = recorder.stats();
+}
 
-    for (auto &kv : frameInfo.gameObjects)
+void ObjectRenderingSystem::renderGameObjects(FrameInfo &frameInfo, Renderer &renderer, JobSystem &jobSystem)
+{
+    if (!prepareDescriptorSets(frameInfo))
     {
-        auto &obj = kv.second;
+        return;
+    }
 
-        if (obj.model == nullptr)
-            continue;
+    std::mutex statsMutex;
+    auto recordPass = [&](DrawPass pass) {
+        renderer.recordSecondaryCommandBuffers(
+            jobSystem, static_cast<uint32_t>(drawRuns.size()), MIN_RUNS_PER_COMMAND_BUFFER,
+            [this, &frameInfo, &statsMutex, pass](uint32_t firstRun, uint32_t endRun, VkCommandBuffer commandBuffer) {
+                CommandRecorder recorder{commandBuffer};
+                recordDrawRuns(recorder, frameInfo, firstRun, endRun, pass);
+
+                std::lock_guard<std::mutex> lock{statsMutex};
+                frameStats.commands += recorder.stats();
+            });
+    };
 
-        auto bufferInfo = obj.getUniformBufferInfo(frameInfo.frameIndex);
-        auto imageInfo = obj.diffuseTexture->descriptorInfo();
+    // The whole pre-pass executes before any shading, otherwise later batches could not reject what earlier ones
+    // would shade.
+    if (depthPrepass)
+    {
+        recordPass(DrawPass::DEPTH_PREPASS);
+        recordPass(DrawPass::SHADING_AFTER_PREPASS);
+    }
+    else
+    {
+        recordPass(DrawPass::SHADING);
+    }
+}
 
-        VkDescriptorSet gameObjectDescriptorSet;
+/**
+ * Records the draws of a range of runs. Only reads the render system's state, so ranges can be recorded in parallel.
+ *
+ * @param recorder Recorder of the command buffer, which is inside the swapchain render pass
+ * @param frameInfo Frame being recorded
+ * @param firstRun First run to record
+ * @param endRun One past the last run to record
+ * @param pass Pass to record the runs for
+ */
+void ObjectRenderingSystem::recordDrawRuns(CommandRecorder &recorder, FrameInfo &frameInfo, uint32_t firstRun,
+                                           uint32_t endRun, DrawPass pass)
+{
+    const bool depthOnly = pass == DrawPass::DEPTH_PREPASS;
+    auto bindGeometry = [&recorder, depthOnly](Model &model) {
+        if (depthOnly)
+            model.bindPositions(recorder);
+        else
+            model.bind(recorder);
+    };
 
-        DescriptorWriter(*renderSystemLayout, frameInfo.frameDescriptorPool)
-            .writeBuffer(0, &bufferInfo)
-            .writeImage(1, &imageInfo)
-            .build(gameObjectDescriptorSet);
+    // Draws arrive sorted by state, so the recorder drops every bind that repeats the previous one.
+    switch (pass)
+    {
+    case DrawPass::SHADING:
+        recorder.bindPipeline(*pipeline);
+        break;
+    case DrawPass::DEPTH_PREPASS:
+        recorder.bindPipeline(*depthPrepassPipeline);
+        break;
+    case DrawPass::SHADING_AFTER_PREPASS:
+        recorder.bindPipeline(*depthEqualPipeline);
+        break;
+    }
+    recorder.bindDescriptorSet(pipelineLayout, 0, frameInfo.globalDescriptorSet);
+    recorder.bindDescriptorSet(pipelineLayout, 1, frameEntityDescriptorSet);
 
-        vkCmdBindDescriptorSets(frameInfo.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1,
-                                &gameObjectDescriptorSet, 0, nullptr);
+    FrameCullBuffers &culled = cullBuffers[frameInfo.frameIndex];
 
-        SimplePushConstantData push{};
-        push.modelMatrix = obj.transformComponent.toMatrix();
-        push.normalMatrix = obj.transformComponent.computeNormalMatrix();
+    // Indirect commands carry each group's first instance, which needs drawIndirectFirstInstance.
+    const bool indirect = frameCulled || (indirectDraws && device.supportsDrawIndirectFirstInstance());
+    const bool countedDraws = frameCulled && compactDraws();
+    const uint32_t maxDrawCount =
+        device.supportsMultiDrawIndirect() ? device.physicalDeviceProperties().limits.maxDrawIndirectCount : 1;
+    VkBuffer indirectBuffer =
+        frameCulled ? culled.drawCommands->getBuffer() : indirectBuffers[frameInfo.frameIndex]->getBuffer();
+    constexpr uint32_t commandStride = sizeof(VkDrawIndexedIndirectCommand);
 
-        vkCmdPushConstants(frameInfo.commandBuffer, pipelineLayout,
-                           VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(SimplePushConstantData),
-                           &push);
+    for (uint32_t run = firstRun; run < endRun; run++)
+    {
+        const DrawRun &drawRun = drawRuns[run];
+        const DrawGroup &group = drawGroups[drawRun.firstDraw];
+        // Non-indexed groups form runs of their own, which the first culling phase already drew in full.
+        if (cullPhase == CullPhase::SECOND && !group.model->isIndexed())
+            continue;
+
+        if (!depthOnly)
+        {
+            recorder.bindDescriptorSet(pipelineLayout, 2, runTextureDescriptorSets[run]);
+        }
+        bindGeometry(*group.model);
+
+        // Non-indexed groups are never culled, so they are drawn in full in either path.
+        if (!indirect || !group.model->isIndexed())
+        {
+            for (uint32_t i = drawRun.firstDraw; i < drawRun.firstDraw + drawRun.drawCount; i++)
+            {
+                uint32_t instanceCount = frameCulled ? drawGroups[i].instanceCount : visibleCounts[i];
+                if (instanceCount > 0)
+                {
+                    bindGeometry(*drawGroups[i].model);
+                    drawGroups[i].model->draw(recorder, instanceCount, drawGroups[i].firstInstance);
+                }
+            }
+            continue;
+        }
+
+        if (countedDraws)
+        {
+            // The run's surviving commands were packed to its front and counted after the per-group counters.
+            VkDeviceSize countOffset = sizeof(uint32_t) * (drawGroups.size() + run);
+            recorder.drawIndexedIndirectCount(device, indirectBuffer,
+                                              static_cast<VkDeviceSize>(drawRun.firstDraw) * commandStride,
+                                              culled.counters->getBuffer(), countOffset, drawRun.drawCount,
+                                              commandStride);
+            continue;
+        }
 
-        obj.model->bind(frameInfo.commandBuffer);
-        obj.model->draw(frameInfo.commandBuffer);
+        // Without multiDrawIndirect every command is submitted on its own, still straight from the buffer.
+        for (uint32_t first = drawRun.firstDraw; first < drawRun.firstDraw + drawRun.drawCount; first += maxDrawCount)
+        {
+            uint32_t count = std::min(drawRun.firstDraw + drawRun.drawCount - first, maxDrawCount);
+            recorder.drawIndexedIndirect(indirectBuffer, static_cast<VkDeviceSize>(first) * commandStride, count,
+                                         commandStride);
+        }
     }
 }
 
@@ -0,0 +1,434 @@
+#include "vionis/occlusion_buffer.hpp"
+
+#include "third_party/tiny_obj_loader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(VIONIS_X86_KERNELS)
+#include <emmintrin.h>
+#endif
+
+namespace vionis
+{
+
+namespace
+{
+
+// Twice the screen space area below which a triangle is treated as degenerate.
+constexpr float MIN_DOUBLE_AREA = 1e-6f;
+
+// Whether all three vertices lie outside the same side or the far plane of the clip volume.
+bool isOutsideClipVolume(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2)
+{
+    return (v0.x > v0.w && v1.x > v1.w && v2.x > v2.w) || (v0.x < -v0.w && v1.x < -v1.w && v2.x < -v2.w) ||
+           (v0.y > v0.w && v1.y > v1.w && v2.y > v2.w) || (v0.y < -v0.w && v1.y < -v1.w && v2.y < -v2.w) ||
+           (v0.z > v0.w && v1.z > v1.w && v2.z > v2.w);
+}
+
+} // namespace
+
+// ---------- OccluderMesh ----------
+
+/**
+ * Loads an occluder mesh from an .obj file. Only positions and faces are read, and vertices are not deduplicated
+ * since occluder meshes are meant to be tiny.
+ *
+ * @param filepath Path of the .obj file
+ * @return The loaded mesh
+ */
+std::shared_ptr<OccluderMesh> OccluderMesh::createFromFile(const std::string &filepath)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filepath.c_str()))
+    {
+        throw std::runtime_error(warn + err);
+    }
+
+    auto mesh = std::make_shared<OccluderMesh>();
+    mesh->positions.reserve(attrib.vertices.size() / 3);
+    for (size_t i = 0; i + 2 < attrib.vertices.size(); i += 3)
+    {
+        mesh->positions.emplace_back(attrib.vertices[i], attrib.vertices[i + 1], attrib.vertices[i + 2]);
+    }
+
+    for (const auto &shape : shapes)
+    {
+        for (const auto &index : shape.mesh.indices)
+        {
+            if (index.vertex_index < 0)
+            {
+                throw std::runtime_error("failed to load occluder mesh, face without position!");
+            }
+            mesh->indices.push_back(static_cast<uint32_t>(index.vertex_index));
+        }
+    }
+
+    return mesh;
+}
+
+// ---------- OcclusionBuffer ----------
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+    : m_width{width}, m_height{height}, m_tilesX{width / TILE_SIZE}, m_tilesY{height / TILE_SIZE},
+      m_depth(static_cast<size_t>(width) * height, 1.0f), m_tileDepth(static_cast<size_t>(m_tilesX) * m_tilesY, 1.0f)
+{
+    assert(width % TILE_SIZE == 0 && height % TILE_SIZE == 0 && "occlusion buffer size must be a multiple of tiles");
+}
+
+/**
+ * Clears the buffer and rasterizes occluders into it. Triangles are set up in parallel per occluder, then rasterized
+ * in parallel per band of tile rows, so every job writes only its own rows.
+ *
+ * @param viewProjection Projection and view matrix of the camera
+ * @param occluders Occluders to rasterize, whose meshes must outlive the call
+ * @param jobSystem Job system to spread the work over
+ */
+void OcclusionBuffer::render(const glm::mat4 &viewProjection, const std::vector<Occluder> &occluders,
+                             JobSystem &jobSystem)
+{
+    m_viewProjection = viewProjection;
+
+    // Clipping against the near plane splits a triangle in two at most.
+    const auto occluderCount = static_cast<uint32_t>(occluders.size());
+    m_triangleOffsets.resize(occluderCount);
+    m_triangleCounts.assign(occluderCount, 0);
+    uint32_t triangleCapacity = 0;
+    for (uint32_t i = 0; i < occluderCount; i++)
+    {
+        m_triangleOffsets[i] = triangleCapacity;
+        triangleCapacity += 2 * static_cast<uint32_t>(occluders[i].mesh->indices.size() / 3);
+    }
+    if (m_triangles.size() < triangleCapacity)
+    {
+        m_triangles.resize(triangleCapacity);
+    }
+
+    jobSystem.parallelFor(occluderCount, 1, [&](uint32_t begin, uint32_t end) {
+        ScratchAllocator &scratch = jobSystem.scratch();
+        for (uint32_t i = begin; i < end; i++)
+        {
+            setupTriangles(occluders[i], scratch, m_triangleOffsets[i], m_triangleCounts[i]);
+        }
+    });
+
+    jobSystem.parallelFor(m_tilesY, 1, [this](uint32_t begin, uint32_t end) {
+        rasterizeBand(begin * TILE_SIZE, end * TILE_SIZE);
+    });
+}
+
+/**
+ * Transforms an occluder to clip space and sets up its triangles
+ *
+ * @param occluder Occluder to set up
+ * @param scratch Scratch allocator of the current worker, for the clip space vertices
+ * @param firstTriangle Index in m_triangles the occluder's triangles start at
+ * @param triangleCount Receives the number of triangles set up
+ */
+void OcclusionBuffer::setupTriangles(const Occluder &occluder, ScratchAllocator &scratch, uint32_t firstTriangle,
+                                     uint32_t &triangleCount)
+{
+    const OccluderMesh &mesh = *occluder.mesh;
+    const glm::mat4 transform = m_viewProjection * occluder.worldMatrix;
+
+    auto *clip = scratch.allocate<glm::vec4>(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); i++)
+    {
+        clip[i] = transform * glm::vec4{mesh.positions[i], 1.0f};
+    }
+
+    uint32_t count = 0;
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        const glm::vec4 triangle[3] = {clip[mesh.indices[i]], clip[mesh.indices[i + 1]], clip[mesh.indices[i + 2]]};
+        if (isOutsideClipVolume(triangle[0], triangle[1], triangle[2]))
+        {
+            continue;
+        }
+
+        // Clip against the near plane (z >= 0), leaving a triangle or a quad.
+        glm::vec4 polygon[4];
+        uint32_t polygonSize = 0;
+        for (uint32_t v = 0; v < 3; v++)
+        {
+            const glm::vec4 &current = triangle[v];
+            const glm::vec4 &next = triangle[(v + 1) % 3];
+            if (current.z >= 0.0f)
+            {
+                polygon[polygonSize++] = current;
+            }
+            if ((current.z >= 0.0f) != (next.z >= 0.0f))
+            {
+                float t = current.z / (current.z - next.z);
+                polygon[polygonSize++] = current + (next - current) * t;
+            }
+        }
+
+        for (uint32_t v = 2; v < polygonSize; v++)
+        {
+            setupTriangle(polygon[0], polygon[v - 1], polygon[v], firstTriangle + count, count);
+        }
+    }
+    triangleCount = count;
+}
+
+/**
+ * Projects a clipped triangle to the screen and stores its edge functions and depth plane, dropping degenerate ones
+ *
+ * @param v0 First clip space vertex, in front of the near plane
+ * @param v1 Second clip space vertex, in front of the near plane
+ * @param v2 Third clip space vertex, in front of the near plane
+ * @param index Index in m_triangles to store the triangle at
+ * @param triangleCount Incremented when the triangle is stored
+ */
+void OcclusionBuffer::setupTriangle(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2, uint32_t index,
+                                    uint32_t &triangleCount)
+{
+    const glm::vec4 *vertices[3] = {&v0, &v1, &v2};
+    float x[3], y[3], z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        const glm::vec4 &v = *vertices[i];
+        if (v.w <= 0.0f)
+        {
+            return;
+        }
+        float inverseW = 1.0f / v.w;
+        x[i] = (v.x * inverseW * 0.5f + 0.5f) * static_cast<float>(m_width);
+        y[i] = (v.y * inverseW * 0.5f + 0.5f) * static_cast<float>(m_height);
+        z[i] = v.z * inverseW;
+    }
+
+    const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (std::abs(area) < MIN_DOUBLE_AREA)
+    {
+        return;
+    }
+
+    Triangle &triangle = m_triangles[index];
+    triangle.minX = std::max(0, static_cast<int32_t>(std::floor(std::min({x[0], x[1], x[2]}))));
+    triangle.maxX = std::min(static_cast<int32_t>(m_width) - 1,
+                             static_cast<int32_t>(std::ceil(std::max({x[0], x[1], x[2]}))) - 1);
+    triangle.minY = std::max(0, static_cast<int32_t>(std::floor(std::min({y[0], y[1], y[2]}))));
+    triangle.maxY = std::min(static_cast<int32_t>(m_height) - 1,
+                             static_cast<int32_t>(std::ceil(std::max({y[0], y[1], y[2]}))) - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+    {
+        return;
+    }
+
+    // Edge functions are evaluated at integer pixel coordinates, the half pixel moves them to the pixel center.
+    const float orientation = area > 0.0f ? 1.0f : -1.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        int j = (i + 1) % 3;
+        float a = (y[i] - y[j]) * orientation;
+        float b = (x[j] - x[i]) * orientation;
+        float c = (x[i] * y[j] - x[j] * y[i]) * orientation;
+        triangle.edgeA[i] = a;
+        triangle.edgeB[i] = b;
+        triangle.edgeC[i] = c + 0.5f * (a + b);
+    }
+
+    // Depth is affine in screen space; offset it to the pixel corner farthest away, but never past the triangle.
+    const float depthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    const float depthY = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+    triangle.depthX = depthX;
+    triangle.depthY = depthY;
+    triangle.depthC = z[0] - depthX * x[0] - depthY * y[0] + 0.5f * (depthX + depthY) +
+                      0.5f * (std::abs(depthX) + std::abs(depthY));
+    triangle.maxDepth = std::max({z[0], z[1], z[2]});
+
+    triangleCount++;
+}
+
+/**
+ * Clears a band of rows, rasterizes every triangle that overlaps it and updates the band's tile depths
+ *
+ * @param firstRow First row of the band, at a tile boundary
+ * @param endRow Row after the band, at a tile boundary
+ */
+void OcclusionBuffer::rasterizeBand(uint32_t firstRow, uint32_t endRow)
+{
+    std::fill(m_depth.begin() + static_cast<size_t>(firstRow) * m_width,
+              m_depth.begin() + static_cast<size_t>(endRow) * m_width, 1.0f);
+
+    const auto bandMinY = static_cast<int32_t>(firstRow);
+    const auto bandMaxY = static_cast<int32_t>(endRow) - 1;
+    for (size_t occluder = 0; occluder < m_triangleOffsets.size(); occluder++)
+    {
+        const uint32_t first = m_triangleOffsets[occluder];
+        const uint32_t end = first + m_triangleCounts[occluder];
+        for (uint32_t i = first; i < end; i++)
+        {
+            const Triangle &triangle = m_triangles[i];
+            const int32_t minY = std::max(triangle.minY, bandMinY);
+            const int32_t maxY = std::min(triangle.maxY, bandMaxY);
+            for (int32_t row = minY; row <= maxY; row++)
+            {
+                rasterizeRow(triangle, static_cast<uint32_t>(row), triangle.minX, triangle.maxX);
+            }
+        }
+    }
+
+    for (uint32_t tileY = firstRow / TILE_SIZE; tileY < endRow / TILE_SIZE; tileY++)
+    {
+        for (uint32_t tileX = 0; tileX < m_tilesX; tileX++)
+        {
+            float farthest = 0.0f;
+            for (uint32_t y = tileY * TILE_SIZE; y < (tileY + 1) * TILE_SIZE; y++)
+            {
+                const float *row = m_depth.data() + static_cast<size_t>(y) * m_width + tileX * TILE_SIZE;
+                farthest = std::max(farthest, *std::max_element(row, row + TILE_SIZE));
+            }
+            m_tileDepth[tileY * m_tilesX + tileX] = farthest;
+        }
+    }
+}
+
+/**
+ * Writes a triangle's depth into the pixels of one row whose centers it covers
+ *
+ * @param triangle Triangle to rasterize
+ * @param row Row to rasterize
+ * @param minX First pixel of the row the triangle may cover
+ * @param maxX Last pixel of the row the triangle may cover
+ */
+void OcclusionBuffer::rasterizeRow(const Triangle &triangle, uint32_t row, int32_t minX, int32_t maxX)
+{
+    const auto py = static_cast<float>(row);
+    float *depth = m_depth.data() + static_cast<size_t>(row) * m_width;
+
+    float edgeRow[3];
+    for (int i = 0; i < 3; i++)
+    {
+        edgeRow[i] = triangle.edgeB[i] * py + triangle.edgeC[i];
+    }
+    const float depthRow = triangle.depthY * py + triangle.depthC;
+
+    int32_t x = minX;
+
+#if defined(VIONIS_X86_KERNELS)
+    // Widths are a multiple of the tile size, so groups of four pixels starting at a multiple of four stay in the row.
+    // Pixels of a group outside the triangle fail the edge test.
+    x &= ~3;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 pixelOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 edgeA0 = _mm_set1_ps(triangle.edgeA[0]);
+    const __m128 edgeA1 = _mm_set1_ps(triangle.edgeA[1]);
+    const __m128 edgeA2 = _mm_set1_ps(triangle.edgeA[2]);
+    const __m128 edgeRow0 = _mm_set1_ps(edgeRow[0]);
+    const __m128 edgeRow1 = _mm_set1_ps(edgeRow[1]);
+    const __m128 edgeRow2 = _mm_set1_ps(edgeRow[2]);
+    const __m128 depthX = _mm_set1_ps(triangle.depthX);
+    const __m128 depthRowVector = _mm_set1_ps(depthRow);
+    const __m128 maxDepth = _mm_set1_ps(triangle.maxDepth);
+    for (; x <= maxX; x += 4)
+    {
+        const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), pixelOffsets);
+        __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA0, px), edgeRow0), zero);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA1, px), edgeRow1), zero));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA2, px), edgeRow2), zero));
+        if (_mm_movemask_ps(inside) == 0)
+        {
+            continue;
+        }
+
+        const __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthX, px), depthRowVector), maxDepth);
+        const __m128 current = _mm_loadu_ps(depth + x);
+        const __m128 nearest = _mm_min_ps(current, z);
+        _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+    }
+#endif
+
+    for (; x <= maxX; x++)
+    {
+        const auto px = static_cast<float>(x);
+        if (triangle.edgeA[0] * px + edgeRow[0] < 0.0f || triangle.edgeA[1] * px + edgeRow[1] < 0.0f ||
+            triangle.edgeA[2] * px + edgeRow[2] < 0.0f)
+        {
+            continue;
+        }
+        const float z = std::min(triangle.depthX * px + depthRow, triangle.maxDepth);
+        depth[x] = std::min(depth[x], z);
+    }
+}
+
+/**
+ * Tests a world space box against the occluders of the last render(). The box's corners are projected to find the
+ * pixels it touches and its nearest depth; it is occluded if every one of those pixels holds an occluder in front of
+ * that depth. Whole tiles are accepted from their farthest depth.
+ *
+ * @param boxMin Minimum corner of the box
+ * @param boxMax Maximum corner of the box
+ * @return Whether the box is hidden
+ */
+bool OcclusionBuffer::isOccluded(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        const glm::vec3 position{corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y,
+                                 corner & 4 ? boxMax.z : boxMin.z};
+        const glm::vec4 clip = m_viewProjection * glm::vec4{position, 1.0f};
+        if (clip.w <= 0.0f || clip.z < 0.0f)
+        {
+            return false;
+        }
+
+        float inverseW = 1.0f / clip.w;
+        float x = (clip.x * inverseW * 0.5f + 0.5f) * static_cast<float>(m_width);
+        float y = (clip.y * inverseW * 0.5f + 0.5f) * static_cast<float>(m_height);
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, clip.z * inverseW);
+    }
+
+    // Parts of the box off screen cannot be seen either; a box entirely off screen is left to frustum culling.
+    const auto x0 = static_cast<int32_t>(std::max(std::floor(minX), 0.0f));
+    const auto y0 = static_cast<int32_t>(std::max(std::floor(minY), 0.0f));
+    const auto x1 = static_cast<int32_t>(std::min(std::floor(maxX), static_cast<float>(m_width - 1)));
+    const auto y1 = static_cast<int32_t>(std::min(std::floor(maxY), static_cast<float>(m_height - 1)));
+    if (x0 > x1 || y0 > y1)
+    {
+        return false;
+    }
+
+    const auto tileSize = static_cast<int32_t>(TILE_SIZE);
+    for (int32_t tileY = y0 / tileSize; tileY <= y1 / tileSize; tileY++)
+    {
+        for (int32_t tileX = x0 / tileSize; tileX <= x1 / tileSize; tileX++)
+        {
+            if (m_tileDepth[tileY * m_tilesX + tileX] < nearest)
+            {
+                continue;
+            }
+
+            for (int32_t y = std::max(y0, tileY * tileSize); y <= std::min(y1, tileY * tileSize + tileSize - 1); y++)
+            {
+                const float *row = m_depth.data() + static_cast<size_t>(y) * m_width;
+                for (int32_t x = std::max(x0, tileX * tileSize); x <= std::min(x1, tileX * tileSize + tileSize - 1);
+                     x++)
+                {
+                    if (row[x] >= nearest)
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace vionis
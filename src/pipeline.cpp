@@ -10,21 +10,10 @@
 namespace vionis
 {
 
-Pipeline::Pipeline(Device &device, const std::string &vertFilepath, const std::string &fragFilepath,
-                   const PipelineConfigInfo &configInfo)
-    : device{device}
-{
-    createGraphicsPipeline(vertFilepath, fragFilepath, configInfo);
-}
-
-Pipeline::~Pipeline()
+namespace
 {
-    vkDestroyShaderModule(device.device(), vertShaderModule, nullptr);
-    vkDestroyShaderModule(device.device(), fragShaderModule, nullptr);
-    vkDestroyPipeline(device.device(), graphicsPipeline, nullptr);
-}
 
-std::vector<char> Pipeline::readFile(const std::string &filepath)
+std::vector<char> readFile(const std::string &filepath)
 {
     std::ifstream file{filepath, std::ios::ate | std::ios::binary};
 
@@ -43,6 +32,22 @@ std::vector<char> Pipeline::readFile(const std::string &filepath)
     return buffer;
 }
 
+} // namespace
+
+Pipeline::Pipeline(Device &device, const std::string &vertFilepath, const std::string &fragFilepath,
+                   const PipelineConfigInfo &configInfo)
+    : device{device}
+{
+    createGraphicsPipeline(vertFilepath, fragFilepath, configInfo);
+}
+
+Pipeline::~Pipeline()
+{
+    vkDestroyShaderModule(device.device(), vertShaderModule, nullptr);
+    vkDestroyShaderModule(device.device(), fragShaderModule, nullptr);
+    vkDestroyPipeline(device.device(), graphicsPipeline, nullptr);
+}
+
 void Pipeline::createGraphicsPipeline(const std::string &vertFilepath, const std::string &fragFilepath,
                                       const PipelineConfigInfo &configInfo)
 {
@@ -52,10 +57,14 @@ void Pipeline::createGraphicsPipeline(const std::string &vertFilepath, const std
            "Cannot create graphics pipeline: no renderPass provided in configInfo");
 
     auto vertCode = readFile(vertFilepath);
-    auto fragCode = readFile(fragFilepath);
-
     createShaderModule(vertCode, &vertShaderModule);
-    createShaderModule(fragCode, &fragShaderModule);
+
+    const bool hasFragmentStage = !fragFilepath.empty();
+    if (hasFragmentStage)
+    {
+        auto fragCode = readFile(fragFilepath);
+        createShaderModule(fragCode, &fragShaderModule);
+    }
 
     VkPipelineShaderStageCreateInfo shaderStages[2];
     shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -84,7 +93,7 @@ void Pipeline::createGraphicsPipeline(const std::string &vertFilepath, const std
 
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = hasFragmentStage ? 2 : 1;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &configInfo.inputAssemblyInfo;
@@ -213,4 +222,67 @@ void Pipeline::enableAlphaBlending(PipelineConfigInfo &configInfo)
     configInfo.colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
+void Pipeline::enableDepthOnly(PipelineConfigInfo &configInfo)
+{
+    configInfo.colorBlendAttachment.blendEnable = VK_FALSE;
+    configInfo.colorBlendAttachment.colorWriteMask = 0;
+
+    configInfo.bindingDescriptions = Model::Vertex::getPositionBindingDescriptions();
+    configInfo.attributeDescriptions = Model::Vertex::getPositionAttributeDescriptions();
+}
+
+void Pipeline::enableDepthEqual(PipelineConfigInfo &configInfo)
+{
+    configInfo.depthStencilInfo.depthWriteEnable = VK_FALSE;
+    configInfo.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+}
+
+// ---------- ComputePipeline ----------
+
+ComputePipeline::ComputePipeline(Device &device, const std::string &compFilepath, VkPipelineLayout pipelineLayout)
+    : device{device}
+{
+    assert(pipelineLayout != VK_NULL_HANDLE && "Cannot create compute pipeline: no pipelineLayout provided");
+
+    auto compCode = readFile(compFilepath);
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = compCode.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t *>(compCode.data());
+
+    if (vkCreateShaderModule(device.device(), &moduleInfo, nullptr, &compShaderModule) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create shader module");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.basePipelineIndex = -1;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+    if (vkCreateComputePipelines(device.device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) !=
+        VK_SUCCESS)
+    {
+        vkDestroyShaderModule(device.device(), compShaderModule, nullptr);
+        throw std::runtime_error("failed to create compute pipeline");
+    }
+}
+
+ComputePipeline::~ComputePipeline()
+{
+    vkDestroyShaderModule(device.device(), compShaderModule, nullptr);
+    vkDestroyPipeline(device.device(), computePipeline, nullptr);
+}
+
+void ComputePipeline::bind(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+}
+
 } // namespace vionis
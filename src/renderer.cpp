@@ -13,7 +13,11 @@ Renderer::Renderer(Window &window, Device &device) : window{window}, device{devi
     createCommandBuffers();
 }
 
-Renderer::~Renderer() { freeCommandBuffers(); }
+Renderer::~Renderer()
+{
+    destroyWorkerCommandPools();
+    freeCommandBuffers();
+}
 
 void Renderer::recreateSwapchain()
 {
@@ -64,6 +68,123 @@ void Renderer::freeCommandBuffers()
     commandBuffers.clear();
 }
 
+/**
+ * Creates the command pools secondary command buffers are recorded from, one per job system worker and frame in
+ * flight. Pools that already exist are kept.
+ *
+ * @param workerCount Number of workers that record in parallel
+ */
+void Renderer::createWorkerCommandPools(uint32_t workerCount)
+{
+    if (workerCommandPools[0].size() >= workerCount)
+    {
+        return;
+    }
+
+    QueueFamilyIndices queueFamilyIndices = device.findPhysicalQueueFamilies();
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    for (auto &framePools : workerCommandPools)
+    {
+        while (framePools.size() < workerCount)
+        {
+            WorkerCommandPool workerPool{};
+            if (vkCreateCommandPool(device.device(), &poolInfo, nullptr, &workerPool.pool) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create worker command pool!");
+            }
+            framePools.push_back(std::move(workerPool));
+        }
+    }
+}
+
+void Renderer::destroyWorkerCommandPools()
+{
+    // Destroying a pool frees its command buffers.
+    for (auto &framePools : workerCommandPools)
+    {
+        for (auto &workerPool : framePools)
+        {
+            vkDestroyCommandPool(device.device(), workerPool.pool, nullptr);
+        }
+        framePools.clear();
+    }
+}
+
+void Renderer::resetWorkerCommandPools()
+{
+    for (auto &workerPool : workerCommandPools[currentFrameIndex])
+    {
+        if (workerPool.usedCommandBuffers == 0)
+        {
+            continue;
+        }
+        vkResetCommandPool(device.device(), workerPool.pool, 0);
+        workerPool.usedCommandBuffers = 0;
+    }
+}
+
+/**
+ * Begins a secondary command buffer that continues the swapchain render pass. Must be called on the thread of the
+ * given worker, which owns the pool the buffer is allocated from.
+ *
+ * @param worker Job system worker that records the buffer
+ *
+ * @return The secondary command buffer, with viewport and scissor already set
+ */
+VkCommandBuffer Renderer::beginSecondaryCommandBuffer(uint32_t worker)
+{
+    WorkerCommandPool &workerPool = workerCommandPools[currentFrameIndex][worker];
+    if (workerPool.usedCommandBuffers == workerPool.commandBuffers.size())
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandPool = workerPool.pool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device.device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate secondary command buffer!");
+        }
+        workerPool.commandBuffers.push_back(commandBuffer);
+    }
+    VkCommandBuffer commandBuffer = workerPool.commandBuffers[workerPool.usedCommandBuffers++];
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = swapchain->getRenderPass();
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapchain->getFrameBuffer(currentImageIndex);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+
+    // Dynamic state is not inherited from the primary command buffer.
+    setViewportAndScissor(commandBuffer);
+    return commandBuffer;
+}
+
+void Renderer::endSecondaryCommandBuffer(VkCommandBuffer commandBuffer)
+{
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to record secondary command buffer!");
+    }
+}
+
 VkCommandBuffer Renderer::beginFrame()
 {
     assert(!isFrameStarted && "Can't call beginFrame while already in progress");
@@ -81,6 +202,8 @@ VkCommandBuffer Renderer::beginFrame()
     }
 
     isFrameStarted = true;
+    // The fence wait in acquireNextImage() retired the frame's previous submission.
+    resetWorkerCommandPools();
 
     auto commandBuffer = getCurrentCommandBuffer();
     VkCommandBufferBeginInfo beginInfo{};
@@ -117,28 +240,56 @@ void Renderer::endFrame()
     currentFrameIndex = (currentFrameIndex + 1) % Swapchain::MAX_FRAMES_IN_FLIGHT;
 }
 
-void Renderer::beginSwapchainRenderPass(VkCommandBuffer commandBuffer)
+void Renderer::beginSwapchainRenderPass(VkCommandBuffer commandBuffer, VkSubpassContents contents)
 {
     assert(isFrameStarted && "Can't call beginSwapchainRenderPass if frame is not in progress");
     assert(commandBuffer == getCurrentCommandBuffer() &&
            "Can't begin render pass on command buffer from a different frame");
 
+    std::array<VkClearValue, 2> clearValues{};
+    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+    clearValues[1].depthStencil = {1.0f, 0};
+    beginRenderPass(commandBuffer, swapchain->getRenderPass(), static_cast<uint32_t>(clearValues.size()),
+                    clearValues.data(), contents);
+}
+
+void Renderer::resumeSwapchainRenderPass(VkCommandBuffer commandBuffer, VkSubpassContents contents)
+{
+    assert(isFrameStarted && "Can't call resumeSwapchainRenderPass if frame is not in progress");
+    assert(commandBuffer == getCurrentCommandBuffer() &&
+           "Can't resume render pass on command buffer from a different frame");
+    assert(!isRenderPassStarted && "Can't resume the render pass while it is still in progress");
+
+    beginRenderPass(commandBuffer, swapchain->getResumeRenderPass(), 0, nullptr, contents);
+}
+
+void Renderer::beginRenderPass(VkCommandBuffer commandBuffer, VkRenderPass renderPass, uint32_t clearValueCount,
+                               const VkClearValue *clearValues, VkSubpassContents contents)
+{
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = swapchain->getRenderPass();
+    renderPassInfo.renderPass = renderPass;
     renderPassInfo.framebuffer = swapchain->getFrameBuffer(currentImageIndex);
 
     renderPassInfo.renderArea.offset = {0, 0};
     renderPassInfo.renderArea.extent = swapchain->getSwapchainExtent();
 
-    std::array<VkClearValue, 2> clearValues{};
-    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-    clearValues[1].depthStencil = {1.0f, 0};
-    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-    renderPassInfo.pClearValues = clearValues.data();
+    renderPassInfo.clearValueCount = clearValueCount;
+    renderPassInfo.pClearValues = clearValues;
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+    isRenderPassStarted = true;
+    secondaryRenderPass = contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS;
 
+    // A render pass filled by secondary command buffers takes no other commands, they set the state themselves.
+    if (!secondaryRenderPass)
+    {
+        setViewportAndScissor(commandBuffer);
+    }
+}
+
+void Renderer::setViewportAndScissor(VkCommandBuffer commandBuffer)
+{
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -159,6 +310,8 @@ void Renderer::endSwapchainRenderPass(VkCommandBuffer commandBuffer)
     assert(commandBuffer == getCurrentCommandBuffer() &&
            "Can't end render pass on command buffer from a different frame");
     vkCmdEndRenderPass(commandBuffer);
+    isRenderPassStarted = false;
+    secondaryRenderPass = false;
 }
 
 } // namespace vionis
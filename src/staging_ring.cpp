@@ -0,0 +1,108 @@
+#include "vionis/staging_ring.hpp"
+
+#include "vionis/device.hpp"
+#include "vionis/utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace vionis
+{
+
+StagingRing::StagingRing(Device &device, VkDeviceSize size) : m_device{device}, m_size{size}
+{
+    assert(size >= ALIGNMENT && "Staging ring is too small");
+
+    device.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_buffer,
+                        m_memory);
+    m_mapped = static_cast<char *>(m_memory.mapped);
+}
+
+StagingRing::~StagingRing()
+{
+    vkDestroyBuffer(m_device.device(), m_buffer, nullptr);
+    m_device.freeMemory(m_memory);
+}
+
+/**
+ * Takes contiguous space at the head of the ring
+ *
+ * @param minSize Smallest acceptable size, at most the size of the ring
+ * @param maxSize Size wanted
+ * @param granularity The size taken is a multiple of this
+ * @param offset Receives the offset of the space into the ring
+ * @param size Receives the size taken
+ * @return Whether there was enough space
+ */
+bool StagingRing::reserve(VkDeviceSize minSize, VkDeviceSize maxSize, VkDeviceSize granularity, VkDeviceSize &offset,
+                          VkDeviceSize &size)
+{
+    assert(minSize > 0 && minSize <= m_size && "Staging chunk does not fit into the ring");
+
+    // Free space is [head, end of ring) and [0, tail) while the staged data does not wrap, [head, tail) while it
+    // does, and the whole ring once everything has been released.
+    VkDeviceSize ranges[2][2];
+    uint32_t rangeCount = 0;
+    if (m_closedHeads.empty() && !m_open)
+    {
+        m_head = m_tail = 0;
+        ranges[rangeCount][0] = 0;
+        ranges[rangeCount++][1] = m_size;
+    }
+    else if (m_head > m_tail)
+    {
+        ranges[rangeCount][0] = m_head;
+        ranges[rangeCount++][1] = m_size;
+        ranges[rangeCount][0] = 0;
+        ranges[rangeCount++][1] = m_tail;
+    }
+    else if (m_head < m_tail)
+    {
+        ranges[rangeCount][0] = m_head;
+        ranges[rangeCount++][1] = m_tail;
+    }
+
+    for (uint32_t i = 0; i < rangeCount; i++)
+    {
+        const VkDeviceSize begin = alignUp(ranges[i][0], ALIGNMENT);
+        if (begin >= ranges[i][1])
+        {
+            continue;
+        }
+
+        const VkDeviceSize available = std::min(ranges[i][1] - begin, maxSize) / granularity * granularity;
+        if (available >= minSize)
+        {
+            m_head = begin + available;
+            m_open = true;
+            offset = begin;
+            size = available;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StagingRing::close()
+{
+    // An empty range would leave a closed head on the tail, which reserve() takes for a full ring.
+    if (!m_open)
+    {
+        return false;
+    }
+
+    m_closedHeads.push_back(m_head);
+    m_open = false;
+    return true;
+}
+
+void StagingRing::release()
+{
+    assert(!m_closedHeads.empty() && "No staging range to release");
+
+    m_tail = m_closedHeads.front();
+    m_closedHeads.pop_front();
+}
+
+} // namespace vionis
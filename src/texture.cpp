@@ -27,7 +27,7 @@ Texture::~Texture()
     vkDestroySampler(m_device.device(), m_textureSampler, nullptr);
     vkDestroyImageView(m_device.device(), m_textureImageView, nullptr);
     vkDestroyImage(m_device.device(), m_textureImage, nullptr);
-    vkFreeMemory(m_device.device(), m_textureImageMemory, nullptr);
+    m_device.freeMemory(m_textureImageMemory);
 }
 
 void Texture::updateDescriptor()
@@ -42,7 +42,6 @@ void Texture::loadImage(const std::string &filepath)
     int texWidth, texHeight, texChannels;
     stbi_set_flip_vertically_on_load(true);
     stbi_uc *pixels = stbi_load(filepath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
 
     if (!pixels)
     {
@@ -53,20 +52,6 @@ void Texture::loadImage(const std::string &filepath)
     m_extent = {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1};
     m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    m_device.createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer,
-                          stagingBufferMemory);
-
-    void *data;
-    vkMapMemory(m_device.device(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(m_device.device(), stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -78,17 +63,21 @@ void Texture::loadImage(const std::string &filepath)
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
     m_device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_textureImage, m_textureImageMemory);
-    m_device.transitionImageLayout(m_textureImage, m_format, VK_IMAGE_LAYOUT_UNDEFINED,
-                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels, m_layerCount);
-    m_device.copyBufferToImage(stagingBuffer, m_textureImage, static_cast<uint32_t>(texWidth),
-                               static_cast<uint32_t>(texHeight), m_layerCount);
+
+    // Recorded into the open upload batch together with the uploads of other assets, nothing waits for the GPU here.
+    // Only mip level 0 is written on the transfer side, the others are prepared by generateMipmaps().
+    UploadBatcher &uploads = m_device.uploadBatcher();
+    m_device.cmdTransitionImageLayout(uploads.transferCommandBuffer(), m_textureImage, m_format,
+                                      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, m_layerCount);
+    uploads.uploadToImage(m_textureImage, pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight),
+                          m_layerCount, 4);
+
+    stbi_image_free(pixels);
 
     generateMipmaps();
+    m_uploadTicket = uploads.pendingTicket();
 
     m_textureLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    vkDestroyBuffer(m_device.device(), stagingBuffer, nullptr);
-    vkFreeMemory(m_device.device(), stagingBufferMemory, nullptr);
 }
 
 void Texture::createImageView(VkImageViewType viewType)
@@ -138,7 +127,7 @@ void Texture::createSampler()
 
 void Texture::generateMipmaps()
 {
-    VkCommandBuffer commandBuffer = m_device.beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = m_device.uploadBatcher().graphicsCommandBuffer();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -161,8 +150,17 @@ void Texture::generateMipmaps()
         barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
         barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
+        // The level blitted into has not been touched yet, its previous contents can be discarded.
+        VkImageMemoryBarrier targetBarrier = barrier;
+        targetBarrier.subresourceRange.baseMipLevel = i;
+        targetBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        targetBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        targetBarrier.srcAccessMask = 0;
+        targetBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        VkImageMemoryBarrier barriers[] = {barrier, targetBarrier};
         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
-                             nullptr, 0, nullptr, 1, &barrier);
+                             nullptr, 0, nullptr, 2, barriers);
 
         VkImageBlit blit{};
         blit.srcOffsets[0] = {0, 0, 0};
@@ -203,8 +201,6 @@ void Texture::generateMipmaps()
     vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
                          nullptr, 0, nullptr, 1, &barrier);
 
-    m_device.endSingleTimeCommands(commandBuffer);
-
     m_textureLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 }
 
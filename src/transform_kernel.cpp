@@ -0,0 +1,108 @@
+#include "transform_kernel_simd.hpp"
+
+#include <cmath>
+
+#if defined(VIONIS_X86_KERNELS) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace vionis
+{
+
+namespace
+{
+
+#if defined(VIONIS_X86_KERNELS)
+
+bool cpuSupportsAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osXsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osXsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+bool cpuSupportsAvx512()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0xe6) != 0xe6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 16)) != 0;
+#else
+    return __builtin_cpu_supports("avx512f");
+#endif
+}
+
+#endif
+
+} // namespace
+
+void computeTransformMatricesScalar(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const float c3 = std::cos(transforms.rotationZ[i]);
+        const float s3 = std::sin(transforms.rotationZ[i]);
+        const float c2 = std::cos(transforms.rotationX[i]);
+        const float s2 = std::sin(transforms.rotationX[i]);
+        const float c1 = std::cos(transforms.rotationY[i]);
+        const float s1 = std::sin(transforms.rotationY[i]);
+
+        const glm::vec3 basis[3] = {
+            {c1 * c3 + s1 * s2 * s3, c2 * s3, c1 * s2 * s3 - c3 * s1},
+            {c3 * s1 * s2 - c1 * s3, c2 * c3, c1 * c3 * s2 + s1 * s3},
+            {c2 * s1, -s2, c1 * c2},
+        };
+        const float scale[3] = {transforms.scaleX[i], transforms.scaleY[i], transforms.scaleZ[i]};
+
+        glm::mat4 &world = worldMatrices[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            world[axis] = glm::vec4{basis[axis] * scale[axis], 0.0f};
+        }
+        world[3] = {transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i], 1.0f};
+    }
+}
+
+std::vector<TransformKernel> supportedTransformKernels()
+{
+    std::vector<TransformKernel> kernels{{"scalar", 1, computeTransformMatricesScalar}};
+
+#if defined(VIONIS_X86_KERNELS)
+    kernels.push_back({"sse2", 4, computeTransformMatricesSse2});
+    if (cpuSupportsAvx2())
+    {
+        kernels.push_back({"avx2", 8, computeTransformMatricesAvx2});
+    }
+    if (cpuSupportsAvx512())
+    {
+        kernels.push_back({"avx512", 16, computeTransformMatricesAvx512});
+    }
+#endif
+
+    return kernels;
+}
+
+const TransformKernel &selectTransformKernel()
+{
+    static const TransformKernel kernel = supportedTransformKernels().back();
+    return kernel;
+}
+
+} // namespace vionis
@@ -0,0 +1,50 @@
+#include "transform_kernel_simd.hpp"
+
+#include <immintrin.h>
+
+namespace vionis
+{
+
+namespace
+{
+
+struct Avx2
+{
+    using Float = __m256;
+    using Int = __m256i;
+    using Mask = __m256;
+
+    static constexpr uint32_t WIDTH = 8;
+
+    static Float load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, Float v) { _mm256_store_ps(p, v); }
+    static Float set1(float v) { return _mm256_set1_ps(v); }
+
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float fmadd(Float a, Float b, Float c) { return _mm256_fmadd_ps(a, b, c); }
+    static Float negate(Float a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+
+    static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static Float signBits(Float a) { return _mm256_and_ps(a, _mm256_set1_ps(-0.0f)); }
+    static Float bitXor(Float a, Float b) { return _mm256_xor_ps(a, b); }
+    static Float select(Mask mask, Float a, Float b) { return _mm256_blendv_ps(b, a, mask); }
+
+    static Int truncate(Float a) { return _mm256_cvttps_epi32(a); }
+    static Float toFloat(Int a) { return _mm256_cvtepi32_ps(a); }
+    static Int addInt(Int a, int b) { return _mm256_add_epi32(a, _mm256_set1_epi32(b)); }
+    static Int andInt(Int a, int b) { return _mm256_and_si256(a, _mm256_set1_epi32(b)); }
+    static Int andNotInt(Int a, int b) { return _mm256_andnot_si256(a, _mm256_set1_epi32(b)); }
+    static Float intToSign(Int a) { return _mm256_castsi256_ps(_mm256_slli_epi32(a, 29)); }
+    static Mask isZero(Int a) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, _mm256_setzero_si256())); }
+};
+
+} // namespace
+
+void computeTransformMatricesAvx2(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    simd::computeTransformMatricesSimd<Avx2>(transforms, count, worldMatrices);
+}
+
+} // namespace vionis
@@ -0,0 +1,60 @@
+#include "transform_kernel_simd.hpp"
+
+#include <immintrin.h>
+
+namespace vionis
+{
+
+namespace
+{
+
+// Only AVX-512F is assumed, so float bit operations go through the integer domain (the _ps forms need AVX-512DQ).
+struct Avx512
+{
+    using Float = __m512;
+    using Int = __m512i;
+    using Mask = __mmask16;
+
+    static constexpr uint32_t WIDTH = 16;
+
+    static Float load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, Float v) { _mm512_store_ps(p, v); }
+    static Float set1(float v) { return _mm512_set1_ps(v); }
+
+    static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+    static Float fmadd(Float a, Float b, Float c) { return _mm512_fmadd_ps(a, b, c); }
+    static Float negate(Float a) { return bitXor(a, _mm512_set1_ps(-0.0f)); }
+
+    static Float abs(Float a)
+    {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(0x7fffffff)));
+    }
+    static Float signBits(Float a)
+    {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_set1_epi32(INT32_MIN)));
+    }
+    static Float bitXor(Float a, Float b)
+    {
+        return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static Float select(Mask mask, Float a, Float b) { return _mm512_mask_blend_ps(mask, b, a); }
+
+    static Int truncate(Float a) { return _mm512_cvttps_epi32(a); }
+    static Float toFloat(Int a) { return _mm512_cvtepi32_ps(a); }
+    static Int addInt(Int a, int b) { return _mm512_add_epi32(a, _mm512_set1_epi32(b)); }
+    static Int andInt(Int a, int b) { return _mm512_and_si512(a, _mm512_set1_epi32(b)); }
+    static Int andNotInt(Int a, int b) { return _mm512_andnot_si512(a, _mm512_set1_epi32(b)); }
+    static Float intToSign(Int a) { return _mm512_castsi512_ps(_mm512_slli_epi32(a, 29)); }
+    static Mask isZero(Int a) { return _mm512_cmpeq_epi32_mask(a, _mm512_setzero_si512()); }
+};
+
+} // namespace
+
+void computeTransformMatricesAvx512(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    simd::computeTransformMatricesSimd<Avx512>(transforms, count, worldMatrices);
+}
+
+} // namespace vionis
@@ -0,0 +1,128 @@
+#pragma once
+
+// Shared implementation of the batched transform kernel. Each instruction set gets its own translation unit, compiled
+// with the matching target flags, that provides a traits struct S and instantiates computeTransformMatricesSimd<S>.
+//
+// S must provide Float, Int and Mask types, WIDTH, and the static operations used below.
+
+#include "vionis/transform_kernel.hpp"
+
+namespace vionis
+{
+
+void computeTransformMatricesScalar(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices);
+void computeTransformMatricesSse2(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices);
+void computeTransformMatricesAvx2(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices);
+void computeTransformMatricesAvx512(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices);
+
+namespace simd
+{
+
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "Kernels write glm::mat4 as 16 packed floats");
+
+// Cephes style sincos: reduce to [-pi/4, pi/4] in octants, evaluate both minimax polynomials and pick per lane.
+// Accurate to a couple of ulp for |x| below ~8192, which covers any sane Euler angle.
+template <typename S>
+inline void sincos(typename S::Float x, typename S::Float &sinOut, typename S::Float &cosOut)
+{
+    using F = typename S::Float;
+    using I = typename S::Int;
+
+    F sinSign = S::signBits(x);
+    x = S::abs(x);
+
+    I octant = S::truncate(S::mul(x, S::set1(1.27323954473516f)));
+    octant = S::andInt(S::addInt(octant, 1), ~1);
+    F y = S::toFloat(octant);
+
+    F sinSwap = S::intToSign(S::andInt(octant, 4));
+    F cosSign = S::intToSign(S::andNotInt(S::addInt(octant, -2), 4));
+    typename S::Mask polyMask = S::isZero(S::andInt(octant, 2));
+
+    x = S::fmadd(y, S::set1(-0.78515625f), x);
+    x = S::fmadd(y, S::set1(-2.4187564849853515625e-4f), x);
+    x = S::fmadd(y, S::set1(-3.77489497744594108e-8f), x);
+    sinSign = S::bitXor(sinSign, sinSwap);
+
+    F z = S::mul(x, x);
+
+    F cosPoly = S::fmadd(S::set1(2.443315711809948e-5f), z, S::set1(-1.388731625493765e-3f));
+    cosPoly = S::fmadd(cosPoly, z, S::set1(4.166664568298827e-2f));
+    cosPoly = S::mul(S::mul(cosPoly, z), z);
+    cosPoly = S::fmadd(S::set1(-0.5f), z, cosPoly);
+    cosPoly = S::add(cosPoly, S::set1(1.0f));
+
+    F sinPoly = S::fmadd(S::set1(-1.9515295891e-4f), z, S::set1(8.3321608736e-3f));
+    sinPoly = S::fmadd(sinPoly, z, S::set1(-1.6666654611e-1f));
+    sinPoly = S::fmadd(S::mul(sinPoly, z), x, x);
+
+    sinOut = S::bitXor(S::select(polyMask, sinPoly, cosPoly), sinSign);
+    cosOut = S::bitXor(S::select(polyMask, cosPoly, sinPoly), cosSign);
+}
+
+template <typename S>
+void computeTransformMatricesSimd(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    using F = typename S::Float;
+    constexpr uint32_t W = S::WIDTH;
+
+    alignas(64) float worldLanes[9][W];
+
+    uint32_t i = 0;
+    for (; i + W <= count; i += W)
+    {
+        F s1, c1, s2, c2, s3, c3;
+        sincos<S>(S::load(transforms.rotationY + i), s1, c1);
+        sincos<S>(S::load(transforms.rotationX + i), s2, c2);
+        sincos<S>(S::load(transforms.rotationZ + i), s3, c3);
+
+        // Same Tait-Bryan Y(1), X(2), Z(3) basis as TransformComponent::toMatrix, one column per scale axis.
+        F s1s2 = S::mul(s1, s2);
+        F c1s2 = S::mul(c1, s2);
+        const F basis[9] = {
+            S::fmadd(s1s2, s3, S::mul(c1, c3)), S::mul(c2, s3), S::sub(S::mul(c1s2, s3), S::mul(c3, s1)),
+            S::sub(S::mul(s1s2, c3), S::mul(c1, s3)), S::mul(c2, c3), S::fmadd(c1s2, c3, S::mul(s1, s3)),
+            S::mul(c2, s1), S::negate(s2), S::mul(c1, c2),
+        };
+
+        const F scale[3] = {S::load(transforms.scaleX + i), S::load(transforms.scaleY + i),
+                            S::load(transforms.scaleZ + i)};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int row = 0; row < 3; row++)
+            {
+                S::store(worldLanes[axis * 3 + row], S::mul(scale[axis], basis[axis * 3 + row]));
+            }
+        }
+
+        // Written through plain float pointers so no glm inline functions get instantiated with this target's flags.
+        for (uint32_t lane = 0; lane < W; lane++)
+        {
+            float *world = reinterpret_cast<float *>(worldMatrices + i + lane);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int row = 0; row < 3; row++)
+                {
+                    world[axis * 4 + row] = worldLanes[axis * 3 + row][lane];
+                }
+                world[axis * 4 + 3] = 0.0f;
+            }
+            world[12] = transforms.positionX[i + lane];
+            world[13] = transforms.positionY[i + lane];
+            world[14] = transforms.positionZ[i + lane];
+            world[15] = 1.0f;
+        }
+    }
+
+    if (i < count)
+    {
+        TransformArrays tail{transforms.positionX + i, transforms.positionY + i, transforms.positionZ + i,
+                             transforms.rotationX + i, transforms.rotationY + i, transforms.rotationZ + i,
+                             transforms.scaleX + i,    transforms.scaleY + i,    transforms.scaleZ + i};
+        computeTransformMatricesScalar(tail, count - i, worldMatrices + i);
+    }
+}
+
+} // namespace simd
+
+} // namespace vionis
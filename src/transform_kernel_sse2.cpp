@@ -0,0 +1,50 @@
+#include "transform_kernel_simd.hpp"
+
+#include <emmintrin.h>
+
+namespace vionis
+{
+
+namespace
+{
+
+struct Sse2
+{
+    using Float = __m128;
+    using Int = __m128i;
+    using Mask = __m128;
+
+    static constexpr uint32_t WIDTH = 4;
+
+    static Float load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, Float v) { _mm_store_ps(p, v); }
+    static Float set1(float v) { return _mm_set1_ps(v); }
+
+    static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float fmadd(Float a, Float b, Float c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static Float negate(Float a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+
+    static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static Float signBits(Float a) { return _mm_and_ps(a, _mm_set1_ps(-0.0f)); }
+    static Float bitXor(Float a, Float b) { return _mm_xor_ps(a, b); }
+    static Float select(Mask mask, Float a, Float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+    static Int truncate(Float a) { return _mm_cvttps_epi32(a); }
+    static Float toFloat(Int a) { return _mm_cvtepi32_ps(a); }
+    static Int addInt(Int a, int b) { return _mm_add_epi32(a, _mm_set1_epi32(b)); }
+    static Int andInt(Int a, int b) { return _mm_and_si128(a, _mm_set1_epi32(b)); }
+    static Int andNotInt(Int a, int b) { return _mm_andnot_si128(a, _mm_set1_epi32(b)); }
+    static Float intToSign(Int a) { return _mm_castsi128_ps(_mm_slli_epi32(a, 29)); }
+    static Mask isZero(Int a) { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_setzero_si128())); }
+};
+
+} // namespace
+
+void computeTransformMatricesSse2(const TransformArrays &transforms, uint32_t count, glm::mat4 *worldMatrices)
+{
+    simd::computeTransformMatricesSimd<Sse2>(transforms, count, worldMatrices);
+}
+
+} // namespace vionis
@@ -0,0 +1,497 @@
+#include "vionis/upload_batcher.hpp"
+
+#include "vionis/buffer.hpp"
+#include "vionis/device.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace vionis
+{
+
+namespace
+{
+
+// Smallest chunk worth splitting an upload into rather than waiting for more staging space.
+constexpr VkDeviceSize MIN_CHUNK_SIZE = 64 * 1024;
+
+} // namespace
+
+UploadBatcher::UploadBatcher(Device &device, VkDeviceSize stagingRingSize)
+    : m_device{device}, m_stagingRing{device, stagingRingSize}, m_transferQueue{device.hasTransferQueue()},
+      m_ownershipTransfer{device.hasTransferQueue() && device.transferQueueFamily() != device.graphicsQueueFamily()},
+      m_directUploads{device.memoryAllocator().supportsDirectUploads()}
+{
+}
+
+UploadBatcher::~UploadBatcher()
+{
+    waitIdle();
+
+    if (!m_freeTransferCommandBuffers.empty())
+    {
+        vkFreeCommandBuffers(m_device.device(), m_device.getTransferCommandPool(),
+                             static_cast<uint32_t>(m_freeTransferCommandBuffers.size()),
+                             m_freeTransferCommandBuffers.data());
+    }
+    if (!m_freeGraphicsCommandBuffers.empty())
+    {
+        vkFreeCommandBuffers(m_device.device(), m_device.getCommandPool(),
+                             static_cast<uint32_t>(m_freeGraphicsCommandBuffers.size()),
+                             m_freeGraphicsCommandBuffers.data());
+    }
+    for (VkSemaphore semaphore : m_freeSemaphores)
+    {
+        vkDestroySemaphore(m_device.device(), semaphore, nullptr);
+    }
+    for (VkFence fence : m_freeFences)
+    {
+        vkDestroyFence(m_device.device(), fence, nullptr);
+    }
+}
+
+/**
+ * Records a copy of data into a buffer, staged through the ring
+ *
+ * @param buffer Destination buffer, created with VK_BUFFER_USAGE_TRANSFER_DST_BIT
+ * @param offset Byte offset into the destination
+ * @param data Data to copy, no longer needed once the call returns
+ * @param size Number of bytes
+ *
+ * @return Ticket of the batch the last part of the copy went into
+ */
+UploadTicket UploadBatcher::uploadToBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    const VkDeviceSize minChunkSize = std::min(MIN_CHUNK_SIZE, m_stagingRing.size());
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    while (size > 0)
+    {
+        VkDeviceSize chunkSize;
+        VkDeviceSize stagingOffset = reserve(std::min(size, minChunkSize), size, 1, chunkSize);
+        memcpy(m_stagingRing.mapped() + stagingOffset, bytes, static_cast<size_t>(chunkSize));
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = stagingOffset;
+        copyRegion.dstOffset = offset;
+        copyRegion.size = chunkSize;
+        vkCmdCopyBuffer(transferCommandBuffer(), m_stagingRing.buffer(), buffer, 1, &copyRegion);
+
+        bytes += chunkSize;
+        offset += chunkSize;
+        size -= chunkSize;
+    }
+
+    if (barrier.size > 0)
+    {
+        transferOwnership(&barrier, nullptr);
+    }
+    return m_pendingTicket;
+}
+
+/**
+ * Writes data into a buffer in place if the host can see its memory, or records a staged copy into it otherwise
+ *
+ * @param buffer Destination buffer, created with VK_BUFFER_USAGE_TRANSFER_DST_BIT unless it is host visible
+ * @param offset Byte offset into the destination
+ * @param data Data to copy, no longer needed once the call returns
+ * @param size Number of bytes
+ *
+ * @return Ticket of the batch the last part of the copy went into, an already completed one for direct writes
+ */
+UploadTicket UploadBatcher::uploadToBuffer(Buffer &buffer, VkDeviceSize offset, const void *data, VkDeviceSize size)
+{
+    if (!(buffer.getMemoryPropertyFlags() & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+    {
+        return uploadToBuffer(buffer.getBuffer(), offset, data, size);
+    }
+
+    // Host writes are visible to every command submitted after them, so there is nothing to wait for.
+    if (!buffer.getMappedMemory() && buffer.map() != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to map upload buffer!");
+    }
+    memcpy(static_cast<char *>(buffer.getMappedMemory()) + offset, data, static_cast<size_t>(size));
+    if (buffer.flush(size, offset) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to flush upload buffer!");
+    }
+    return m_completedTicket;
+}
+
+/**
+ * Records a copy of texels into an image, staged through the ring in chunks of whole rows
+ *
+ * @param image Destination image, created with VK_IMAGE_USAGE_TRANSFER_DST_BIT
+ * @param data Texels of every layer, no longer needed once the call returns
+ * @param width Width of mip level 0
+ * @param height Height of mip level 0
+ * @param layerCount Number of layers
+ * @param texelSize Bytes per texel
+ *
+ * @return Ticket of the batch the last part of the copy went into
+ */
+UploadTicket UploadBatcher::uploadToImage(VkImage image, const void *data, uint32_t width, uint32_t height,
+                                          uint32_t layerCount, uint32_t texelSize)
+{
+    assert(StagingRing::ALIGNMENT % texelSize == 0 && "Unsupported texel size");
+
+    const VkDeviceSize rowSize = static_cast<VkDeviceSize>(width) * texelSize;
+    if (rowSize > m_stagingRing.size())
+    {
+        throw std::runtime_error("failed to upload image, a row does not fit into the staging ring!");
+    }
+    const auto minRowCount = static_cast<uint32_t>(
+        std::max<VkDeviceSize>(std::min(MIN_CHUNK_SIZE, m_stagingRing.size()) / rowSize, 1));
+
+    const char *bytes = static_cast<const char *>(data);
+    for (uint32_t layer = 0; layer < layerCount; layer++)
+    {
+        for (uint32_t row = 0; row < height;)
+        {
+            const uint32_t remainingRows = height - row;
+
+            VkDeviceSize chunkSize;
+            VkDeviceSize stagingOffset =
+                reserve(rowSize * std::min(minRowCount, remainingRows), rowSize * remainingRows, rowSize, chunkSize);
+            const auto rowCount = static_cast<uint32_t>(chunkSize / rowSize);
+            memcpy(m_stagingRing.mapped() + stagingOffset, bytes, static_cast<size_t>(chunkSize));
+
+            VkBufferImageCopy region{};
+            region.bufferOffset = stagingOffset;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = 0;
+            region.imageSubresource.baseArrayLayer = layer;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, static_cast<int32_t>(row), 0};
+            region.imageExtent = {width, rowCount, 1};
+            vkCmdCopyBufferToImage(transferCommandBuffer(), m_stagingRing.buffer(), image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+            bytes += chunkSize;
+            row += rowCount;
+        }
+    }
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = layerCount;
+    transferOwnership(nullptr, &barrier);
+    return m_pendingTicket;
+}
+
+VkCommandBuffer UploadBatcher::transferCommandBuffer()
+{
+    if (!m_transferQueue)
+    {
+        return graphicsCommandBuffer();
+    }
+    if (m_transferCommandBuffer == VK_NULL_HANDLE)
+    {
+        m_transferCommandBuffer = beginCommandBuffer(m_device.getTransferCommandPool(), m_freeTransferCommandBuffers);
+    }
+    return m_transferCommandBuffer;
+}
+
+VkCommandBuffer UploadBatcher::graphicsCommandBuffer()
+{
+    if (m_graphicsCommandBuffer == VK_NULL_HANDLE)
+    {
+        m_graphicsCommandBuffer = beginCommandBuffer(m_device.getCommandPool(), m_freeGraphicsCommandBuffers);
+    }
+    return m_graphicsCommandBuffer;
+}
+
+void UploadBatcher::flush()
+{
+    if (m_transferCommandBuffer != VK_NULL_HANDLE || m_graphicsCommandBuffer != VK_NULL_HANDLE)
+    {
+        submit();
+    }
+}
+
+VkMemoryPropertyFlags UploadBatcher::targetMemoryProperties() const
+{
+    return m_directUploads ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                           : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+bool UploadBatcher::isComplete(UploadTicket ticket)
+{
+    reclaim();
+    if (ticket == m_pendingTicket && m_transferCommandBuffer == VK_NULL_HANDLE &&
+        m_graphicsCommandBuffer == VK_NULL_HANDLE)
+    {
+        // Nothing was recorded into the open batch, so it stands for the last submitted one.
+        ticket--;
+    }
+    return ticket <= m_completedTicket;
+}
+
+void UploadBatcher::wait(UploadTicket ticket)
+{
+    if (ticket >= m_pendingTicket)
+    {
+        flush();
+    }
+    while (ticket > m_completedTicket && !m_inFlight.empty())
+    {
+        waitOldest();
+    }
+}
+
+void UploadBatcher::waitIdle()
+{
+    flush();
+    while (!m_inFlight.empty())
+    {
+        waitOldest();
+    }
+}
+
+/**
+ * Takes staging space, submitting the open batch and waiting for the oldest ones until there is enough
+ *
+ * @param minSize Smallest acceptable size, at most the size of the ring
+ * @param maxSize Size wanted
+ * @param granularity The size taken is a multiple of this
+ * @param size Receives the size taken
+ * @return Offset of the space into the ring
+ */
+VkDeviceSize UploadBatcher::reserve(VkDeviceSize minSize, VkDeviceSize maxSize, VkDeviceSize granularity,
+                                    VkDeviceSize &size)
+{
+    reclaim();
+
+    VkDeviceSize offset;
+    while (!m_stagingRing.reserve(minSize, maxSize, granularity, offset, size))
+    {
+        if (m_transferCommandBuffer != VK_NULL_HANDLE || m_graphicsCommandBuffer != VK_NULL_HANDLE)
+        {
+            submit();
+        }
+        else
+        {
+            waitOldest();
+        }
+    }
+    return offset;
+}
+
+/**
+ * Hands a range the transfer queue wrote over to the graphics queue family: released at the end of the transfer part
+ * of the batch, acquired at the start of the graphics part. Nothing to do when both are the same family.
+ *
+ * @param bufferBarrier Buffer range to transfer, or null
+ * @param imageBarrier Image subresources to transfer in their current layout, or null
+ */
+void UploadBatcher::transferOwnership(const VkBufferMemoryBarrier *bufferBarrier,
+                                      const VkImageMemoryBarrier *imageBarrier)
+{
+    if (!m_ownershipTransfer)
+    {
+        return;
+    }
+
+    VkBufferMemoryBarrier bufferBarriers[1];
+    VkImageMemoryBarrier imageBarriers[1];
+    const uint32_t bufferBarrierCount = bufferBarrier ? 1 : 0;
+    const uint32_t imageBarrierCount = imageBarrier ? 1 : 0;
+    if (bufferBarrier)
+    {
+        bufferBarriers[0] = *bufferBarrier;
+        bufferBarriers[0].srcQueueFamilyIndex = m_device.transferQueueFamily();
+        bufferBarriers[0].dstQueueFamilyIndex = m_device.graphicsQueueFamily();
+    }
+    if (imageBarrier)
+    {
+        imageBarriers[0] = *imageBarrier;
+        imageBarriers[0].srcQueueFamilyIndex = m_device.transferQueueFamily();
+        imageBarriers[0].dstQueueFamilyIndex = m_device.graphicsQueueFamily();
+    }
+
+    // Release: only the source half of the barrier applies.
+    bufferBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarriers[0].dstAccessMask = 0;
+    imageBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarriers[0].dstAccessMask = 0;
+    vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0, 0, nullptr, bufferBarrierCount, bufferBarriers, imageBarrierCount, imageBarriers);
+
+    // Acquire: only the destination half applies, the semaphore between the two parts orders it after the release.
+    bufferBarriers[0].srcAccessMask = 0;
+    bufferBarriers[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    imageBarriers[0].srcAccessMask = 0;
+    imageBarriers[0].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(graphicsCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0, 0, nullptr, bufferBarrierCount, bufferBarriers, imageBarrierCount, imageBarriers);
+}
+
+VkCommandBuffer UploadBatcher::beginCommandBuffer(VkCommandPool commandPool,
+                                                  std::vector<VkCommandBuffer> &freeCommandBuffers)
+{
+    VkCommandBuffer commandBuffer;
+    if (!freeCommandBuffers.empty())
+    {
+        commandBuffer = freeCommandBuffers.back();
+        freeCommandBuffers.pop_back();
+        vkResetCommandBuffer(commandBuffer, 0);
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(m_device.device(), &allocInfo, &commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate upload command buffer!");
+        }
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    return commandBuffer;
+}
+
+/**
+ * Submits the open batch together with a fence that releases its staging space. The transfer part goes first and
+ * signals a semaphore that the graphics part waits for; the graphics part always exists to carry the fence and the
+ * closing barrier.
+ */
+void UploadBatcher::submit()
+{
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if (m_transferCommandBuffer != VK_NULL_HANDLE)
+    {
+        vkEndCommandBuffer(m_transferCommandBuffer);
+
+        if (!m_freeSemaphores.empty())
+        {
+            semaphore = m_freeSemaphores.back();
+            m_freeSemaphores.pop_back();
+        }
+        else
+        {
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            if (vkCreateSemaphore(m_device.device(), &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create upload semaphore!");
+            }
+        }
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &m_transferCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &semaphore;
+
+        if (vkQueueSubmit(m_device.transferQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+    }
+
+    VkCommandBuffer commandBuffer = graphicsCommandBuffer();
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1,
+                         &barrier, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkFence fence;
+    if (!m_freeFences.empty())
+    {
+        fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+    else
+    {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(m_device.device(), &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+    }
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = semaphore != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &semaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    if (vkQueueSubmit(m_device.graphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+
+    const bool stagingRange = m_stagingRing.close();
+    m_inFlight.push_back({m_pendingTicket, m_transferCommandBuffer, commandBuffer, semaphore, fence, stagingRange});
+    m_transferCommandBuffer = VK_NULL_HANDLE;
+    m_graphicsCommandBuffer = VK_NULL_HANDLE;
+    m_pendingTicket++;
+}
+
+/**
+ * Retires every batch the GPU is done with, oldest first
+ */
+void UploadBatcher::reclaim()
+{
+    while (!m_inFlight.empty() && vkGetFenceStatus(m_device.device(), m_inFlight.front().fence) == VK_SUCCESS)
+    {
+        const Batch &batch = m_inFlight.front();
+        m_completedTicket = batch.ticket;
+        if (batch.stagingRange)
+        {
+            m_stagingRing.release();
+        }
+
+        vkResetFences(m_device.device(), 1, &batch.fence);
+        m_freeFences.push_back(batch.fence);
+        m_freeGraphicsCommandBuffers.push_back(batch.graphicsCommandBuffer);
+        if (batch.transferCommandBuffer != VK_NULL_HANDLE)
+        {
+            m_freeTransferCommandBuffers.push_back(batch.transferCommandBuffer);
+            m_freeSemaphores.push_back(batch.semaphore);
+        }
+        m_inFlight.pop_front();
+    }
+}
+
+void UploadBatcher::waitOldest()
+{
+    assert(!m_inFlight.empty() && "No upload batch to wait for");
+
+    vkWaitForFences(m_device.device(), 1, &m_inFlight.front().fence, VK_TRUE, UINT64_MAX);
+    reclaim();
+}
+
+} // namespace vionis